@@ -0,0 +1,235 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* simrun --adjacency.  See adjexport.h.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "simulator.h"
+#include "adjexport.h"
+
+char *adjacency_name;
+int adjacency_format = ADJ_MTX;
+
+typedef struct
+{
+  FILE *f;
+  long nnz_at;      // where the size line's nnz goes
+  int64_t nnz;
+} MtxFile;
+
+#define NNZ_WIDTH 20
+
+static int
+cmp_entry (const void *a, const void *b)
+{
+  const AdjEntry *x = a, *y = b;
+  if (x->col != y->col)
+    return x->col < y->col ? -1 : 1;
+  return (x->type > y->type) - (x->type < y->type);
+}
+
+// Sort one source's terminals and count the repeats, in place. Returns
+// how many entries are left.
+static int
+row_entries (Target *t, int target_count, const int *pop_first, AdjEntry *e)
+{
+  int n, in, out = 0, k = 0;
+
+  for (n = 0; n < target_count; n++)
+  {
+    if (t[n].disabled)
+      continue;
+    e[k].col = pop_first[t[n].syn->cpidx] + t[n].syn->cidx;
+    e[k].type = t[n].syn->stidx;
+    e[k].count = 1;
+    k++;
+  }
+  if (k == 0)
+    return 0;
+  qsort (e, k, sizeof *e, cmp_entry);
+  for (in = 1; in < k; in++)
+  {
+    if (cmp_entry (e + in, e + out) == 0)
+      e[out].count++;
+    else
+      e[++out] = e[in];
+  }
+  return out + 1;
+}
+
+static FILE *
+mtx_open (const char *name, int type, int rows, int cols, const int *pop_first, MtxFile *m)
+{
+  char *file_name;
+  int pn;
+
+  if (asprintf (&file_name, "%s.%d.mtx", name, type + 1) == -1)
+    exit (1);
+  if ((m->f = fopen (file_name, "w")) == 0)
+  {
+    fprintf (stdout, "SIMRUN: cannot write %s\n", file_name);
+    free (file_name);
+    return 0;
+  }
+  free (file_name);
+  fprintf (m->f, "%%%%MatrixMarket matrix coordinate integer general\n"
+           "%% simrun connections of synapse type %d, EQ %g\n"
+           "%% rows are source cells then fibers, columns target cells\n",
+           type + 1, S.net.syntype[type].EQ);
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    fprintf (m->f, "%% cell pop %d is %d to %d\n", pn + 1,
+             pop_first[pn] + 1, pop_first[pn] + S.net.cellpop[pn].cell_count);
+  fprintf (m->f, "%d %d ", rows, cols);
+  m->nnz_at = ftell (m->f);
+  fprintf (m->f, "%*s\n", NNZ_WIDTH, "");
+  return m->f;
+}
+
+// Write a source's entries, row is 0-based.
+static bool
+put_row (int format, FILE *bin, MtxFile *mtx, const char *name, int rows,
+         int cols, const int *pop_first, int row, AdjEntry *e, int count,
+         int64_t *nnz)
+{
+  int n;
+
+  if (format == ADJ_BIN)
+  {
+    *nnz += count;
+    return fwrite (e, sizeof *e, count, bin) == (size_t) count;
+  }
+  for (n = 0; n < count; n++)
+  {
+    MtxFile *m = mtx + e[n].type;
+    if (!m->f && !mtx_open (name, e[n].type, rows, cols, pop_first, m))
+      return false;
+    fprintf (m->f, "%d %d %d\n", row + 1, e[n].col + 1, e[n].count);
+    m->nnz++;
+    (*nnz)++;
+  }
+  return true;
+}
+
+bool
+adj_export (const char *name, int format)
+{
+  int pn, n, row = 0, cells = 0, fibers = 0, max_targets = 0;
+  int *pop_first;
+  int64_t *row_ptr = 0, nnz = 0;
+  AdjEntry *e;
+  AdjHeader h = {0};
+  MtxFile *mtx = 0;
+  FILE *bin = 0;
+  bool ok = true;
+
+  TMALLOC (pop_first, S.net.cellpop_count + 1);
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    pop_first[pn] = cells;
+    cells += cp->cell_count;
+    for (n = 0; n < cp->cell_count; n++)
+      max_targets = MAX (max_targets, cp->cell[n].target_count);
+  }
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    fibers += fp->fiber_count;
+    for (n = 0; n < fp->fiber_count; n++)
+      max_targets = MAX (max_targets, fp->fiber[n].target_count);
+  }
+  TMALLOC (e, max_targets + 1);
+  memcpy (h.magic, ADJ_MAGIC, sizeof h.magic);
+
+  if (format == ADJ_BIN)
+  {
+    if ((bin = fopen (name, "wb")) == 0)
+    {
+      fprintf (stdout, "SIMRUN: cannot write %s\n", name);
+      free (e);
+      free (pop_first);
+      return false;
+    }
+    TMALLOC (row_ptr, cells + fibers + 1);
+    ok = fwrite (&h, sizeof h, 1, bin) == 1;
+  }
+  else
+    TCALLOC (mtx, S.net.syntype_count + 1);
+
+  for (pn = 0; ok && pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    for (n = 0; ok && n < cp->cell_count; n++, row++)
+    {
+      Cell *c = cp->cell + n;
+      if (row_ptr)
+        row_ptr[row] = nnz;
+      ok = put_row (format, bin, mtx, name, cells + fibers, cells, pop_first, row, e,
+                    row_entries (c->target, c->target_count, pop_first, e), &nnz);
+    }
+  }
+  for (pn = 0; ok && pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    for (n = 0; ok && n < fp->fiber_count; n++, row++)
+    {
+      Fiber *f = fp->fiber + n;
+      if (row_ptr)
+        row_ptr[row] = nnz;
+      ok = put_row (format, bin, mtx, name, cells + fibers, cells, pop_first, row, e,
+                    row_entries (f->target, f->target_count, pop_first, e), &nnz);
+    }
+  }
+
+  if (bin)
+  {
+    row_ptr[row] = nnz;
+    h.rows = cells + fibers;
+    h.cols = cells;
+    h.cells = cells;
+    h.syntype_count = S.net.syntype_count;
+    h.nnz = nnz;
+    h.row_ptr_at = sizeof h + nnz * sizeof (AdjEntry);
+    ok = ok && fwrite (row_ptr, sizeof *row_ptr, row + 1, bin) == (size_t) row + 1
+            && fseek (bin, 0, SEEK_SET) == 0 && fwrite (&h, sizeof h, 1, bin) == 1;
+    ok = fclose (bin) == 0 && ok;
+    free (row_ptr);
+  }
+  for (n = 0; mtx && n < S.net.syntype_count; n++)
+    if (mtx[n].f)
+    {
+      ok = ok && fseek (mtx[n].f, mtx[n].nnz_at, SEEK_SET) == 0
+              && fprintf (mtx[n].f, "%-*ld", NNZ_WIDTH, (long) mtx[n].nnz) > 0;
+      ok = fclose (mtx[n].f) == 0 && ok;
+    }
+  free (mtx);
+  free (e);
+  free (pop_first);
+  if (ok)
+    fprintf (stdout, "SIMRUN: wrote %ld connections of %d cells and %d fibers to %s%s\n",
+             (long) nnz, cells, fibers, name, format == ADJ_BIN ? "" : ".N.mtx");
+  else
+    fprintf (stdout, "SIMRUN: could not write all of %s\n", name);
+  return ok;
+}
@@ -0,0 +1,73 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ADJEXPORT_H
+#define ADJEXPORT_H
+
+/* Sparse export of the built network's connections (simrun --adjacency).
+
+   Rows are the source cells, pop by pop, then the fibers, pop by pop.
+   Columns are the target cells in the same order.  An entry is how many
+   terminals the source has on the target's synapse of one synapse type.
+   Disabled terminals are left out.  Each source's terminals are sorted
+   and counted on their own, so memory use follows the largest terminal
+   count, not the network size.
+
+   ADJ_MTX writes one Matrix Market coordinate file per synapse type that
+   has any entries, name.N.mtx with N the 1-based synapse type.  Rows and
+   columns are 1-based, as Matrix Market wants.
+
+   ADJ_BIN writes one file, name, in CSR order:
+      AdjHeader
+      AdjEntry[nnz]           by row, then column, then type
+      int64_t row_ptr[rows + 1]   at row_ptr_at, entries of row r are
+                                  row_ptr[r] .. row_ptr[r + 1] - 1
+   Indexes are 0-based, in the byte order of the machine that wrote it.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {ADJ_MTX, ADJ_BIN};
+
+#define ADJ_MAGIC "SIMADJ1"
+
+typedef struct
+{
+  char magic[8];        // ADJ_MAGIC
+  int32_t rows;         // cells + fibers
+  int32_t cols;         // cells
+  int32_t cells;
+  int32_t syntype_count;
+  int64_t nnz;
+  int64_t row_ptr_at;   // file offset of row_ptr
+} AdjHeader;
+
+typedef struct
+{
+  int32_t col;
+  int32_t type;         // 0-based synapse type
+  int32_t count;
+} AdjEntry;
+
+extern char *adjacency_name;
+extern int adjacency_format;
+
+bool adj_export (const char *name, int format);
+
+#endif
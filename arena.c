@@ -0,0 +1,152 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Per-network bump allocator.  See arena.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "util.h"
+
+// Blocks are calloc'd, so for a block this big glibc hands back fresh
+// mmap'd pages and the zeroing is free until a page is touched.
+#define ARENA_BLOCK (16 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+struct ArenaBlock
+{
+  ArenaBlock *next;
+  size_t size;
+  size_t used;
+  char *data;
+  void (*release) (void *, size_t);  // for adopted blocks, else free
+};
+
+Arena *
+arena_new (void)
+{
+  Arena *a;
+  TCALLOC (a, 1);
+  return a;
+}
+
+static ArenaBlock *
+arena_block (Arena *a, size_t need)
+{
+  ArenaBlock *b;
+  size_t size = need > ARENA_BLOCK ? need : ARENA_BLOCK;
+
+  TCALLOC (b, 1);
+  TCALLOC (b->data, size);
+  b->size = size;
+  a->reserved += size;
+  a->blocks++;
+  return b;
+}
+
+void *
+arena_calloc (Arena *a, size_t n, size_t size)
+{
+  ArenaBlock *b = a->head;
+  size_t bytes;
+  void *p;
+
+  if (size && n > ((size_t) -1 - ARENA_ALIGN) / size)
+    DIE;
+  bytes = (n * size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+  if (!b || b->size - b->used < bytes)
+  {
+    ArenaBlock *nb = arena_block (a, bytes);
+    if (b && bytes > ARENA_BLOCK / 4)
+    {
+      // a big array gets a block of its own, and the current block
+      // stays at the head to take the small ones that follow
+      nb->next = b->next;
+      b->next = nb;
+    }
+    else
+    {
+      nb->next = b;
+      a->head = nb;
+    }
+    b = nb;
+  }
+  p = b->data + b->used;
+  b->used += bytes;
+  a->used += bytes;
+  a->allocs++;
+  return p;
+}
+
+void
+arena_free (Arena *a)
+{
+  ArenaBlock *b, *next;
+
+  if (!a)
+    return;
+  for (b = a->head; b; b = next)
+  {
+    next = b->next;
+    if (b->release)
+      b->release (b->data, b->size);
+    else
+      free (b->data);
+    free (b);
+  }
+  free (a);
+}
+
+/* Hand back the used part of each block, for saving the arena
+   contents.  The caller frees the array.
+*/
+int
+arena_spans (Arena *a, ArenaSpan **span)
+{
+  ArenaBlock *b;
+  int n = 0;
+
+  TMALLOC (*span, a->blocks + 1);
+  for (b = a->head; b; b = b->next, n++)
+  {
+    (*span)[n].data = b->data;
+    (*span)[n].used = b->used;
+  }
+  return n;
+}
+
+/* Make an arena of memory that is already filled in, such as a mapped
+   network image.  It is handed to release rather than free'd when the
+   arena goes.  Anything allocated later comes from new blocks.
+*/
+Arena *
+arena_adopt (void *data, size_t size, void (*release) (void *, size_t))
+{
+  Arena *a = arena_new ();
+  ArenaBlock *b;
+
+  TCALLOC (b, 1);
+  b->data = data;
+  b->size = b->used = size;
+  b->release = release;
+  a->head = b;
+  a->reserved = a->used = size;
+  a->blocks = 1;
+  a->allocs = 1;
+  return a;
+}
@@ -0,0 +1,68 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* A bump allocator that holds everything build_network allocates per
+   cell, fiber, terminal and synapse.  Memory comes from a short chain of
+   large zero-filled blocks and is never given back piece by piece; the
+   whole arena is released at once when its network goes away, which
+   makes dropping the old network on a mid-run update cost one free per
+   block instead of one per array.
+
+   Allocations are zeroed and 16 byte aligned.  An arena is not thread
+   safe; only the thread building the network may allocate from it.
+*/
+typedef struct ArenaBlock ArenaBlock;
+
+// The part of one block handed out so far, for arena_spans.
+typedef struct
+{
+  char *data;
+  size_t used;
+} ArenaSpan;
+
+typedef struct
+{
+  ArenaBlock *head;
+  size_t reserved;     // bytes in all blocks
+  size_t used;         // bytes handed out
+  long allocs;
+  int blocks;
+} Arena;
+
+#define ACALLOC(a, buf, n) ((buf = arena_calloc ((a), (n), sizeof *(buf))) || DIE)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+Arena *arena_new (void);
+void *arena_calloc (Arena *a, size_t n, size_t size);
+void arena_free (Arena *a);
+int arena_spans (Arena *a, ArenaSpan **span);
+Arena *arena_adopt (void *data, size_t size, void (*release) (void *, size_t));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
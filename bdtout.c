@@ -0,0 +1,186 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Buffered bdt/edt spike output.  See bdtout.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simulator.h"
+#include "bdtout.h"
+#include "util.h"
+
+#define BDT_EVENTS 32768
+#define BDT_FIELD 11    // widest int, with sign
+
+extern char *fmt;
+
+BdtMap *bdt_cell_map, *bdt_fiber_map;
+static int map_cellpops, map_fiberpops;
+
+static int *events;     // code, time pairs
+static int event_count;
+static char *text;
+static int width0, width1;
+static long event_total;
+static double write_sec;
+
+static void
+free_map (BdtMap *map, int count)
+{
+  for (int pn = 0; pn < count; pn++)
+  {
+    free (map[pn].off);
+    free (map[pn].code);
+  }
+  free (map);
+}
+
+// Fill one pop's table from the S.cwrit or S.fwrit entries for it. A
+// pop nobody records has no table.
+static void
+map_pop (BdtMap *m, int pn, int count, Plot *writ, int writ_count, int base, int wild)
+{
+  int widx, n, total = 0;
+  int *fill;
+
+  for (widx = 0; widx < writ_count; widx++)
+    if (writ[widx].pop == pn + 1)
+    {
+      if (wild && writ[widx].cell == 999999999)
+        total += count;
+      else if (writ[widx].cell >= 1 && writ[widx].cell <= count)
+        total++;
+    }
+  if (total == 0)
+    return;
+  TCALLOC (m->off, count + 1);
+  TMALLOC (m->code, total);
+  for (widx = 0; widx < writ_count; widx++)
+    if (writ[widx].pop == pn + 1)
+    {
+      if (wild && writ[widx].cell == 999999999)
+        for (n = 0; n < count; n++)
+          m->off[n + 1]++;
+      else if (writ[widx].cell >= 1 && writ[widx].cell <= count)
+        m->off[writ[widx].cell]++;
+    }
+  for (n = 0; n < count; n++)
+    m->off[n + 1] += m->off[n];
+  TMALLOC (fill, count + 1);
+  memcpy (fill, m->off, count * sizeof *fill);
+    // in S.cwrit order, which is the order the channels were written in
+  for (widx = 0; widx < writ_count; widx++)
+    if (writ[widx].pop == pn + 1)
+    {
+      if (wild && writ[widx].cell == 999999999)
+        for (n = 0; n < count; n++)
+          m->code[fill[n]++] = -(21 + n);
+      else if (writ[widx].cell >= 1 && writ[widx].cell <= count)
+        m->code[fill[writ[widx].cell - 1]++] = base + widx + 1;
+    }
+  free (fill);
+}
+
+// (Re)build the channel tables for the current network.
+void
+bdt_map (void)
+{
+  int pn;
+
+  free_map (bdt_cell_map, map_cellpops);
+  free_map (bdt_fiber_map, map_fiberpops);
+  TCALLOC (bdt_cell_map, S.net.cellpop_count + 1);
+  TCALLOC (bdt_fiber_map, S.net.fiberpop_count + 1);
+  map_cellpops = S.net.cellpop_count;
+  map_fiberpops = S.net.fiberpop_count;
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    map_pop (bdt_cell_map + pn, pn, S.net.cellpop[pn].cell_count, S.cwrit, S.cwrit_count, 100, 1);
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    map_pop (bdt_fiber_map + pn, pn, S.net.fiberpop[pn].fiber_count, S.fwrit, S.fwrit_count,
+             100 + S.cwrit_count, 0);
+}
+
+// Right justify val in width columns, as %*d does.
+static inline char *
+put_int (char *p, int val, int width)
+{
+  char digits[BDT_FIELD];
+  unsigned int u = val < 0 ? -(unsigned int) val : (unsigned int) val;
+  int n = 0;
+
+  do
+    digits[n++] = '0' + u % 10;
+  while ((u /= 10));
+  if (val < 0)
+    digits[n++] = '-';
+  for (int pad = width - n; pad > 0; pad--)
+    *p++ = ' ';
+  while (n)
+    *p++ = digits[--n];
+  return p;
+}
+
+void
+bdt_event (int code, int time)
+{
+  if (!events)
+  {
+    TMALLOC (events, 2 * BDT_EVENTS);
+    TMALLOC (text, BDT_EVENTS * (2 * BDT_FIELD + 1));
+    if (sscanf (fmt, "%%%dd%%%dd", &width0, &width1) != 2)
+      DIE;
+  }
+  events[2 * event_count] = code;
+  events[2 * event_count + 1] = time;
+  if (++event_count == BDT_EVENTS)
+    bdt_flush ();
+}
+
+// Format the queue and write it, with the linux newline whatever we
+// are running on.
+void
+bdt_flush (void)
+{
+  struct timespec t0, t1;
+  char *p = text;
+  int n;
+
+  if (event_count == 0)
+    return;
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (n = 0; n < event_count; n++)
+  {
+    p = put_int (p, events[2 * n], width0);
+    p = put_int (p, events[2 * n + 1], width1);
+    *p++ = 0x0a;
+  }
+  fwrite (text, 1, p - text, S.ofile) == (size_t) (p - text) || DIE;
+  event_total += event_count;
+  event_count = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  write_sec += t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+}
+
+void
+bdt_stats (long *count, double *sec)
+{
+  *count = event_total;
+  *sec = write_sec;
+}
@@ -0,0 +1,72 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BDTOUT_H
+#define BDTOUT_H
+
+#include <stdio.h>
+
+/* Buffered bdt/edt spike output.
+
+   The script lists the recorded cells in S.cwrit and fibers in S.fwrit.
+   bdt_map turns these into a (pop, cell) -> channel table for the
+   current network, so a spike finds its channels without a scan of the
+   whole list.  A cell can have more than one channel.  An exact entry
+   gives channel 100 + its position in S.cwrit; the 999999999 cell
+   wildcard gives channel 21 + the cell number, and is stored negated so
+   the smr path can tell the two apart.
+
+   bdt_event queues an event; the queue is formatted with S.ofile's
+   bdt or edt field widths and written with one fwrite when it fills,
+   and by bdt_flush.  Everything simloop writes to S.ofile has to go
+   through here to keep the order.
+*/
+
+typedef struct
+{
+  int *off;     // cell_count + 1 offsets into code, per pop
+  int *code;
+} BdtMap;
+
+extern BdtMap *bdt_cell_map, *bdt_fiber_map;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bdt_map (void);
+void bdt_event (int code, int time);
+void bdt_flush (void);
+void bdt_stats (long *count, double *sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+  // the channels of cell or fiber n of pop pn, *code is set to the first
+static inline int
+bdt_codes (const BdtMap *map, int pn, int n, const int **code)
+{
+  const int *off = map[pn].off;
+  if (!off)
+    return 0;
+  *code = map[pn].code + off[n];
+  return off[n + 1] - off[n];
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Micro-benchmark for the synaptic decay kernels in syndecay.c.
+
+   Builds synthetic populations of 10^4 to 10^7 synapses, runs every
+   kernel the CPU supports for the same number of steps, checks that they
+   all leave the same bits behind as the scalar kernel, and prints the
+   time per synapse per step.
+
+   usage: bench_decay [steps] [synapses per cell]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "syndecay.h"
+
+typedef struct
+{
+  SynDecay sd;
+  float *ring;
+  int *syn_off;
+  double *Gsum, *GEsum;
+  int syn_count, cell_count;
+} Bench;
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+bench_init (Bench *b, int syn_count, int per_cell)
+{
+  long ring_len = 0;
+  int k;
+
+  b->syn_count = syn_count;
+  b->cell_count = syn_count / per_cell;
+  b->sd.G = calloc (syn_count, sizeof (float));
+  b->sd.DCS = malloc (syn_count * sizeof (float));
+  b->sd.EQ = malloc (syn_count * sizeof (float));
+  b->sd.q = malloc (syn_count * sizeof (float *));
+  b->sd.q_count = malloc (syn_count * sizeof (int));
+  b->sd.qpos = calloc (syn_count, sizeof (int));
+  b->syn_off = malloc ((b->cell_count + 1) * sizeof (int));
+  b->Gsum = malloc (b->cell_count * sizeof (double));
+  b->GEsum = malloc (b->cell_count * sizeof (double));
+  if (!b->sd.G || !b->sd.DCS || !b->sd.EQ || !b->sd.q || !b->sd.q_count
+      || !b->sd.qpos || !b->syn_off || !b->Gsum || !b->GEsum)
+  {
+    fprintf (stderr, "out of memory\n");
+    exit (1);
+  }
+
+  srand (12345);
+  for (k = 0; k < syn_count; k++)
+  {
+    b->sd.q_count[k] = 2 + rand () % 30;
+    ring_len += b->sd.q_count[k];
+    b->sd.DCS[k] = 0.5 + 0.49 * rand () / RAND_MAX;
+    b->sd.EQ[k] = rand () % 2 ? 70 : -10;
+  }
+  b->ring = malloc (ring_len * sizeof (float));
+  if (!b->ring)
+  {
+    fprintf (stderr, "out of memory\n");
+    exit (1);
+  }
+  ring_len = 0;
+  for (k = 0; k < syn_count; k++)
+  {
+    b->sd.q[k] = b->ring + ring_len;
+    ring_len += b->sd.q_count[k];
+  }
+  for (k = 0; k <= b->cell_count; k++)
+    b->syn_off[k] = k * per_cell;
+}
+
+// Same starting state and the same input spikes for every kernel.
+static void
+bench_reset (Bench *b, long ring_len)
+{
+  memset (b->sd.G, 0, b->syn_count * sizeof (float));
+  memset (b->sd.qpos, 0, b->syn_count * sizeof (int));
+  memset (b->ring, 0, ring_len * sizeof (float));
+}
+
+static void
+bench_input (Bench *b, int step)
+{
+  int k;
+  for (k = step % 7; k < b->syn_count; k += 7)
+    b->sd.q[k][(b->sd.qpos[k] + 1) % b->sd.q_count[k]] += 0.25f * (1 + step % 3);
+}
+
+int
+main (int argc, char **argv)
+{
+  int steps = argc > 1 ? atoi (argv[1]) : 100;
+  int per_cell = argc > 2 ? atoi (argv[2]) : 4;
+  const SynDecayKernel *list;
+  int kernel_count = syn_decay_kernels (&list);
+  int size;
+
+  if (steps < 1 || per_cell < 1)
+  {
+    fprintf (stderr, "usage: %s [steps] [synapses per cell]\n", argv[0]);
+    return 1;
+  }
+  printf ("%10s %8s %12s %12s %8s\n", "synapses", "kernel", "ns/syn/step", "speedup", "same");
+  for (size = 10000; size <= 10000000; size *= 10)
+  {
+    Bench b;
+    long ring_len = 0;
+    float *G_ref;
+    double *Gsum_ref, *GEsum_ref, t_scalar = 0;
+    int kn, k, step;
+
+    bench_init (&b, size - size % per_cell, per_cell);
+    for (k = 0; k < b.syn_count; k++)
+      ring_len += b.sd.q_count[k];
+    G_ref = malloc (b.syn_count * sizeof (float));
+    Gsum_ref = malloc (b.cell_count * sizeof (double));
+    GEsum_ref = malloc (b.cell_count * sizeof (double));
+
+      // scalar is last in the list, run it first as the reference
+    for (kn = kernel_count - 1; kn >= 0; kn--)
+    {
+      double t, start;
+      int same;
+
+      syn_decay = list[kn];
+      bench_reset (&b, ring_len);
+      t = 0;
+      for (step = 0; step < steps; step++)
+      {
+        bench_input (&b, step);
+        start = now ();
+        syn_decay.decay (&b.sd, 0, b.syn_count);
+        syn_decay_sums (&b.sd, b.syn_off, 0, b.cell_count, 0, b.Gsum, b.GEsum);
+        t += now () - start;
+      }
+      if (kn == kernel_count - 1)
+      {
+        t_scalar = t;
+        memcpy (G_ref, b.sd.G, b.syn_count * sizeof (float));
+        memcpy (Gsum_ref, b.Gsum, b.cell_count * sizeof (double));
+        memcpy (GEsum_ref, b.GEsum, b.cell_count * sizeof (double));
+      }
+      same = memcmp (G_ref, b.sd.G, b.syn_count * sizeof (float)) == 0
+          && memcmp (Gsum_ref, b.Gsum, b.cell_count * sizeof (double)) == 0
+          && memcmp (GEsum_ref, b.GEsum, b.cell_count * sizeof (double)) == 0;
+      printf ("%10d %8s %12.3f %12.2f %8s\n", b.syn_count, list[kn].name,
+              t * 1e9 / steps / b.syn_count, t_scalar / t, same ? "yes" : "NO");
+    }
+    free (G_ref);
+    free (Gsum_ref);
+    free (GEsum_ref);
+    free (b.sd.G);
+    free (b.sd.DCS);
+    free (b.sd.EQ);
+    free (b.sd.q);
+    free (b.sd.q_count);
+    free (b.sd.qpos);
+    free (b.ring);
+    free (b.syn_off);
+    free (b.Gsum);
+    free (b.GEsum);
+  }
+  return 0;
+}
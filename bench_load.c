@@ -0,0 +1,184 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Benchmark for the .sim and .snd loader.
+
+   Loads a file the way read_sim does, from a mapping with
+   load_buf_open, and the way simbuild does, from a FILE with
+   load_struct, as many times as asked, into the same struct each time
+   as a mid-run update does.  Prints the time per load, MB and lines per
+   second for each, and for just reading the lines with getline, which
+   is about as fast as any loader that goes through stdio can be.
+
+   A file whose name ends in .snd loads into an inode_global, anything
+   else into a simulator_global.
+
+   usage: bench_load file [loads]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simulator.h"
+#include "inode.h"
+#include "hash.h"
+#include "fileio.h"
+#include "inode_hash.h"
+#include "simulator_hash.h"
+
+struct StructInfo *(*struct_info_fn) (const char *str, unsigned int len);
+struct StructMembers *(*struct_members_fn) (const char *str, unsigned int len);
+
+simulator_global S;
+inode_global D;
+
+static char *struct_name;
+static void *struct_ptr;
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+load_mapped (char *name)
+{
+  LoadBuf b;
+
+  if (!load_buf_open (&b, name) || !load_buf_read_version (&b))
+  {
+    fprintf (stderr, "bench_load: cannot load %s\n", name);
+    exit (1);
+  }
+  load_struct_buf (&b, struct_name, struct_ptr, 1);
+  load_buf_close (&b);
+}
+
+static void
+load_stdio (char *name)
+{
+  FILE *f;
+
+  if ((f = load_struct_open (name)) == 0)
+  {
+    fprintf (stderr, "bench_load: cannot load %s\n", name);
+    exit (1);
+  }
+  load_struct (f, struct_name, struct_ptr, 1);
+  fclose (f);
+}
+
+static long line_count;
+
+static void
+read_lines (char *name)
+{
+  FILE *f;
+  char *s = 0;
+  size_t slen = 0;
+
+  if ((f = fopen (name, "r")) == 0)
+  {
+    fprintf (stderr, "bench_load: cannot open %s\n", name);
+    exit (1);
+  }
+  for (line_count = 0; getline (&s, &slen, f) > 0; line_count++)
+    ;
+  free (s);
+  fclose (f);
+}
+
+// best and mean seconds per load
+static void
+run (void (*load)(char *), char *name, int loads, double *best, double *mean)
+{
+  double total = 0, t;
+  int n;
+
+  *best = 1e30;
+  for (n = 0; n < loads; n++)
+  {
+    t = now ();
+    load (name);
+    t = now () - t;
+    total += t;
+    if (t < *best)
+      *best = t;
+  }
+  *mean = total / loads;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const struct
+  {
+    const char *name;
+    void (*load)(char *);
+  } loaders[] = {{"mapped", load_mapped}, {"stdio", load_stdio}, {"getline", read_lines}};
+  int loads = argc > 2 ? atoi (argv[2]) : 20;
+  size_t len;
+  long bytes;
+  FILE *f;
+  int n;
+
+  if (argc < 2 || loads < 1)
+  {
+    fprintf (stderr, "usage: %s file [loads]\n", argv[0]);
+    return 1;
+  }
+  len = strlen (argv[1]);
+  if (len > 4 && strcmp (argv[1] + len - 4, ".snd") == 0)
+  {
+    struct_info_fn = inode_struct_info;
+    struct_members_fn = inode_struct_members;
+    struct_name = "inode_global";
+    struct_ptr = &D;
+  }
+  else
+  {
+    struct_info_fn = simulator_struct_info;
+    struct_members_fn = simulator_struct_members;
+    struct_name = "simulator_global";
+    struct_ptr = &S;
+  }
+  if ((f = fopen (argv[1], "r")) == 0 || fseek (f, 0, SEEK_END) || (bytes = ftell (f)) < 0)
+  {
+    fprintf (stderr, "bench_load: cannot open %s\n", argv[1]);
+    return 1;
+  }
+  fclose (f);
+  read_lines (argv[1]);
+  load_mapped (argv[1]);   // the first load allocates the arrays
+
+  printf ("%s: %ld bytes, %ld lines, %d loads\n", argv[1], bytes, line_count, loads);
+  printf ("%-8s %12s %12s %10s %14s\n", "loader", "best ms", "mean ms", "MB/s", "lines/s");
+  for (n = 0; n < (int) (sizeof loaders / sizeof loaders[0]); n++)
+  {
+    double best, mean;
+    run (loaders[n].load, argv[1], loads, &best, &mean);
+    printf ("%-8s %12.3f %12.3f %10.1f %14.0f\n", loaders[n].name, best * 1e3, mean * 1e3,
+            bytes / best / 1e6, line_count / best);
+  }
+  return 0;
+}
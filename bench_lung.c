@@ -0,0 +1,195 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Benchmark for simrun --lung-thread.
+
+   Couples the lung model to a synthetic cell update that does what
+   simloop does with it: the cells get an injected current that follows
+   the lung volume, and their spike rates the step before become the
+   phrenic and abdominal drive. Runs the same simulated time with lung ()
+   called in line and with it on the lung thread, each in its own process
+   since the lung model keeps its state in statics, and prints the wall
+   time per simulated second and whether the two runs produced the same
+   lung State every step.
+
+   usage: bench_lung [simulated seconds] [cells] [step in ms]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lung.h"
+#include "lungthread.h"
+
+char inPath[2048];
+char outPath[2048];
+
+typedef struct
+{
+  double wall;          // seconds for the whole run
+  double waited;        // seconds the cells waited for the lung thread
+  unsigned long hash;   // of every State, to compare the runs
+} Result;
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long
+hash_state (unsigned long h, const State *st)
+{
+  const unsigned char *b = (const unsigned char *) st;
+  size_t n;
+  for (n = 0; n < sizeof *st; n++)
+    h = (h ^ b[n]) * 1099511628211UL;
+  return h;
+}
+
+// Half the cells drive the phrenic, half the abdominal, on a 3 s cycle
+// with the lung volume feeding back as an injected current. Returns the
+// next step's motor drive.
+static Motor
+cell_update (float *Vm, int cells, int step, double step_ms, double volume)
+{
+  double osc = sin (2 * M_PI * step * step_ms / 3000.);
+  int half = cells / 2, fired[2] = {0, 0}, cn;
+  Motor m = {0, 0, 0, 0, 0, 0};
+
+  for (cn = 0; cn < cells; cn++)
+  {
+    int pop = cn >= half;
+    double drive = (pop ? -osc : osc) * (0.06 + 0.04 * (cn % 7) / 7.) - 0.0005 * volume;
+    double v = Vm[cn] * exp (-step_ms / 4.) + (drive > 0 ? drive : 0);
+    if (v > 1)
+    {
+      fired[pop]++;
+      v = 0;
+    }
+    Vm[cn] = v;
+  }
+  m.phrenic = fired[0] / (double) half / (step_ms / 1000) / 100;
+  m.abdominal = fired[1] / (double) (cells - half) / (step_ms / 1000) / 20;
+  m.pca = 10;
+  m.ta = 5;
+  return m;
+}
+
+static Result
+run (bool threaded, double seconds, int cells, double step_ms)
+{
+  int steps = seconds * 1000 / step_ms, n;
+  float *Vm = calloc (cells, sizeof *Vm);
+  Motor m = {0, 0, 0, 0, 0, 0};
+  State state, next;
+  Result r = {0, 0, 14695981039346656037UL};
+  double start;
+
+  if (!Vm)
+  {
+    fprintf (stderr, "out of memory\n");
+    exit (1);
+  }
+  state = lung (m, step_ms);
+  if (threaded)
+    lung_thread_start ();
+  start = now ();
+  for (n = 0; n < steps; n++)
+  {
+    if (threaded)
+      lung_thread_post (m, step_ms);
+    else
+      next = lung (m, step_ms);
+    m = cell_update (Vm, cells, n, step_ms, state.volume);
+    if (threaded)
+      next = lung_thread_wait ();
+    state = next;
+    r.hash = hash_state (r.hash, &state);
+  }
+  r.wall = now () - start;
+  if (threaded)
+  {
+    r.waited = lung_thread_waited ();
+    lung_thread_stop ();
+  }
+  free (Vm);
+  return r;
+}
+
+static Result
+run_child (bool threaded, double seconds, int cells, double step_ms)
+{
+  Result r;
+  int fd[2];
+  pid_t pid;
+
+  if (pipe (fd) || (pid = fork ()) < 0)
+  {
+    perror ("bench_lung");
+    exit (1);
+  }
+  if (pid == 0)
+  {
+    close (fd[0]);
+    r = run (threaded, seconds, cells, step_ms);
+    if (write (fd[1], &r, sizeof r) != sizeof r)
+      _exit (1);
+    _exit (0);
+  }
+  close (fd[1]);
+  if (read (fd[0], &r, sizeof r) != sizeof r)
+  {
+    fprintf (stderr, "bench_lung: %s run failed\n", threaded ? "threaded" : "inline");
+    exit (1);
+  }
+  close (fd[0]);
+  waitpid (pid, NULL, 0);
+  return r;
+}
+
+int
+main (int argc, char **argv)
+{
+  double seconds = argc > 1 ? atof (argv[1]) : 10;
+  int cells = argc > 2 ? atoi (argv[2]) : 100000;
+  double step_ms = argc > 3 ? atof (argv[3]) : 0.5;
+  Result in, th;
+
+  if (seconds <= 0 || cells < 2 || step_ms <= 0)
+  {
+    fprintf (stderr, "usage: %s [simulated seconds] [cells] [step in ms]\n", argv[0]);
+    return 1;
+  }
+  in = run_child (false, seconds, cells, step_ms);
+  th = run_child (true, seconds, cells, step_ms);
+  printf ("%d cells, %g ms steps, %g simulated seconds\n", cells, step_ms, seconds);
+  printf ("%-10s %16s\n", "lung", "wall s/sim s");
+  printf ("%-10s %16.3f\n", "inline", in.wall / seconds);
+  printf ("%-10s %16.3f   (cells waited %.3f s for the lung)\n", "thread", th.wall / seconds, th.waited);
+  printf ("speedup %.2f, same lung states: %s\n", in.wall / th.wall, in.hash == th.hash ? "yes" : "NO");
+  return in.hash != th.hash;
+}
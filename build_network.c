@@ -22,9 +22,16 @@ This file is part of the USF Neural Simulator suite.
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
 #include "simulator.h"
 #include "inode.h"
 #include "simrun_wrap.h"
+#include "cellstate.h"
+#include "csr.h"
+#include "arena.h"
+#include "expr.h"
+#include "threadpool.h"
+#include <time.h>
 #include <string.h>
           
 #define BOUNDS(idx, count) ((idx) >= 0 && (idx) < (count)) || DIE
@@ -46,15 +53,51 @@ extern int learnCPop[MAX_INODES];
 extern int numCPop;
 extern int learnFPop[MAX_INODES];
 extern int numFPop;
+extern int csr_flag;
+extern int num_threads;
 
 typedef struct
 {
   Syn *ptr;
   int maxqidx;
+  uint64_t last;    // order + 1 of the last terminal attached, and its STR
 } SynInfo;
 
+#define SYN_USED ((Syn *) 1)
+
+  // a run of sources, cells or fibers, for one pool task
+typedef struct
+{
+  bool fiber;
+  int pidx;
+  int first;
+  int last;
+  int64_t order0;   // order of its first source's first terminal
+} SrcChunk;
+
+#define BUILD_CHUNK 256
+
+static Arena *scratch;     // build-only storage, the synapse cube
 static SynInfo ***synapse; // see lengthy comment at end of file with some
                            // clues about how this is used.
+static SrcChunk *src_chunk;
+static int src_chunk_count;
+
+static inline void
+atomic_max (int *p, int v)
+{
+  int old = __atomic_load_n (p, __ATOMIC_RELAXED);
+  while (v > old && !__atomic_compare_exchange_n (p, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static inline void
+atomic_max64 (uint64_t *p, uint64_t v)
+{
+  uint64_t old = __atomic_load_n (p, __ATOMIC_RELAXED);
+  while (v > old && !__atomic_compare_exchange_n (p, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
 
 double
 ran (int *i)
@@ -67,13 +110,44 @@ ran (int *i)
   return x / 4294967296.0; // 0.0 - 1.0
 }
 
+/* Return the seed ran() would leave behind after being called n times
+   starting from seed i, without making the calls. Each call is the map
+   i -> 69069 * i + 1 (mod 2^32), so n calls compose into one map
+   i -> a * i + c, built here by squaring.
+*/
+int
+ran_skip (int i, unsigned long n)
+{
+  uint32_t a = 1, c = 0;          // accumulated map
+  uint32_t sa = 69069, sc = 1;    // map for the current power of two steps
+
+  for ( ; n; n >>= 1)
+  {
+    if (n & 1)
+    {
+      a = sa * a;
+      c = sa * c + sc;
+    }
+    sc = sa * sc + sc;
+    sa = sa * sa;
+  }
+  return (int)(a * (uint32_t) i + c);
+}
+
+/* The passes over every terminal (count_to_synapses, then
+   attach_to_synapses) run on the thread pool, a run of sources per task.
+   order is the terminal's place in the serial build, sources in the
+   order cells then fibers, pop by pop, and their terminals in turn.
+*/
+typedef void (*TermFunc) (TargetPop*, CellPop*, Target*, int, int, int, int64_t);
+
 /* func is function to call. Choices are:
    count_to_synapses(...)
    attach_to_synapses(...) 
 */
 static inline void
 for_terminals (int iseed, Target *target, int target_count, TargetPop *tp, int tidx0,
-          void (*func)(TargetPop*, CellPop*, Target*, int, int, int))
+          int64_t order0, TermFunc func)
 {
   int tidx;
   for (tidx = 0; tidx < tp->NT; tidx++) {
@@ -119,7 +193,7 @@ for_terminals (int iseed, Target *target, int target_count, TargetPop *tp, int t
            fprintf (stdout, "bounds2: tidx0 %d, tp->NT %d, tidx %d, target_count %d cellpopcount %d \n", tidx0, tp->NT, tidx, target_count,S.net.cellpop_count); fflush(stdout);
         }
         BOUNDS (tidx0 + tidx, target_count);
-        func (tp, tcp, target + tidx0 + tidx, tcpidx, tcidx, qidx);
+        func (tp, tcp, target + tidx0 + tidx, tcpidx, tcidx, qidx, order0 + tidx0 + tidx);
      }
   }
 }
@@ -134,7 +208,7 @@ for_terminals (int iseed, Target *target, int target_count, TargetPop *tp, int t
 //** common area where senders store firing history and where receivers
 //** decide if the sender strength should be modified.
 static inline void
-attach_to_synapses (TargetPop *tp, CellPop *tcp, Target* t, int tcpidx, int tcidx, int qidx)
+attach_to_synapses (TargetPop *tp, CellPop *tcp, Target* t, int tcpidx, int tcidx, int qidx, int64_t order)
 {
   // JAH:
   // tp - target population
@@ -146,12 +220,16 @@ attach_to_synapses (TargetPop *tp, CellPop *tcp, Target* t, int tcpidx, int tcid
   BOUNDS (tcpidx, S.net.cellpop_count);
   BOUNDS (tcidx, S.net.cellpop[tcpidx].cell_count);
   BOUNDS (tp->TYPE - 1, S.net.syntype_count);
-  t->syn = synapse[tcpidx][tcidx][tp->TYPE-1].ptr;
+  SynInfo *si = &synapse[tcpidx][tcidx][tp->TYPE-1];
+  t->syn = si->ptr;
   t->delay = qidx;
   t->strength = tp->STR;
   t->disabled = 0;
-  t->syn->initial_strength = tp->STR;
-  t->syn->lrn_strength = tp->STR;
+    // Other tasks may hit the same synapse. It gets the STR of the one
+    // that is last in the serial order, set by set_strengths.
+  uint32_t str;
+  memcpy (&str, &tp->STR, sizeof str);
+  atomic_max64 (&si->last, (uint64_t) (order + 1) << 32 | str);
 
 //  if(Debug) printf("attach syn ptr %p to synapse[%d][%d][%d]  vals: delay (qidx):%d str:%f disabled:%d\n", t->syn, tcpidx,tcidx,tp->TYPE-1, t->delay, t->strength, t->disabled);
   if(Debug) printf("attach synapse[%d][%d][%d]  vals: delay (qidx):%d str:%f disabled:%d\n", tcpidx,tcidx,tp->TYPE-1, t->delay, t->strength, t->disabled);
@@ -163,107 +241,184 @@ attach_to_synapses (TargetPop *tp, CellPop *tcp, Target* t, int tcpidx, int tcid
 // Note that this STRONGLY assumes that the cell/fiber does not 
 // have more than one of the same type of synapse. If so, it will not be counted.
 // Of course, why would you do this?
+// The cells' syn_count is added up from the flags by count_syns.
 static inline void
-count_to_synapses (TargetPop *tp, CellPop *tcp, Target *target, int tcpidx, int tcidx, int qidx)
+count_to_synapses (TargetPop *tp, CellPop *tcp, Target *target, int tcpidx, int tcidx, int qidx, int64_t order)
 {
-  Cell *tc = tcp->cell + tcidx;
-
-  if (Debug) printf ("tgt cellpop %d tgt cell %d syntype offset %d cell count: %d\n", tcpidx, tcidx, tp->TYPE, tcp->cell_count);
-  fflush(stdout);
+  (void) target;
+  (void) order;
+  if (Debug) {
+    printf ("tgt cellpop %d tgt cell %d syntype offset %d cell count: %d\n", tcpidx, tcidx, tp->TYPE, tcp->cell_count);
+    fflush(stdout);
+  }
 
   BOUNDS (tcpidx, S.net.cellpop_count);
   BOUNDS (tcidx, tcp->cell_count);
   BOUNDS (tcidx, S.net.cellpop[tcpidx].cell_count);
   BOUNDS (tp->TYPE - 1, S.net.syntype_count);
 
-  if (synapse[tcpidx][tcidx][tp->TYPE-1].ptr == 0) {
-     synapse[tcpidx][tcidx][tp->TYPE-1].ptr++; // used as NZ flag, later replaced by real ptr
-     tc->syn_count++;
-  }
-  if (qidx > synapse[tcpidx][tcidx][tp->TYPE-1].maxqidx)
-     synapse[tcpidx][tcidx][tp->TYPE-1].maxqidx = qidx;
+  SynInfo *si = &synapse[tcpidx][tcidx][tp->TYPE-1];
+  if (__atomic_load_n (&si->ptr, __ATOMIC_RELAXED) == 0)
+     __atomic_store_n (&si->ptr, SYN_USED, __ATOMIC_RELAXED); // NZ flag, later replaced by real ptr
+  atomic_max (&si->maxqidx, qidx);
   if (Debug) printf("count_to_synapses: ptr, maxqidx for synapse[%d][%d][%d] is %p %d\n",tcpidx,tcidx,tp->TYPE-1, synapse[tcpidx][tcidx][tp->TYPE-1].ptr, synapse[tcpidx][tcidx][tp->TYPE-1].maxqidx);
 }
 
-
-/* func choices are:
-   count_to_synapses(...)
-   attach_to_synapses(...) 
-*/
+// One source's terminals, a cell or fiber. idx is its index in its pop.
 static inline void
-for_cell_targets (void (*func)(TargetPop*, CellPop*, Target*, int, int, int))
+for_source_targets (Target *target, int target_count, TargetPop *tpop, int tp_count,
+                    int idx, int64_t order0, TermFunc func)
 {
-  {if(Debug) printf(" for_cell_targets\n");}
-  int cpidx;
-  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)  // for each pop
+  int tpidx, tidx0 = 0;
+  for (tpidx = 0; tpidx < tp_count; tpidx++)  // for each target population
   {
-    CellPop *cp = S.net.cellpop + cpidx;
-    int cidx;
-    for (cidx = 0; cidx < cp->cell_count; cidx++)    // for each cell
+    TargetPop *tp = tpop + tpidx;
+    int iseed = (idx + 1) * tp->INSED;
+    tp->NT >= 0 || DIE;
+    if (tp->NT > 0) 
     {
-      Cell *c = cp->cell + cidx;
-      int tpidx, tidx0 = 0;
-      for (tpidx = 0; tpidx < cp->targetpop_count; tpidx++)  // for each target population
+      BOUNDS (tidx0 + tp->NT - 1, target_count);
+      for_terminals (iseed, target, target_count, tp, tidx0, order0, func);
+      tidx0 += tp->NT;
+    }
+  }
+}
+
+static void
+targets_task (int task, void *arg)
+{
+  SrcChunk *sc = src_chunk + task;
+  TermFunc func = *(TermFunc *) arg;
+  int n;
+
+  if (!sc->fiber)
+  {
+    CellPop *cp = S.net.cellpop + sc->pidx;
+    for (n = sc->first; n < sc->last; n++)
+    {
+      Cell *c = cp->cell + n;
+      if (c->target == 0 && cp->targetpop_count)
       {
-        TargetPop *tp = cp->targetpop + tpidx;
-        int iseed = (cidx + 1) * tp->INSED;
-        if (c->target == 0) 
-        {
-          if(Debug) printf ("S.net.cellpop[1].cell[4].target: %lx\n", (long)S.net.cellpop[1].cell[4].target);
-          if(Debug) printf ("cell %d of pop %d target is not set.  targetpop_count = %d\n",
-             cidx, cpidx, cp->targetpop_count);
-          DIE;
-        }
-        tp->NT >= 0 || DIE;
-        if (tp->NT > 0) 
-        {
-          BOUNDS (tidx0 + tp->NT - 1, c->target_count);
-          if(Debug) printf("for cell terminals\n");
-          for_terminals (iseed, c->target, c->target_count, tp, tidx0, func);
-          tidx0 += tp->NT;
-        }
+        if(Debug) printf ("cell %d of pop %d target is not set.  targetpop_count = %d\n",
+           n, sc->pidx, cp->targetpop_count);
+        DIE;
       }
+      for_source_targets (c->target, c->target_count, cp->targetpop, cp->targetpop_count,
+                          n, sc->order0 + (int64_t) (n - sc->first) * c->target_count, func);
+    }
+  }
+  else
+  {
+    FiberPop *fp = S.net.fiberpop + sc->pidx;
+    for (n = sc->first; n < sc->last; n++)
+    {
+      Fiber *f = fp->fiber + n;
+      for_source_targets (f->target, f->target_count, fp->targetpop, fp->targetpop_count,
+                          n, sc->order0 + (int64_t) (n - sc->first) * f->target_count, func);
+    }
+  }
+}
+
+// Cut the cells and fibers into runs of BUILD_CHUNK, in serial order.
+static void
+make_src_chunks (void)
+{
+  int pn, n, count = 0;
+  int64_t order = 0;
+
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    count += (S.net.cellpop[pn].cell_count + BUILD_CHUNK - 1) / BUILD_CHUNK;
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    count += (S.net.fiberpop[pn].fiber_count + BUILD_CHUNK - 1) / BUILD_CHUNK;
+  ACALLOC (scratch, src_chunk, count + 1);
+  src_chunk_count = 0;
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    for (n = 0; n < cp->cell_count; n += BUILD_CHUNK)
+    {
+      SrcChunk *sc = src_chunk + src_chunk_count++;
+      sc->fiber = false;
+      sc->pidx = pn;
+      sc->first = n;
+      sc->last = MIN (n + BUILD_CHUNK, cp->cell_count);
+      sc->order0 = order;
+      order += (int64_t) (sc->last - n) * cp->cell[n].target_count;
     }
   }
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    for (n = 0; n < fp->fiber_count; n += BUILD_CHUNK)
+    {
+      SrcChunk *sc = src_chunk + src_chunk_count++;
+      sc->fiber = true;
+      sc->pidx = pn;
+      sc->first = n;
+      sc->last = MIN (n + BUILD_CHUNK, fp->fiber_count);
+      sc->order0 = order;
+      order += (int64_t) (sc->last - n) * fp->fiber[n].target_count;
+    }
+  }
+    // attach_to_synapses keeps order + 1 in 32 bits
+  if (order >= UINT32_MAX)
+  {
+    fprintf (stdout, "SIMRUN: the network has %lld terminals, more than this build can handle\n",
+             (long long) order);
+    exit (1);
+  }
 }
 
 /* func choices are:
    count_to_synapses(...)
    attach_to_synapses(...) 
 */
-static inline void
-for_fiber_targets (void (*func)(TargetPop*, CellPop*, Target*, int, int, int))
+static void
+for_all_targets (TermFunc func)
+{
+  if(Debug) printf(" for_all_targets\n");
+  pool_run (targets_task, &func, src_chunk_count);
+}
+
+// syn_count of each cell, from the flags count_to_synapses left.
+static void
+count_syns (void)
 {
-if(Debug) printf("   for_fiber_targets\n");
-  int fpidx;
-  for (fpidx = 0; fpidx < S.net.fiberpop_count; fpidx++)  // for each pop
+  int cpidx, cidx, stidx;
+
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
   {
-    FiberPop *fp = S.net.fiberpop + fpidx;
-    int fidx;
-    for (fidx = 0; fidx < fp->fiber_count; fidx++)   // for each fiber
-    {
-      Fiber *f = fp->fiber + fidx;
-      int tpidx, tidx0 = 0;
-      for (tpidx = 0; tpidx < fp->targetpop_count; tpidx++)  // for each terminal
-      {
-        TargetPop *tp = fp->targetpop + tpidx;
-        int iseed = (fidx + 1) * tp->INSED;
-        tp->NT >= 0 || DIE;
-        if (tp->NT > 0) 
-        {
-          BOUNDS (tidx0 + tp->NT - 1, f->target_count);
-          if(Debug) printf("for fiber terminals\n");
-          for_terminals (iseed, f->target, f->target_count, tp, tidx0, func);
-          tidx0 += tp->NT;
-        }
-      }
-    }
+    CellPop *cp = S.net.cellpop + cpidx;
+    for (cidx = 0; cidx < cp->cell_count; cidx++)
+      for (stidx = 0; stidx < S.net.syntype_count; stidx++)
+        if (synapse[cpidx][cidx][stidx].ptr != 0)
+          cp->cell[cidx].syn_count++;
   }
 }
 
-int row_order_offset(int i, int j, int numberOfColumns) {
-   int offset = i * numberOfColumns + j;
-   return offset;
+// Each synapse's strength is the STR of the last terminal on it, as when
+// the terminals were attached one at a time.
+static void
+set_strengths (void)
+{
+  int cpidx, cidx, stidx;
+
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
+  {
+    CellPop *cp = S.net.cellpop + cpidx;
+    for (cidx = 0; cidx < cp->cell_count; cidx++)
+      for (stidx = 0; stidx < S.net.syntype_count; stidx++)
+      {
+        SynInfo *si = &synapse[cpidx][cidx][stidx];
+        uint32_t bits = (uint32_t) si->last;
+        float str;
+        if (!si->last)
+          continue;
+        memcpy (&str, &bits, sizeof str);
+        si->ptr->initial_strength = str;
+        si->ptr->lrn_strength = str;
+      }
+  }
 }
 
 int st (float eq, float dcs)
@@ -275,172 +430,6 @@ int st (float eq, float dcs)
   return 99999999;
 }
 
-// JAH: Writes out the adjacency matrices for the instantiated network in 
-//      separate files based on excitatory vs. inhibitory connections
-void writeAdjacencyMatrices (void)
-{
-  //fprintf(ofile, "cell pop count1: %d\n", sizeof(S.net.cellpop));
-  //fprintf(ofile, "cell pop count1: %d\n", sizeof(S.net.cellpop[0]));
-  /*fprintf(ofile, "cell pop count2: %d\n", S.net.cellpop_count);
-  fprintf(ofile, "cell syn count2: %d\n", S.net.syntype_count);
-  fprintf(ofile, "cell pop #1, target pop count: %d\n", S.net.cellpop[0].targetpop_count);
-  fprintf(ofile, "cell pop #1, target pop: %d\n", S.net.cellpop[0].targetpop[0]);
-  fprintf(ofile, "cell pop #1, cell #1, syn count: %d\n", S.net.cellpop[0].cell[0].syn_count);
-  */
-  
-  // iterate over cell populations to get total number of cells in network
-  fprintf(stderr, "start writeAdjacencyMatrices\n");
-  
-  int totalCellsInNetwork = 0;
-  int cellPopulationSizes[S.net.cellpop_count];
-  
-  for (int cpidx = 0; cpidx < S.net.cellpop_count; cpidx++) {
-     CellPop *cp = S.net.cellpop + cpidx;
-     cellPopulationSizes[cpidx] = cp->cell_count;
-     totalCellsInNetwork += cp->cell_count;
-  }
-  fprintf(stderr, "totalCellsInNetwork: %d\n", totalCellsInNetwork);
-  
-  // initialize adjacency matrices full of zeros the size of the network
-  fprintf(stderr, "sizeof(int): %zu\n", sizeof(short));
-//  short excitatoryAdjacencyMatrix[totalCellsInNetwork][totalCellsInNetwork];
-  int *excitatoryAdjacencyMatrix = (int *)malloc(totalCellsInNetwork * totalCellsInNetwork * sizeof(int));
-  
-  fprintf(stderr, "middle writeAdjacencyMatrices\n");
-  memset(excitatoryAdjacencyMatrix, 0, totalCellsInNetwork*totalCellsInNetwork*sizeof(int));
-
-  fprintf(stderr, "middle2 writeAdjacencyMatrices\n");
-  //short inhibitoryAdjacencyMatrix[totalCellsInNetwork][totalCellsInNetwork];
-  int *inhibitoryAdjacencyMatrix = (int *)malloc(totalCellsInNetwork * totalCellsInNetwork * sizeof(int));
-  memset(inhibitoryAdjacencyMatrix, 0, totalCellsInNetwork*totalCellsInNetwork*sizeof(int));
-
-  int previousCellPopCounts = 0;
-  for (int cpidx = 0; cpidx < S.net.cellpop_count; cpidx++) {
-     CellPop *cp = S.net.cellpop + cpidx;
-     //fprintf(ofile, "cell pop #1, cell count: %d\n", cp->cell_count);
-     //fprintf(ofile, "cell pop #1, cell #1, target count: %d\n", cp->cell[0].target_count);
-     Syn *syn = NULL;
-     
-     // int i = 0, source cells, also rows
-     for (int i = 0; i < cp->cell_count; i++) {
-     	Cell *c = cp->cell + i;
-      
-        //syn->cidx // target cells, also columns
-        for (int j = 0; j < c->target_count; j++) {
-           syn = c->target[j].syn;
-           
-           // This block to calculate targetPopulationOffset is to correct for 
-           //    the preceding columns in the adjacency matrix from other cell populations
-           int targetPopulationOffset = 0;
-           for (int k = 0; k < syn->cpidx; k++) {
-              targetPopulationOffset += cellPopulationSizes[k];
-           }
-           // excitatory connections
-           if (syn->stidx == 0) {
-           	  excitatoryAdjacencyMatrix[row_order_offset(previousCellPopCounts + i, targetPopulationOffset + syn->cidx, totalCellsInNetwork)] += 1;
-//              excitatoryAdjacencyMatrix[previousCellPopCounts + i][targetPopulationOffset + syn->cidx] += 1;
-           }
-           // inhibitory connections
-           else if (syn->stidx == 1) {
-           	  inhibitoryAdjacencyMatrix[row_order_offset(previousCellPopCounts + i, targetPopulationOffset + syn->cidx, totalCellsInNetwork)] += 1;
-//              inhibitoryAdjacencyMatrix[previousCellPopCounts + i][targetPopulationOffset + syn->cidx] += 1;
-           }
-           //fprintf(ofile, "cell pop #1, cell #%d, target #%d, syn#1, cidx: %d\n", i, j, syn->cidx);
-           //fprintf(ofile, "cell pop #1, cell #%d, target #%d, syn#1, stidx: %d\n", i, j, syn->stidx);
-         //  fprintf(ofile, "cell pop #1, cell #1, target #1, syn#%d, cpidx: %d\n", i, syn->cpidx);
-           //fprintf(ofile, "cell pop #1, cell #1, target #1, syn#%d, syntype: %d\n", i, syn->syntype);
-        }
-     }
-     previousCellPopCounts += cp->cell_count;
-  }
-  
-  // Get filename basename
-//  char *tmp = basename(S.snd_file_name);
- // fprintf(stderr, tmp);
- // char basefilename[sizeof(tmp)+22];
- // strcpy(basefilename, tmp);
-  
-  // write out excitatory adjacency matrix
-  FILE *ofile;
-  ofile = fopen("Excitatory.adjMatrix", "w");
-  
-  for (int i = 0; i < totalCellsInNetwork; i++) {
-     for (int j = 0; j < totalCellsInNetwork; j++) {
-        fprintf(ofile, "%d ", excitatoryAdjacencyMatrix[row_order_offset(i, j, totalCellsInNetwork)]);
-     }
-     fprintf(ofile, "\n");
-  }
-  fclose(ofile);
-  free(excitatoryAdjacencyMatrix);
-  
-  // write out inhibitory adjacency matrix
-  ofile = fopen("Inhibitory.adjMatrix", "w");
-  
-  for (int i = 0; i < totalCellsInNetwork; i++) {
-     for (int j = 0; j < totalCellsInNetwork; j++) {
-     //   fprintf(ofile, "%d ", inhibitoryAdjacencyMatrix[i][j]);
-        fprintf(ofile, "%d ", inhibitoryAdjacencyMatrix[row_order_offset(i, j, totalCellsInNetwork)]);
-     }
-     fprintf(ofile, "\n");
-  }
-  fclose(ofile);
-  free(inhibitoryAdjacencyMatrix);
-  
- // fprintf(ofile, "cell pop #1: %d\n", S.net.cellpop[0]);
- // fprintf(ofile, "cell pop #2: %d\n", S.net.cellpop[1]);
-/*  fprintf(ofile, "cell pop count1: %d\n", array_length(S.net.cellpop, sizeof(int)));
-  fprintf(ofile, "pop #1 number of cells1: %d\n", S.net.cellpop[0].cell_count);
-  fprintf(ofile, "pop #1 number of cells2: %d\n", array_length(S.net.cellpop[0].cell, sizeof(int)));
-  fprintf(ofile, "\n");
-  fprintf(ofile, "%d\n", array_length(synapse[0], sizeof(int)));
-*/                                      
-//  fprintf(ofile, "%zu\n", array_length(synapse[0][0], sizeof(int)));
-//  fprintf(ofile, "\n");
-/*  int rowIndex_fromNeuron = 0;
-  int columnIndex_toNeuron = 0;
-  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++) {
-    CellPop *cp = S.net.cellpop + cpidx;
-    int totalSynapses = 0;
-    int totalTargets = 0;
-    fprintf(ofile, "cell pop counter #%d\n", (cpidx+1));
-    for (int cidx = 0; cidx < cp->cell_count; cidx++) {
-      Cell *c = cp->cell + cidx;
-      fprintf(ofile, "\tcell counter #%d\n", (cidx+1));
-      for (int sn = 0; sn < c->syn_count; sn++) {
-        fprintf(ofile, "\t\tsynapse counter #%d\n", (sn+1));
-        totalSynapses += c->syn_count;
-        for (int qn = 0; qn < c->syn[sn].q_count; qn++) { 
-           fprintf(ofile, "\t\tq counter #%d\n", (qn+1));
-        /*
-          if(Debug) printf("cell->syn[%d].q[%d] = %lf\n", sn,qn,c->syn[sn].q[qn]);
-          if (!(c->syn[sn].q[qn] == 0 || (c->syn[sn].q[qn] == 1 && S.ispresynaptic))) 
-          {
-            printf ("transmit: cell %d pop %d syn %d qval %d of %d is %a\n",
-               cidx, cpidx, sn, qn, c->syn->q_count, c->syn[sn].q[qn]);
-            fflush(stdout);
-            DIE; // todo this should not be a fatal error
-          }*/
-   //     }
-      //    fprintf(ofile, "1 ");
-    /*      columnIndex_toNeuron++;
-        
-      }
-      for (int tn = 0; tn < c->target_count; tn++) {
-        fprintf(ofile, "\t\ttarget counter #%d\n", (tn+1));
-        totalTargets += c->target_count;
-        
-      }
-      if (c->syn_count == 0) {
-      //  fprintf(ofile, "0 ");
-      }
-      //fprintf(ofile, "\n");
-      rowIndex_fromNeuron++;
-    }
-    fprintf(ofile, "Total synapse count for cell population #%d: %d\n", (cpidx+1), totalSynapses);
-    fprintf(ofile, "Total target count for cell population #%d: %d\n", (cpidx+1), totalTargets);
-  }*/
-}
-
 // This checks the allocated q arrays to be 0 if normal
 // or 1 if presynaptic modifiers are being used.
 // Exits on error. This, of course, should "never" happen
@@ -501,6 +490,142 @@ static double ran_gaussian (int seed)
   return y * sqrt (-2.0 * log (r2) / r2);
 }
 
+/* With --csr, size the network-wide pools. The Target pool can be
+   handed out right away, since every cell and fiber already knows its
+   target count. The Syn and q pool sizes come from the synapse cube,
+   so this has to run after count_to_synapses has filled it in.
+*/
+static void
+csr_pools (void)
+{
+  size_t target_count = 0;
+  int cpidx, fpidx, cidx, fidx;
+
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
+  {
+    CellPop *cp = S.net.cellpop + cpidx;
+    for (cidx = 0; cidx < cp->cell_count; cidx++)
+      target_count += cp->cell[cidx].target_count;
+  }
+  for (fpidx = 0; fpidx < S.net.fiberpop_count; fpidx++)
+  {
+    FiberPop *fp = S.net.fiberpop + fpidx;
+    for (fidx = 0; fidx < fp->fiber_count; fidx++)
+      target_count += fp->fiber[fidx].target_count;
+  }
+  csr_alloc_targets (&S.net, target_count);
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
+  {
+    CellPop *cp = S.net.cellpop + cpidx;
+    for (cidx = 0; cidx < cp->cell_count; cidx++)
+      cp->cell[cidx].target = csr_take_targets (CSR (&S.net), cp->cell[cidx].target_count);
+  }
+  for (fpidx = 0; fpidx < S.net.fiberpop_count; fpidx++)
+  {
+    FiberPop *fp = S.net.fiberpop + fpidx;
+    for (fidx = 0; fidx < fp->fiber_count; fidx++)
+      fp->fiber[fidx].target = csr_take_targets (CSR (&S.net), fp->fiber[fidx].target_count);
+  }
+}
+
+static void
+csr_syn_pools (void)
+{
+  size_t syn_count = 0, q_count = 0;
+  int cpidx, cidx, stidx;
+
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
+  {
+    CellPop *cp = S.net.cellpop + cpidx;
+    for (cidx = 0; cidx < cp->cell_count; cidx++)
+    {
+      syn_count += cp->cell[cidx].syn_count;
+      for (stidx = 0; stidx < S.net.syntype_count; stidx++)
+        if (synapse[cpidx][cidx][stidx].ptr != 0)
+          q_count += synapse[cpidx][cidx][stidx].maxqidx + 1;
+    }
+  }
+  csr_alloc_syns (&S.net, syn_count, q_count);
+}
+
+// The cube is only needed while the network is being built.
+static void
+free_synapse_cube (void)
+{
+  arena_free (scratch);
+  scratch = NULL;
+  synapse = NULL;
+}
+
+// Point each synapse at the pre- and post-synaptic modifiers that name
+// it as parent, so simloop does not have to search c->syn every step.
+// The editor allows at most one of each per parent; if a file has more,
+// the first one in c->syn is used.
+static void
+link_modifiers (Cell *c)
+{
+  static int warned;
+  int sidx, midx;
+
+  for (sidx = 0; sidx < c->syn_count; sidx++)
+    c->syn[sidx].pre = c->syn[sidx].post = -1;
+  if (!S.ispresynaptic)
+    return;
+  for (midx = 0; midx < c->syn_count; midx++) {
+    Syn *m = c->syn + midx;
+    if (!m->synparent || (m->syntype != SYN_PRE && m->syntype != SYN_POST))
+      continue;
+    for (sidx = 0; sidx < c->syn_count; sidx++) {
+      Syn *s = c->syn + sidx;
+      int *link = m->syntype == SYN_PRE ? &s->pre : &s->post;
+      if (s->stidx + 1 != m->synparent || s->syntype == SYN_PRE || s->syntype == SYN_POST)
+        continue;
+      if (*link == -1)
+        *link = midx;
+      else if (!warned++)
+        fprintf (stdout, "SIMRUN: synapse type %d has more than one %s-synaptic modifier, using the first\n",
+                 s->stidx + 1, m->syntype == SYN_PRE ? "pre" : "post");
+    }
+  }
+}
+
+// Parse the injected current expressions once, here, rather than on the
+// first step. Pops with the same text share one parser, and since the
+// parser keeps its last result each distinct expression runs once a step.
+void
+compile_ic_expressions (void)
+{
+  int cpidx, k;
+
+  for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++)
+  {
+    CellPop *cp = S.net.cellpop + cpidx;
+    if (!cp->ic_expression)
+      continue;
+    cp->ic_evaluator = NULL;
+    for (k = 0; k < cpidx; k++)
+      if (S.net.cellpop[k].ic_evaluator && strcmp (S.net.cellpop[k].ic_expression, cp->ic_expression) == 0)
+      {
+        cp->ic_evaluator = S.net.cellpop[k].ic_evaluator;
+        break;
+      }
+    if (!cp->ic_evaluator && !(cp->ic_evaluator = xp_set (cp->ic_expression)))
+    {
+      fprintf (stdout, "SIMRUN: cannot parse the injected current expression \"%s\" of population %d\n",
+               cp->ic_expression, cpidx + 1);
+      exit (1);
+    }
+  }
+}
+
+static double
+build_clock (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 void build_network ()
 {
   int cpidx; // JAH: cell population index
@@ -524,12 +649,17 @@ void build_network ()
   int seed_size = (sizeof seed / sizeof seed[0])-1;
   int last_seed = seed[seed_size];
 
+  double start = build_clock ();
+  Arena *arena;
+
   Debug = false;
  
   printf("blah build_network.c\n");
   if(Debug) printf("allocate array of ptrs for %d pops\n",S.net.cellpop_count);
 
-  TMALLOC (synapse, S.net.cellpop_count);
+  S.net.arena = arena = arena_new ();
+  scratch = arena_new ();
+  ACALLOC (scratch, synapse, S.net.cellpop_count);
 
   for (cpidx = 0; cpidx < S.net.cellpop_count; cpidx++) 
   {
@@ -544,13 +674,13 @@ void build_network ()
     }
 
     if (Debug) printf("allocate array of ptrs in synapse[%d] for %d cells\n",cpidx,cp->cell_count);
-    TMALLOC (synapse[cpidx], cp->cell_count);
+    ACALLOC (scratch, synapse[cpidx], cp->cell_count);
 
     for (tpidx = 0; tpidx < cp->targetpop_count; tpidx++)
       target_count += cp->targetpop[tpidx].NT;
 
     if(Debug) printf("allocate array of ptrs in S.net.cellpop+%d for %d cells\n",cpidx,cp->cell_count);
-    TCALLOC (cp->cell, cp->cell_count);
+    ACALLOC (arena, cp->cell, cp->cell_count);
     if (!getenv ("SIM_OLDRAN")) // this is undocumented, just used for testing/debugging??
        ran_gaussian(cpidx < 43 ? rgseed[cpidx] : 100 + cpidx); // set seed for this cell pop
 
@@ -558,14 +688,16 @@ void build_network ()
     {
       Cell *c = cp->cell + cidx;
       if (Debug) printf("allocate array of %d ptrs in synapse[%d][%d] for synapse types\n",S.net.syntype_count, cpidx,cidx);
-      TCALLOC (synapse[cpidx][cidx], S.net.syntype_count);
+      ACALLOC (scratch, synapse[cpidx][cidx], S.net.syntype_count);
       c->Vm = S.Vm0;
       c->Thr = cp->Th0 + ran_gaussian (0) * cp->Th0_sd;
       c->target_count = target_count;
       if (Debug) printf("allocate array of ptrs in S.net.cellpop.target+%d for %d targets\n",cpidx,c->target_count);
         // this allocates an array of *Target ptrs for each terminal
-      TMALLOC (c->target, c->target_count);
+      if (!csr_flag)
+        ACALLOC (arena, c->target, c->target_count);
     }
+    cellstate_alloc (cp);
   }
 
   /* Allocate the fibers */
@@ -602,19 +734,26 @@ void build_network ()
       target_count += fp->targetpop[tpidx].NT;
 
     if (Debug)printf("\nallocate array of %d fibers for fiber pop %d in S.net.fiberpop + %d\n",fp->fiber_count,fpidx, fpidx);
-    TCALLOC (fp->fiber, fp->fiber_count);
+    ACALLOC (arena, fp->fiber, fp->fiber_count);
 
     for (fidx = 0; fidx < fp->fiber_count; fidx++) {
       Fiber *f = fp->fiber + fidx;
       f->target_count = target_count;
       if (Debug)printf("allocate %d ptrs in S.net.fiberpop[%d].target\n",f->target_count,fidx);
-      TMALLOC (f->target, f->target_count);
+      if (!csr_flag)
+        ACALLOC (arena, f->target, f->target_count);
     }
   }
-      if (Debug)printf("call for_cell_targets, fnc is count_to_synapses\n");
-  for_cell_targets (count_to_synapses);
-      if (Debug)printf("call for_fiber_targets, fnc is count_to_synapses\n");
-  for_fiber_targets (count_to_synapses);
+  if (csr_flag)
+    csr_pools ();
+    // the pool stays up for simloop, a mid-run rebuild uses it as is
+  pool_start (num_threads);
+  make_src_chunks ();
+      if (Debug)printf("call for_all_targets, fnc is count_to_synapses\n");
+  for_all_targets (count_to_synapses);
+  count_syns ();
+  if (csr_flag)
+    csr_syn_pools ();
 
   printf("JAH: cell point count %d\n", S.net.cellpop_count);
    /* Allocate synapses */
@@ -633,7 +772,10 @@ void build_network ()
       {if(Debug) printf("\nallocate %d slots in Syn array\n",c->syn_count);}
       // this allocates an array pointed to by synapse[pop][cell][c_syn_count].ptr
       // for the 
-      TCALLOC (c->syn, c->syn_count);
+      if (csr_flag)
+        c->syn = csr_take_syns (CSR (&S.net), c->syn_count);
+      else
+        ACALLOC (arena, c->syn, c->syn_count);
       syn = c->syn;
       for (stidx = 0; stidx < S.net.syntype_count; stidx++) 
       {
@@ -668,7 +810,10 @@ void build_network ()
           syn->syntype,
           syn->synparent);}
 
-          TCALLOC (syn->q, syn->q_count);
+          if (csr_flag)
+            syn->q = csr_take_q (CSR (&S.net), syn->q_count);
+          else
+            ACALLOC (arena, syn->q, syn->q_count);
           if (stp->SYN_TYPE == SYN_NOT_USED) // a bug
             fprintf(stdout,"Unexpected unused synapse in list\n");
           if (S.ispresynaptic && (stp->SYN_TYPE == SYN_PRE || stp->SYN_TYPE == SYN_POST))
@@ -687,30 +832,27 @@ void build_network ()
               if (Debug) printf(" syn[%d] = 1\n",n);
             }
           }
-          if (stp->SYN_TYPE == SYN_LEARN)
-          {
-             {if (Debug) printf("add ptr to learn array of %d slots\n",LRN_SIZE);}
-             TCALLOC (syn->lrn, LRN_SIZE);
-             LEARN *lrn = syn->lrn;
-             syn->lrn_size = LRN_SIZE;
-             for (int lrs = 0; lrs < LRN_SIZE; ++lrs,++lrn)
-                lrn->recv_pop = LRN_FREE;  // mark as unused slot
-          }
-
           synapse[cpidx][cidx][stidx].ptr = syn++;
         }
       }
       syn - c->syn == c->syn_count || DIE;
+      link_modifiers (c);
     }
   }
 
-  if (Debug) printf("call for_cell_targets, fnc is attacth_to_synapses\n");
-  for_cell_targets (attach_to_synapses);
-  if (Debug) printf("call for_fiber_targets, JAH fnc is attach_to_synapses\n");
-  for_fiber_targets (attach_to_synapses);
+  if (Debug) printf("call for_all_targets, fnc is attach_to_synapses\n");
+  for_all_targets (attach_to_synapses);
+  set_strengths ();
   check_synapses ();
+  if (csr_flag)
+    csr_index (&S.net);
   
-  writeAdjacencyMatrices();
+  compile_ic_expressions ();
+
+  free_synapse_cube ();
+  fprintf(stdout,"SIMRUN: network built in %.3f s, arena %.1f MB used of %.1f MB in %d blocks, %ld arrays\n",
+          build_clock () - start, arena->used / 1048576., arena->reserved / 1048576.,
+          arena->blocks, arena->allocs);
   printf("JAH: exiting build_network\n");
   fflush(stdout);
   //exit(0);
@@ -0,0 +1,234 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Structure-of-arrays storage for the per-cell simulation state.
+   See cellstate.h.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "simulator.h"
+#include "cellstate.h"
+#include "util.h"
+#include "inode.h"
+
+// One allocation per pop, carved into the field arrays. Every field is
+// 4 bytes wide, so the arrays stay aligned.
+void
+cellstate_alloc (CellPop *p)
+{
+  CellState *cs;
+  int n = p->cell_count;
+  float *block;
+
+  TCALLOC (cs, 1);
+  TCALLOC (block, 6 * (size_t) n + 1);
+  cs->count = n;
+  cs->Vm_prev  = block;
+  cs->Vm       = block + n;
+  cs->Gk       = block + 2 * n;
+  cs->Thr      = block + 3 * n;
+  cs->gnoise_e = block + 4 * n;
+  cs->gnoise_i = block + 5 * n;
+  TCALLOC (cs->spike, n + 1);
+  p->cellstate = cs;
+  cellstate_gather (p);
+}
+
+void
+cellstate_free (CellPop *p)
+{
+  CellState *cs = CELLSTATE (p);
+  if (!cs)
+    return;
+  free (cs->Vm_prev);
+  free (cs->spike);
+  free (cs);
+  p->cellstate = NULL;
+}
+
+// Cell records -> arrays
+void
+cellstate_gather (CellPop *p)
+{
+  CellState *cs = CELLSTATE (p);
+  int cn;
+  for (cn = 0; cn < cs->count; cn++)
+  {
+    Cell *c = p->cell + cn;
+    cs->Vm_prev[cn]  = c->Vm_prev;
+    cs->Vm[cn]       = c->Vm;
+    cs->Gk[cn]       = c->Gk;
+    cs->Thr[cn]      = c->Thr;
+    cs->gnoise_e[cn] = c->gnoise_e;
+    cs->gnoise_i[cn] = c->gnoise_i;
+    cs->spike[cn]    = c->spike;
+  }
+}
+
+// arrays -> Cell records
+void
+cellstate_scatter (CellPop *p)
+{
+  CellState *cs = CELLSTATE (p);
+  int cn;
+  for (cn = 0; cn < cs->count; cn++)
+  {
+    Cell *c = p->cell + cn;
+    c->Vm_prev  = cs->Vm_prev[cn];
+    c->Vm       = cs->Vm[cn];
+    c->Gk       = cs->Gk[cn];
+    c->Thr      = cs->Thr[cn];
+    c->gnoise_e = cs->gnoise_e[cn];
+    c->gnoise_i = cs->gnoise_i[cn];
+    c->spike    = cs->spike[cn];
+  }
+}
+
+// Mid-run update, carry the running state of the cells that exist in both
+// the old and new network over to the new one.
+void
+cellstate_copy (CellPop *pold, CellPop *pnew)
+{
+  CellState *cold = CELLSTATE (pold);
+  CellState *cnew = CELLSTATE (pnew);
+  size_t n = MIN (cold->count, cnew->count);
+
+  memcpy (cnew->Vm_prev, cold->Vm_prev, n * sizeof *cnew->Vm_prev);
+  memcpy (cnew->Vm, cold->Vm, n * sizeof *cnew->Vm);
+  memcpy (cnew->Gk, cold->Gk, n * sizeof *cnew->Gk);
+  memcpy (cnew->Thr, cold->Thr, n * sizeof *cnew->Thr);
+  memcpy (cnew->gnoise_e, cold->gnoise_e, n * sizeof *cnew->gnoise_e);
+  memcpy (cnew->gnoise_i, cold->gnoise_i, n * sizeof *cnew->gnoise_i);
+  memcpy (cnew->spike, cold->spike, n * sizeof *cnew->spike);
+}
+
+void
+synstate_alloc (CellPop *p, int stepnum)
+{
+  SynState *ss;
+  int cn, k = 0;
+
+  TCALLOC (ss, 1);
+  TMALLOC (ss->syn_off, p->cell_count + 1);
+  for (cn = 0; cn < p->cell_count; cn++)
+  {
+    ss->syn_off[cn] = k;
+    k += p->cell[cn].syn_count;
+  }
+  ss->syn_off[cn] = k;
+  ss->count = k;
+  TMALLOC (ss->sd.G, k + 1);
+  TMALLOC (ss->sd.DCS, k + 1);
+  TMALLOC (ss->sd.EQ, k + 1);
+  TMALLOC (ss->sd.q, k + 1);
+  TMALLOC (ss->sd.q_count, k + 1);
+  TMALLOC (ss->sd.qpos, k + 1);
+  TMALLOC (ss->Gsum, p->cell_count + 1);
+  TMALLOC (ss->GEsum, p->cell_count + 1);
+  TCALLOC (ss->Prob, p->cell_count + 1);
+  ss->eq_off = p->pop_subtype == BURSTER_POP ? 65. : 0;
+  for (cn = 0, k = 0; cn < p->cell_count; cn++)
+  {
+    Cell *c = p->cell + cn;
+    int sidx;
+    for (sidx = 0; sidx < c->syn_count; sidx++, k++)
+    {
+      Syn *s = c->syn + sidx;
+      ss->sd.G[k] = s->G;
+      ss->sd.DCS[k] = s->DCS;
+      ss->sd.EQ[k] = s->EQ;
+      ss->sd.q[k] = s->q;
+      ss->sd.q_count[k] = s->q_count;
+    }
+  }
+  p->synstate = ss;
+  ss->qstep = -1;
+  synstate_sync (p, stepnum);
+  synstate_sums (p, 0, p->cell_count);
+}
+
+void
+synstate_free (CellPop *p)
+{
+  SynState *ss = SYNSTATE (p);
+  if (!ss)
+    return;
+  free (ss->syn_off);
+  free (ss->sd.G);
+  free (ss->sd.DCS);
+  free (ss->sd.EQ);
+  free (ss->sd.q);
+  free (ss->sd.q_count);
+  free (ss->sd.qpos);
+  free (ss->Gsum);
+  free (ss->GEsum);
+  free (ss->Prob);
+  free (ss);
+  p->synstate = NULL;
+}
+
+// Point each ring at the slot for this step's decay. The kernels step the
+// slots along themselves, so this only does any work on the first step.
+void
+synstate_sync (CellPop *p, int stepnum)
+{
+  SynState *ss = SYNSTATE (p);
+  int k;
+
+  if (ss->qstep != stepnum)
+    for (k = 0; k < ss->count; k++)
+      ss->sd.qpos[k] = stepnum % ss->sd.q_count[k];
+  ss->qstep = stepnum + 1;
+}
+
+// The conductance sums for cells cn0 up to cn1, added up in the same
+// order the membrane update used to walk the synapses.
+void
+synstate_sums (CellPop *p, int cn0, int cn1)
+{
+  SynState *ss = SYNSTATE (p);
+  int cn, k;
+
+  syn_decay_sums (&ss->sd, ss->syn_off, cn0, cn1, ss->eq_off, ss->Gsum, ss->GEsum);
+  if (p->pop_subtype == PSR_POP)
+    for (cn = cn0; cn < cn1; cn++)
+    {
+      double Prob = 0;
+      for (k = ss->syn_off[cn]; k < ss->syn_off[cn + 1]; k++)
+        Prob += ss->sd.G[k] * (1. - ss->sd.DCS[k]);
+      ss->Prob[cn] = Prob;
+    }
+}
+
+// flat G -> Syn records
+void
+synstate_scatter (CellPop *p)
+{
+  SynState *ss = SYNSTATE (p);
+  int cn, k = 0;
+
+  if (!ss)
+    return;
+  for (cn = 0; cn < p->cell_count; cn++)
+  {
+    Cell *c = p->cell + cn;
+    int sidx;
+    for (sidx = 0; sidx < c->syn_count; sidx++, k++)
+      c->syn[sidx].G = ss->sd.G[k];
+  }
+}
@@ -0,0 +1,91 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CELLSTATE_H
+#define CELLSTATE_H
+
+#include "syndecay.h"
+
+/* Hot per-cell state for the simloop membrane update, kept as one
+   contiguous array per field per cell population instead of being
+   spread across the Cell records.  The update kernels only touch
+   these arrays, so the synapse pointers, target lists and coordinates
+   in Cell stay out of the cache during the integrate pass.
+
+   While simloop is running, these arrays are the live copy of the
+   state.  The Cell fields of the same name are what the .sim file
+   loader and saver see, and are brought in sync at the start and end
+   of a run with cellstate_gather and cellstate_scatter.
+*/
+typedef struct
+{
+  int count;
+  float *Vm_prev;
+  float *Vm;
+  float *Gk;
+  float *Thr;
+  float *gnoise_e;
+  float *gnoise_i;
+  int *spike;
+} CellState;
+
+#define CELLSTATE(p) ((CellState *)(p)->cellstate)
+
+/* The synapses of a pop flattened the same way, for the conductance
+   decay kernels in syndecay.c, along with the per-cell conductance sums
+   the decay pass leaves behind for the next membrane update.  Cell cn's
+   synapses are syn_off[cn] up to syn_off[cn+1].  Only used when there
+   are no pre/post synaptic modifiers; those still run on the Syn
+   records.  While simloop runs, G here is the live copy and Syn.G is
+   brought up to date with synstate_scatter.
+*/
+typedef struct
+{
+  int count;
+  int *syn_off;
+  SynDecay sd;
+  double eq_off;      // subtracted from EQ in GEsum
+  double *Gsum;
+  double *GEsum;
+  double *Prob;       // PSR pops only
+  int qstep;          // the step the sd.qpos slots are for
+} SynState;
+
+#define SYNSTATE(p) ((SynState *)(p)->synstate)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void cellstate_alloc (CellPop *p);
+void cellstate_free (CellPop *p);
+void cellstate_gather (CellPop *p);
+void cellstate_scatter (CellPop *p);
+void cellstate_copy (CellPop *pold, CellPop *pnew);
+
+void synstate_alloc (CellPop *p, int stepnum);
+void synstate_free (CellPop *p);
+void synstate_sync (CellPop *p, int stepnum);
+void synstate_sums (CellPop *p, int cn0, int cn1);
+void synstate_scatter (CellPop *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
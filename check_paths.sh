@@ -0,0 +1,96 @@
+#!/bin/sh
+# Check for simrun, run by make check.
+#
+# Runs example_model through simrun's default paths, then again with the
+# options that must not change the results: --threads, --csr,
+# --lung-thread, a saved and loaded network, and a run resumed from a
+# checkpoint.  The philox generator is checked against itself with and
+# without threads, since its numbers are not the lcg's.  Every run's wave
+# and bdt files have to match the first run's byte for byte.
+#
+# snd2sim makes the .sim and needs a Qt platform, the check is skipped
+# if it cannot.
+
+srcdir=${srcdir:-.}
+dir=check_paths.dir
+steps=2000
+failed=0
+
+rm -rf $dir
+mkdir -p $dir || exit 99
+cp $srcdir/example_model.snd $dir/ || exit 99
+QT_QPA_PLATFORM=${QT_QPA_PLATFORM:-offscreen} \
+  ./snd2sim -i $dir/example_model.snd -o example_model.sim -s $steps > $dir/snd2sim.log 2>&1
+if test ! -s $dir/example_model.sim; then
+  echo "check_paths: snd2sim could not make the .sim, see $dir/snd2sim.log"
+  exit 77
+fi
+
+# plot some cells and the lung volume, record pop 1 with the wildcard
+# and a few single cells and fibers
+cat > $dir/script <<EOF
+example_model.sim
+100
+E
+0
+1,1,1,Vm
+2,1,1,Vm
+3,1,3,Thr
+1,1,-1,Lung Volume
+
+Y
+N
+N
+N
+check.bdt
+C1,999999999
+C2,1
+C3,1
+F1,1
+
+EOF
+
+run ()
+{
+  name=$1
+  shift
+  mkdir -p $dir/$name
+  if ! ./simrun --script $dir/script --file --output $dir/$name "$@" >> $dir/$name/simrun.log 2>&1; then
+    echo "check_paths: simrun $* failed, see $dir/$name/simrun.log"
+    failed=1
+  fi
+}
+
+same ()
+{
+  for f in wave.00.bin check.bdt; do
+    if ! cmp -s $dir/$1/$f $dir/$2/$f; then
+      echo "check_paths: $f of the $2 run differs from the $1 run"
+      failed=1
+    fi
+  done
+}
+
+run base
+run threads --threads 4
+run csr --csr
+run lung --lung-thread
+run all --threads 4 --csr --lung-thread
+run save --save-network $dir/net.img
+run load --load-network $dir/net.img
+run resume --checkpoint $dir/ckpt --checkpoint-every 700
+run resume --resume $dir/ckpt
+run philox --rng philox
+run philox_all --rng philox --threads 4 --csr --lung-thread
+
+if test ! -s $dir/base/check.bdt || test ! -s $dir/base/wave.00.bin; then
+  echo "check_paths: the base run wrote no bdt or wave file"
+  exit 1
+fi
+for name in threads csr lung all save load resume; do
+  same base $name
+done
+same philox philox_all
+
+test $failed = 0 && echo "check_paths: all runs match"
+exit $failed
@@ -0,0 +1,89 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Check for the Philox generator in philox.c, run by make check.
+
+   Checks philox4x32 against the known answers from the Random123
+   distribution, that philox_fill gives the same numbers as philox_ran
+   one at a time, that the same seed gives the same stream again, and
+   that two different seeds give different streams.
+
+   usage: check_philox
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "philox.h"
+
+#define DRAWS 1000
+
+static int failed;
+
+static void
+check (int ok, const char *what)
+{
+  if (!ok)
+  {
+    fprintf (stderr, "check_philox: %s\n", what);
+    failed = 1;
+  }
+}
+
+int
+main (void)
+{
+  static const uint32_t kat_in[2][6] = {
+    {0, 0, 0, 0, 0, 0},
+    {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0}
+  };
+  static const uint32_t kat_out[2][4] = {
+    {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+    {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}
+  };
+  double a[DRAWS], b[DRAWS];
+  int n, same;
+
+  for (n = 0; n < 2; n++)
+  {
+    const uint32_t *in = kat_in[n];
+    Philox4 r = philox4x32 (in[0], in[1], in[2], in[3], in[4], in[5]);
+    check (memcmp (r.v, kat_out[n], sizeof r.v) == 0, "philox4x32 does not match the Random123 known answers");
+  }
+
+    // an odd start and count so fill takes both the single and the batched path
+  philox_fill (12345, PHILOX_CELL_NOISE, 3, 17, 5, DRAWS - 5, a);
+  for (n = 0; n < DRAWS - 5; n++)
+    b[n] = philox_ran (12345, PHILOX_CELL_NOISE, 3, 17, n + 5);
+  check (memcmp (a, b, (DRAWS - 5) * sizeof *a) == 0, "philox_fill and philox_ran differ");
+
+  philox_fill (12345, PHILOX_FIBER, 0, 100, 0, DRAWS, a);
+  philox_fill (12345, PHILOX_FIBER, 0, 100, 0, DRAWS, b);
+  check (memcmp (a, b, sizeof a) == 0, "the same seed gave a different stream");
+
+  philox_fill (12346, PHILOX_FIBER, 0, 100, 0, DRAWS, b);
+  for (n = same = 0; n < DRAWS; n++)
+    same += a[n] == b[n];
+  check (same < 2, "two seeds gave the same stream");
+
+  for (n = 0; n < DRAWS; n++)
+    check (a[n] >= 0 && a[n] < 1, "a draw is outside [0, 1)");
+
+  if (!failed)
+    printf ("check_philox: known answers, fill, and per-seed streams all good\n");
+  return failed;
+}
@@ -0,0 +1,82 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Check for the thread pool in threadpool.c, run by make check.
+
+   Starts and stops the pool over and over, the way build_network and a
+   sweep worker do, and checks after every pool_run that all of its tasks
+   have finished. A worker left over from an earlier pool_run would let
+   pool_run return with tasks still running, or wait forever.
+
+   usage: check_pool [restarts] [threads]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+#define TASKS 64
+#define RUNS  8
+
+static atomic_int done[TASKS];
+
+static void
+task (int tn, void *arg)
+{
+  (void) arg;
+  // keep some tasks busy long enough for a stray worker to show up
+  if (tn % 7 == 0)
+    for (int n = 0; n < 100; n++)
+      sched_yield ();
+  atomic_store (&done[tn], 1);
+}
+
+int
+main (int argc, char **argv)
+{
+  int restarts = argc > 1 ? atoi (argv[1]) : 1000;
+  int threads = argc > 2 ? atoi (argv[2]) : 4;
+  int rn, run, tn, missed = 0;
+
+  alarm (600);  // a worker that lost count leaves pool_run waiting forever
+  for (rn = 0; rn < restarts; rn++)
+  {
+    pool_start (threads);
+    for (run = 0; run < RUNS; run++)
+    {
+      for (tn = 0; tn < TASKS; tn++)
+        atomic_store (&done[tn], 0);
+      pool_run (task, NULL, TASKS);
+      for (tn = 0; tn < TASKS; tn++)
+        if (!atomic_load (&done[tn]))
+          missed++;
+    }
+    pool_stop ();
+  }
+  if (missed)
+  {
+    fprintf (stderr, "check_pool: %d tasks still running after pool_run returned\n", missed);
+    return 1;
+  }
+  printf ("check_pool: %d restarts of %d threads, all tasks finished\n", restarts, threads);
+  return 0;
+}
@@ -0,0 +1,128 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Pooled connectivity storage and its CSR index.  See csr.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "simulator.h"
+#include "csr.h"
+#include "util.h"
+#include "arena.h"
+
+// The pools are sized by build_network, and everything it takes from
+// them must use them up exactly. The Target pool is needed before the
+// synapses are counted, the other two only after.
+void
+csr_alloc_targets (Network *np, size_t target_count)
+{
+  Arena *a = np->arena;
+  Csr *csr;
+
+  ACALLOC (a, csr, 1);
+  ACALLOC (a, csr->target_pool, target_count);
+  csr->target_count = target_count;
+  np->csr = csr;
+}
+
+void
+csr_alloc_syns (Network *np, size_t syn_count, size_t q_count)
+{
+  Arena *a = np->arena;
+  Csr *csr = CSR (np);
+
+  ACALLOC (a, csr->syn_pool, syn_count);
+  ACALLOC (a, csr->q_pool, q_count);
+  csr->syn_count = syn_count;
+  csr->q_count = q_count;
+}
+
+Target *
+csr_take_targets (Csr *csr, int count)
+{
+  Target *t = csr->target_pool + csr->target_used;
+  (csr->target_used += count) <= csr->target_count || DIE;
+  return t;
+}
+
+Syn *
+csr_take_syns (Csr *csr, int count)
+{
+  Syn *s = csr->syn_pool + csr->syn_used;
+  (csr->syn_used += count) <= csr->syn_count || DIE;
+  return s;
+}
+
+float *
+csr_take_q (Csr *csr, int count)
+{
+  float *q = csr->q_pool + csr->q_used;
+  (csr->q_used += count) <= csr->q_count || DIE;
+  return q;
+}
+
+void
+csr_index (Network *np)
+{
+  Arena *a = np->arena;
+  Csr *csr = CSR (np);
+  int pn, n, s = 0;
+  size_t t;
+
+  csr->target_used == csr->target_count || DIE;
+  csr->syn_used == csr->syn_count || DIE;
+  csr->q_used == csr->q_count || DIE;
+
+  csr->source_count = 0;
+  for (pn = 0; pn < np->cellpop_count; pn++)
+    csr->source_count += np->cellpop[pn].cell_count;
+  for (pn = 0; pn < np->fiberpop_count; pn++)
+    csr->source_count += np->fiberpop[pn].fiber_count;
+
+  ACALLOC (a, csr->cell_base, np->cellpop_count + 1);
+  ACALLOC (a, csr->fiber_base, np->fiberpop_count + 1);
+  ACALLOC (a, csr->off, csr->source_count + 1);
+  for (pn = 0; pn < np->cellpop_count; pn++)
+  {
+    CellPop *p = np->cellpop + pn;
+    csr->cell_base[pn] = s;
+    for (n = 0; n < p->cell_count; n++)
+      csr->off[s++] = p->cell[n].target - csr->target_pool;
+  }
+  for (pn = 0; pn < np->fiberpop_count; pn++)
+  {
+    FiberPop *p = np->fiberpop + pn;
+    csr->fiber_base[pn] = s;
+    for (n = 0; n < p->fiber_count; n++)
+      csr->off[s++] = p->fiber[n].target - csr->target_pool;
+  }
+  csr->off[s] = csr->target_count;
+
+  ACALLOC (a, csr->delay, csr->target_count + 1);
+  ACALLOC (a, csr->strength, csr->target_count + 1);
+  ACALLOC (a, csr->syn, csr->target_count + 1);
+  for (t = 0; t < csr->target_count; t++)
+  {
+    Target *target = csr->target_pool + t;
+    csr->delay[t] = target->delay;
+    csr->strength[t] = target->strength;
+    csr->syn[t] = target->disabled ? -1 : target->syn - csr->syn_pool;
+  }
+  fprintf (stdout, "CSR connectivity: %d sources, %zu terminals, %zu synapses, %zu q slots\n",
+           csr->source_count, csr->target_count, csr->syn_count, csr->q_count);
+}
@@ -0,0 +1,75 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CSR_H
+#define CSR_H
+
+/* Compressed sparse row layout of the network connectivity, used when
+   simrun is started with --csr.
+
+   build_network normally gives every cell and fiber its own Target
+   array, every cell its own Syn array and every synapse its own q ring,
+   interleaved in the network arena in the order they are built.  With
+   --csr each kind comes out of its own pool instead, handed out in
+   build order: cell pops, then fiber pops, each cell or fiber in turn.  The per-cell pointers (c->target,
+   c->syn, syn->q) still point into the pools, so condi, sample_cells
+   and the rest of the per-cell code work unchanged.
+
+   Once the synapses are attached, csr_index packs the terminals into
+   parallel arrays in the same order as the Target pool.  Sources are
+   numbered cell pops first, then fiber pops, and the terminals of
+   source s are off[s] up to off[s+1].  A disabled terminal has a syn
+   index of -1.  simloop delivers spikes from these arrays, which are
+   half the size of the Target records and have no pointers to chase.
+*/
+typedef struct
+{
+  Target *target_pool;
+  size_t target_count, target_used;
+  Syn *syn_pool;
+  size_t syn_count, syn_used;
+  float *q_pool;
+  size_t q_count, q_used;
+
+  int source_count;
+  int *cell_base;     // first source number of each cell pop
+  int *fiber_base;    // first source number of each fiber pop
+  size_t *off;        // source_count + 1 offsets into the terminal arrays
+  int *delay;
+  float *strength;
+  int *syn;           // index into syn_pool, -1 if disabled
+} Csr;
+
+#define CSR(np) ((Csr *)(np)->csr)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void csr_alloc_targets (Network *np, size_t target_count);
+void csr_alloc_syns (Network *np, size_t syn_count, size_t q_count);
+Target *csr_take_targets (Csr *csr, int count);
+Syn *csr_take_syns (Csr *csr, int count);
+float *csr_take_q (Csr *csr, int count);
+void csr_index (Network *np);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
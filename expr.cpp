@@ -26,10 +26,15 @@ This file is part of the USF Neural Simulator suite.
 using namespace std;
 using namespace mu;
 
+// last_arg/last_val remember the most recent evaluation, so pops that
+// share an expression, or ask twice in a step, do not run the parser again.
 struct expr
 {
   double val;
   Parser *p;
+  bool have_last;
+  double last_arg;
+  double last_val;
 };
 
 Expr *
@@ -39,6 +44,7 @@ xp_set (char *txt)
   if (!e)
     return e;
   e->val = 0;
+  e->have_last = false;
   e->p = new (nothrow) Parser;
   if (!e->p) {
     delete e;
@@ -47,6 +53,7 @@ xp_set (char *txt)
   try {
     e->p->DefineVar("V", &e->val); 
     e->p->SetExpr (txt);
+    e->p->Eval ();   // parse now, later calls run the bytecode
   }
   catch (Parser::exception_type &err) {
     std::cout << err.GetMsg() << std::endl;
@@ -60,6 +67,8 @@ xp_set (char *txt)
 double
 xp_eval (Expr *e, double arg)
 {
+  if (e->have_last && arg == e->last_arg)
+    return e->last_val;
   e->val = arg;
   double val;
   try {
@@ -69,6 +78,9 @@ xp_eval (Expr *e, double arg)
     std::cout << err.GetMsg() << endl;
     abort ();
   }
+  e->have_last = true;
+  e->last_arg = arg;
+  e->last_val = val;
   return val;
 }
 
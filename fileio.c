@@ -22,6 +22,12 @@ This file is part of the USF Neural Simulator suite.
 #include <malloc.h>
 #include <string.h>
 #include <stdio.h>
+#if defined __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 #include "fileio.h"
 #include "hash.h"
 #include "util.h"
@@ -696,45 +702,67 @@ save_struct (FILE *f, char *struct_name, void *struct_ptr)
   free (tag_info); tag_info = 0; tag_info_count = 0; tag_info_alloc = 0;
 }
 
+// The loader works on the whole file in memory (a LoadBuf) instead of a
+// line at a time from a FILE.  Lines are cut in place, the
+// "struct.member" hash key is put together in a buffer on the stack, and
+// strings and multiline values are handed to the val functions where
+// they sit in the buffer, so nothing is allocated per line.
+
+// The end of the line at s: its '\n', or the 0 after the last byte.
+static inline char *
+line_end (LoadBuf *b, char *s)
+{
+  char *e = memchr (s, '\n', b->base + b->size - s);
+  return e ? e : b->base + b->size;
+}
+
+// The next line, with its '\n' replaced by a 0, or 0 at the end of the
+// buffer.  *eol is left at where the '\n' was.
 static char *
-get_multiline (FILE *f)
+next_line (LoadBuf *b, char **eol)
 {
-  static char *s = 0;
-  static size_t slen = 0;
-  static char *buf;
-  static int buflen;
-  int len, space_left;
-  char *p;
+  char *s = b->p, *e;
 
-  p = buf;
-  if ((space_left = buflen) == 0)
-    TCALLOC (buf, space_left = buflen = 4096);
+  if (s >= b->base + b->size)
+    return 0;
+  e = line_end (b, s);
+  *e = 0;
+  b->p = e < b->base + b->size ? e + 1 : e;
+  *eol = e;
+  return s;
+}
 
-  while ((len = getline (&s, &slen, f)) > 0) {
-    if (len == 0 || len == strspn (s, white))
-      return buf;
-    if (len + 1 > space_left)
-      TREALLOC (buf, buflen *= 2);
-    strcpy (p, s);
-    p += len;
-    space_left -= len;
+// The lines up to the next blank one, newlines included.
+static char *
+get_multiline (LoadBuf *b)
+{
+  char *start = b->p, *end = b->base + b->size, *s, *e;
+
+  for (s = start; s < end; s = e + 1) {
+    e = line_end (b, s);
+    if (s + strspn (s, " \r\t") >= e) {
+      *s = 0;
+      b->p = e < end ? e + 1 : e;
+      return start;
+    }
   }
-  return buf;
+  b->p = end;
+  return start;
 }
 
+// varname is the key buffer from load_struct_buf, len its length
 static inline void
-maybe_array_size (char *varname, StructInfo *v, char *number_string, void *struct_ptr)
+maybe_array_size (char *varname, int len, StructInfo *v, char *number_string, void *struct_ptr)
 {
-  int len = strlen (varname);
-  char *ptrname;
   StructInfo *vp;
   if (CHAT) {printf("%s   %s\n",varname,number_string); fflush(stdout);}
   if (v->size != sizeof (int) || v->count != 1 || v->struct_name != 0
       || len < 6 || strcmp (varname + len - 6, "_count") != 0)
     return;
-  ptrname = strdup (varname);
-  ptrname[len - 6] = 0;
-  if ((vp = struct_info_fn (ptrname, len - 6)) != 0 && vp->ptr) {
+  varname[len - 6] = 0;
+  vp = struct_info_fn (varname, len - 6);
+  varname[len - 6] = '_';
+  if (vp != 0 && vp->ptr) {
     int new_count, old_count, old_size, new_size, usable_size, new_start, new_usable_size;
     void *t;
     new_count = atoi (number_string);
@@ -759,45 +787,24 @@ maybe_array_size (char *varname, StructInfo *v, char *number_string, void *struc
       memset (t + new_start, 0, new_usable_size - new_start);
     }
   }
-  free (ptrname);
 }
 
+// The count bytes after the current line, and the '\n' after them, which
+// becomes the string's 0.  The string is moved down over any \r in place.
 static char *
-get_string (FILE *f, int count)
+get_string (LoadBuf *b, int count)
 {
-  static char *buf;
-  static int buflen;
+  char *s, *d, *end = b->base + b->size;
+  int byte = 0;
 
-  int txt;
-  if (count == -1)
-    return 0;
-  if (buflen < count + 1)
-    TREALLOC (buf, buflen = count + 1);
-  for (int byte=0; byte < count+1; ++byte)
-  {
-     txt = fgetc(f);
-     if (txt == '\r') // if a dos file, this is not included in count
-     {
-        --byte;
-        continue;
-     }
-     buf[byte] = txt;
-  }
-  buf[count] = 0;  // overwrite '\n'
-  return buf;
-#if 0
-// was this, but the count is too small because \r is not counted
   if (count == -1)
     return 0;
-  if (buflen < count + 1)
-    TREALLOC (buf, buflen = count + 1);
-  if (fread (buf, 1, count + 1, f) != count + 1) {
-    fprintf (stdout, "string count %d is too big\n", count);
-    exit (1);
-  }
-  buf[count] = 0;
-  return buf;
-#endif
+  for (s = d = b->p; byte < count + 1 && s < end; s++)
+    if (*s != '\r') // if a dos file, this is not included in count
+      d[byte++] = *s;
+  d[MIN (byte, count)] = 0;  // overwrite '\n'
+  b->p = s;
+  return d;
 }
 
 static int
@@ -814,42 +821,54 @@ get_offset (StructInfo *v, int n, int *sizep, char **number_string_ptr)
   return offset + index * size;
 }
 
+#define KEY_MAX 256
+
 void
-load_struct (FILE *f, char *struct_name, void *struct_ptr, int ptr_valid)
+load_struct_buf (LoadBuf *b, char *struct_name, void *struct_ptr, int ptr_valid)
 {
-  static char *s = 0;
-  static size_t slen = 0;
   struct StructInfo *v;
-  char *varname, *number_string, *member_name;
-  int len;
+  char *s, *eol, *number_string, *member_name;
+  char varname[KEY_MAX];
+  int prefix_len, member_len, len;
 
-  while ((len = getline (&s, &slen, f)) > 0) {
+  prefix_len = strlen (struct_name) + 1;
+  prefix_len < KEY_MAX || DIE;
+  memcpy (varname, struct_name, prefix_len - 1);
+  varname[prefix_len - 1] = '.';
+
+  while ((s = next_line (b, &eol)) != 0) {
     int ptr_index = 0;
     if ((member_name = strtok (s, white)) == 0)
       return;
-    number_string = member_name + strlen (member_name) + 1;
+    member_len = strlen (member_name);
+    number_string = member_name + member_len + 1;
     if (CHAT) {printf("%s %s\n",struct_name,member_name); fflush(stdout);}
-    number_string < s + len || DIE;
+    number_string <= eol || DIE;
     if (number_string[0] == '&')
-      number_string = get_multiline (f);
-    if (asprintf (&varname, "%s.%s", struct_name, member_name) == -1) exit (1);
-    v = struct_info_fn (varname, strlen (varname));
+      number_string = get_multiline (b);
+    len = prefix_len + member_len;
+    if (len >= KEY_MAX)
+      v = 0;
+    else {
+      memcpy (varname + prefix_len, member_name, member_len + 1);
+      v = struct_info_fn (varname, len);
+    }
     if (v == 0) {
-      fprintf (stdout, "load_struct: %s not found in hash\n", varname);
+      fprintf (stdout, "load_struct: %s.%s not found in hash\n", struct_name, member_name);
       continue;
     }
     if (ptr_valid)
-      maybe_array_size (varname, v, number_string, struct_ptr);
-    free (varname);
+      maybe_array_size (varname, len, v, number_string, struct_ptr);
     if (strchr ("t", number_string[0]) && ptr_valid) {
       tag (number_string, v, struct_ptr);
       continue;
     }
     if (strchr ("di", number_string[0]) && ptr_valid) {
-      char *ref_string = strdup (number_string);
-      char *tag_string = strtok (number_string, white);
-      char *ref_index_string;
+      char ref_string[KEY_MAX];
+      char *tag_string, *ref_index_string;
       int ref_index = 0;
+      snprintf (ref_string, sizeof ref_string, "%s", number_string);
+      tag_string = strtok (number_string, white);
       if (v->count > 1) {
  ref_index_string = strtok (0, white);
  if (ref_index_string == 0) {
@@ -859,7 +878,6 @@ load_struct (FILE *f, char *struct_name, void *struct_ptr, int ptr_valid)
  ref_index = atoi (ref_index_string);
       }
       tagref (tag_string, ref_string, v, struct_ptr + ref_index * sizeof (void *));
-      free (ref_string);
       continue;
     }
     ptr_index = 0;
@@ -883,18 +901,113 @@ load_struct (FILE *f, char *struct_name, void *struct_ptr, int ptr_valid)
       }
       if (this_ptr_valid)
         memset (this_struct_ptr, 0, v->size);
-      load_struct (f, v->struct_name, this_struct_ptr, this_ptr_valid);
+      load_struct_buf (b, v->struct_name, this_struct_ptr, this_ptr_valid);
     }
     else if (ptr_valid) {
       int size, aoffset;
       aoffset = get_offset (v, 0, &size, &number_string);
       if (v->string)
- number_string = get_string (f, atoi (number_string));
+ number_string = get_string (b, atoi (number_string));
       v->val (number_string, struct_ptr + v->offset + aoffset + ptr_index * sizeof (void *), v->size * v->count);
     }
   }
 }
 
+// Reads the rest of f into b.
+static void
+load_buf_read (LoadBuf *b, FILE *f)
+{
+  size_t n, alloc = 65536;
+
+  memset (b, 0, sizeof *b);
+  TMALLOC (b->base, alloc);
+  while ((n = fread (b->base + b->size, 1, alloc - b->size - 1, f)) > 0)
+    if ((b->size += n) + 1 == alloc)
+      TREALLOC (b->base, alloc *= 2);
+  b->base[b->size] = 0;
+  b->p = b->base;
+}
+
+// simbuild and the tools read from a FILE they have opened and checked
+// the version of.  This takes the rest of it.
+void
+load_struct (FILE *f, char *struct_name, void *struct_ptr, int ptr_valid)
+{
+  LoadBuf b;
+
+  load_buf_read (&b, f);
+  load_struct_buf (&b, struct_name, struct_ptr, ptr_valid);
+  load_buf_close (&b);
+}
+
+// Maps filename copy on write, or reads it if it can't be mapped.
+// Returns 0 if it can't be opened.
+int
+load_buf_open (LoadBuf *b, char *filename)
+{
+  FILE *f;
+
+#if defined __linux__
+  struct stat st;
+  int fd;
+
+  if ((fd = open (filename, O_RDONLY)) < 0)
+    return 0;
+  if (fstat (fd, &st) != 0 || S_ISDIR (st.st_mode)) {
+    close (fd);
+    return 0;
+  }
+  // The 0 after the last byte goes in the tail of the last page, which
+  // the kernel fills with zeros.  A file that ends on a page boundary
+  // has no tail, so it is read instead.  The parser writes to every
+  // page, so they are all faulted in up front.
+  if (S_ISREG (st.st_mode) && st.st_size > 0 && st.st_size % sysconf (_SC_PAGESIZE) != 0) {
+    void *p = mmap (0, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (p != MAP_FAILED) {
+      close (fd);
+      b->base = b->p = p;
+      b->size = st.st_size;
+      b->mapped = 1;
+      return 1;
+    }
+  }
+  if ((f = fdopen (fd, "r")) == 0) {
+    close (fd);
+    return 0;
+  }
+#else
+  if ((f = fopen (filename, "r")) == 0)
+    return 0;
+#endif
+  load_buf_read (b, f);
+  fclose (f);
+  return 1;
+}
+
+// A copy of size bytes at data, for the files simbuild sends over the
+// direct connect.
+void
+load_buf_mem (LoadBuf *b, const char *data, size_t size)
+{
+  memset (b, 0, sizeof *b);
+  TMALLOC (b->base, size + 1);
+  memcpy (b->base, data, size);
+  b->base[size] = 0;
+  b->size = size;
+  b->p = b->base;
+}
+
+void
+load_buf_close (LoadBuf *b)
+{
+#if defined __linux__
+  if (b->mapped)
+    munmap (b->base, b->size + 1);
+  else
+#endif
+    free (b->base);
+  memset (b, 0, sizeof *b);
+}
 
 // the inode_global struct does not have a field for the file version, it
 // is the first line of text in the output file.
@@ -912,13 +1025,9 @@ save_struct_open (char *filename)
 static char *load_struct_filename = "the .sim file";
 
 
-// the simulator engine uses the next two functions
-int
-load_struct_read_version (FILE *f)
+static int
+check_version (int format_version)
 {
-   int format_version = 0;
-
-   fscanf(f, "file_format_version %d\n", &format_version);
    Version = format_version;
    if (format_version != FILEIO_FORMAT_VERSION6) {
       fprintf (stdout, "The format of %s is an earlier version which\nthe simbuild package does not support.\n"
@@ -929,6 +1038,31 @@ load_struct_read_version (FILE *f)
    return 1;
 }
 
+// the simulator engine uses the next three functions
+int
+load_struct_read_version (FILE *f)
+{
+   int format_version = 0;
+
+   fscanf(f, "file_format_version %d\n", &format_version);
+   return check_version (format_version);
+}
+
+// the same as load_struct_read_version, for a LoadBuf
+int
+load_buf_read_version (LoadBuf *b)
+{
+   static const char key[] = "file_format_version";
+   int format_version = 0;
+   char *p = b->p, *endptr;
+
+   if (strncmp (p, key, sizeof key - 1) == 0) {
+      format_version = strtol (p + sizeof key - 1, &endptr, 10);
+      b->p = endptr + strspn (endptr, " \t\r\n\v\f");
+   }
+   return check_version (format_version);
+}
+
 FILE *
 load_struct_open (char *filename)
 {
@@ -36,6 +36,24 @@ size_t malloc_usable_size (void*);
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+// A whole .sim or .snd file in memory.  load_struct_buf cuts it up in
+// place, so it is a private mapping or a copy, with a 0 after the last
+// byte.
+typedef struct
+{
+  char *base;
+  size_t size;
+  char *p;        // where the parser is
+  int mapped;
+} LoadBuf;
+
+int load_buf_open (LoadBuf *b, char *filename);
+void load_buf_mem (LoadBuf *b, const char *data, size_t size);
+void load_buf_close (LoadBuf *b);
+int load_buf_read_version (LoadBuf *b);
+void load_struct_buf (LoadBuf *b, char *struct_name, void *struct_ptr, int ptr_valid);
+
 void print_member (FILE *f, char *struct_name, char *member, void *struc);
 void load_struct (FILE *f, char *struct_name, void *struct_ptr, int ptr_valid);
 void save_struct (FILE *f, char *struct_name, void *struct_ptr);
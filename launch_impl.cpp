@@ -38,6 +38,7 @@ This file is part of the USF Neural Simulator suite.
 #include <QString>
 #include <QTextStream>
 #include <QFile>
+#include <QRegularExpression>
 
 #include "lin2ms.h"
 #include "ui_launchwindow.h"
@@ -1025,7 +1026,10 @@ bool launchWindow::validateFiles()
          F_NODE *fn = &D.inode[node].unode.fiber_node;
          if (fn->pop_subtype == AFFERENT && strlen(fn->afferent_file))
          {
-            QFile test(fn->afferent_file);
+            QString name(fn->afferent_file);
+            QRegularExpression chan(":[0-9]+$");  // file.smr:N picks a channel
+            name.remove(chan);
+            QFile test(name);
             if (!test.exists())
             {
                QMessageBox msgBox;
@@ -1333,9 +1337,9 @@ void launchWindow::launchSim()
       {
        // delete wave files for this launch number
 #ifdef Q_OS_LINUX
-         asprintf(&cmd, "/bin/bash -c \'rm -f wave.%02d.????\'",currModel);
+         asprintf(&cmd, "/bin/bash -c \'rm -f wave.%02d.???? wave.%02d.bin\'",currModel,currModel);
 #else
-         asprintf(&cmd, "cmd.exe /C del wave.%02d.????",currModel);
+         asprintf(&cmd, "cmd.exe /C del wave.%02d.???? wave.%02d.bin",currModel,currModel);
 #endif
          result = system(cmd);
          if (result == -1)
@@ -1383,14 +1383,27 @@ time_t global_last_time;
 static double xio_0, xio_1;
 #endif
 
+/* what lung () and dVdt () carry from one call to the next, in one place
+   so lung_get_state and lung_set_state can save and restore it */
+static struct
+{
+  Params params;
+  double y[2];                  /* Vdi, Vab */
+  double step_size;
+  double t;
+  int pass;
+  double xio[2];                /* dVdt: Vdi_t, Vab_t from the last call */
+  double t0;                    /* dVdt: t of the last call */
+  int dvdt_pass;
+} ls = {.step_size = 1e-6};
+
 /* calculates the time derivatives of the volumes (f, Vdi_t and Vab_t) from the volumes (y, Vdi and
    Vab), for the ode solver using a multiroot solver */
 static int
 dVdt (double t, const double y[], double f[], void *params)
 {
 
-  static int pass;
-  pass++;
+  int pass = ++ls.dvdt_pass;
 
   extern time_t global_last_time;
   time_t now;
@@ -1405,7 +1418,7 @@ dVdt (double t, const double y[], double f[], void *params)
   p->Vab = y[1];
   double VL = get_VL (y[0], y[1]);
 
-  static double xio[2];         /* Vdi_t, Vab_t */
+  double *xio = ls.xio;         /* Vdi_t, Vab_t */
 
   
 
@@ -1417,7 +1430,7 @@ dVdt (double t, const double y[], double f[], void *params)
 #endif
 
   double xio0[2]; xio0[0] = xio[0]; xio0[1] = xio[1];
-  static double t0;
+  double t0 = ls.t0;
 
   debug = false;
   Params p0 = *p;
@@ -1505,10 +1518,29 @@ dVdt (double t, const double y[], double f[], void *params)
   p->Vdi_t = f[0] = xio[0];                /* Vdi_t */
   p->Vab_t = f[1] = xio[1];                /* Vab_t */
   
-  t0 = t;
+  ls.t0 = t;
   return 0;
 }
 
+/* the state lung () carries between steps, for checkpoints.  With buf 0
+   this just returns the size. */
+size_t
+lung_get_state (void *buf)
+{
+  if (buf)
+    memcpy (buf, &ls, sizeof ls);
+  return sizeof ls;
+}
+
+int
+lung_set_state (const void *buf, size_t size)
+{
+  if (size != sizeof ls)
+    return 0;
+  memcpy (&ls, buf, sizeof ls);
+  return 1;
+}
+
 /* calculate Rohrer's constants for the larynx as a function of the
    laryngeal muscle activation */
 static void
@@ -1597,24 +1629,22 @@ init_ode_solver (gsl_odeiv_step **s, gsl_odeiv_control **c, gsl_odeiv_evolve **e
 State
 lung (Motor m, double Sstep)
 {
-  /* state - can change every step */
-  static Params params;
-  static double y[2];  /* = {Vdi0, Vab0}; */
-  static double step_size = 1e-6;
-  static double t;
+  /* state - can change every step, kept in ls */
+  double *y = ls.y;  /* = {Vdi0, Vab0}; */
+  double step_size = ls.step_size;
+  double t = ls.t;
 
   /* one time setup */
-  static gsl_odeiv_system sys = {dVdt, NULL/*no Jacobian*/, 2, &params};
+  static gsl_odeiv_system sys = {dVdt, NULL/*no Jacobian*/, 2, &ls.params};
   static gsl_odeiv_step *s;
   static gsl_odeiv_control *c;
   static gsl_odeiv_evolve *e;
   if (s == NULL) init_ode_solver (&s, &c, &e, y);
   
-  static int pass;
-  pass++;
+  int pass = ++ls.pass;
 
-  rohrer_constants (&params);
-  Params *p = &params;
+  rohrer_constants (&ls.params);
+  Params *p = &ls.params;
   if (0)printf ("Sstep: %g, t = %g\n", Sstep, t);
   for (double t1 = t + Sstep / 1000; t < t1; ) {
     if (0)
@@ -1664,8 +1694,10 @@ lung (Motor m, double Sstep)
       error (1, 0, "%s", "ODE solver failed");
     
   }
+  ls.t = t;
+  ls.step_size = step_size;
 
-  update_activation (m, &params, Sstep);
+  update_activation (m, &ls.params, Sstep);
 
   //  error (0, 0, "%d: %8.5f %8.5f %8.5f %11.8f", pass, y[0], y[1], get_VL (y[0], y[1]), step_size);
 
@@ -1674,17 +1706,17 @@ lung (Motor m, double Sstep)
 
   double VL = get_VL (y[0], y[1]);
   double VL_t = get_VL_t (e->dydt_out[0], e->dydt_out[1]);
-  double sigma_di = get_sigma_di (params.Phr_d, y[0], e->dydt_out[0], 0, 1);
-  double sigma_ab = get_sigma_ab (params.u, y[1], e->dydt_out[1], 0, 1);
+  double sigma_di = get_sigma_di (ls.params.Phr_d, y[0], e->dydt_out[0], 0, 1);
+  double sigma_ab = get_sigma_ab (ls.params.u, y[1], e->dydt_out[1], 0, 1);
   double sigma_L = get_sigma_L (VL);
   State st;
   st.pressure = (sigma_ab + sigma_L - sigma_di) / 2.78; /* cmH2O, 2.78 scales for a cat - see notes100304 */
   st.volume = (VL - VL0) / VC * 100;           /* %VC relative to RV */
   st.flow = -VL_t / VC * 100;                   /* %VC / sec */
 
-  st.Phr_d = params.Phr_d_i;
-  st.u = params.u_i;
-  st.lma = params.lma_i;
+  st.Phr_d = ls.params.Phr_d_i;
+  st.u = ls.params.u_i;
+  st.lma = ls.params.lma_i;
   st.Vdi = y[0];
   st.Vab = y[1];
   st.Vdi_t = e->dydt_out[0];
@@ -15,6 +15,12 @@ This file is part of the USF Neural Simulator suite.
     You should have received a copy of the GNU General Public License
     along with the suite.  If not, see <https://www.gnu.org/licenses/>.
 */
+
+#ifndef LUNG_H
+#define LUNG_H
+
+#include <stddef.h>
+
 typedef struct
 {
   double phrenic;         /* JAH: diaphragm activation?, 0->1 */
@@ -44,3 +50,11 @@ typedef struct
 
 State lung (Motor m, double Sstep);
 extern char baby_lung_flag;
+
+/* Save and restore the lung's state between steps, for checkpoints.
+   lung_get_state (0) returns the size of the buffer it needs, and
+   lung_set_state returns 0 if size is not that. */
+size_t lung_get_state (void *buf);
+int lung_set_state (const void *buf, size_t size);
+
+#endif
@@ -0,0 +1,133 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* The lung worker for simrun --lung-thread.  See lungthread.h.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include "lungthread.h"
+#include "util.h"
+
+static pthread_t thread;
+static bool running;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t posted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static bool have_work, have_result, quit;
+static Motor motor;
+static double step;
+static State result;
+static double waited;          // seconds simloop spent in lung_thread_wait
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *
+lung_main (void *unused)
+{
+  (void) unused;
+  pthread_mutex_lock (&lock);
+  while (1)
+  {
+    while (!have_work && !quit)
+      pthread_cond_wait (&posted, &lock);
+    if (quit)
+      break;
+    have_work = false;
+    Motor m = motor;
+    double Sstep = step;
+    pthread_mutex_unlock (&lock);
+
+    State st = lung (m, Sstep);
+
+    pthread_mutex_lock (&lock);
+    result = st;
+    have_result = true;
+    pthread_cond_signal (&done);
+  }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+void
+lung_thread_start (void)
+{
+  if (running)
+    return;
+  quit = have_work = have_result = false;
+  waited = 0;
+  pthread_create (&thread, NULL, lung_main, NULL) == 0 || DIE;
+  running = true;
+}
+
+void
+lung_thread_post (Motor m, double Sstep)
+{
+  pthread_mutex_lock (&lock);
+  motor = m;
+  step = Sstep;
+  have_work = true;
+  have_result = false;
+  pthread_cond_signal (&posted);
+  pthread_mutex_unlock (&lock);
+}
+
+State
+lung_thread_wait (void)
+{
+  State st;
+  double t = now ();
+
+  pthread_mutex_lock (&lock);
+  while (!have_result)
+    pthread_cond_wait (&done, &lock);
+  have_result = false;
+  st = result;
+  pthread_mutex_unlock (&lock);
+  waited += now () - t;
+  return st;
+}
+
+void
+lung_thread_stop (void)
+{
+  if (!running)
+    return;
+  pthread_mutex_lock (&lock);
+  quit = true;
+  pthread_cond_signal (&posted);
+  pthread_mutex_unlock (&lock);
+  pthread_join (thread, NULL);
+  running = false;
+}
+
+double
+lung_thread_waited (void)
+{
+  return waited;
+}
@@ -0,0 +1,49 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef LUNGTHREAD_H
+#define LUNGTHREAD_H
+
+/* Runs lung () on a thread of its own (simrun --lung-thread).
+
+   simloop calls lung () at the top of step n with the motor drive from
+   the spikes of step n-1, and the State it returns is not looked at until
+   step n+1: step n's injected currents and lung plots still use the State
+   from step n-1. So the lung integration for a step can run while the
+   cells of the same step are updated, and the results are the same as
+   calling lung () directly. lung_thread_post starts one call, and
+   lung_thread_wait returns its State. Only one call can be outstanding.
+*/
+
+#include "lung.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void  lung_thread_start (void);
+void  lung_thread_post (Motor m, double Sstep);
+State lung_thread_wait (void);
+void  lung_thread_stop (void);
+double lung_thread_waited (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,589 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Saving and loading built networks.  See netimage.h.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined __linux__
+#include <sys/mman.h>
+#endif
+#include "simulator.h"
+#include "inode.h"
+#include "simrun_wrap.h"
+#include "cellstate.h"
+#include "csr.h"
+#include "arena.h"
+#include "netimage.h"
+
+#define NET_IMAGE_VERSION 2
+#define NET_IMAGE_ALIGN 4096
+
+extern int csr_flag;
+extern int haveLearn;
+extern int learnCPop[];
+extern int numCPop;
+extern int learnFPop[];
+extern int numFPop;
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t sizes[6];     // of Cell, Syn, Target, Fiber, Csr and a pointer
+  uint64_t key;
+  int32_t cellpop_count;
+  int32_t fiberpop_count;
+  int32_t syntype_count;
+  int32_t csr;
+  uint64_t size;         // of the whole file
+  uint64_t pops;         // offset of the CellPopImage and FiberPopImage tables
+  uint64_t arena;        // offset of the first arena span
+  uint64_t csr_at;       // offset of the Csr record, 0 without --csr
+  uint64_t state;        // offset of the checkpoint state, 0 if none
+  uint64_t state_size;
+} NetImageHeader;
+
+// What build_network leaves in the pop records
+typedef struct
+{
+  uint64_t cell;
+  int32_t noise_seed;
+  int32_t pad;
+} CellPopImage;
+
+typedef struct
+{
+  uint64_t fiber;
+  int32_t start;
+  int32_t stop;
+  int32_t next_stim;
+  int32_t next_fixed;
+} FiberPopImage;
+
+static const char magic[8] = "SIMNET\n";
+
+static uint64_t
+fnv (const void *p, size_t n, uint64_t h)
+{
+  const unsigned char *c = p;
+  size_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    h ^= c[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* Fold size bytes at data into h.  Start with h = 0.
+*/
+uint64_t
+net_image_hash (const void *data, size_t size, uint64_t h)
+{
+  if (h == 0)
+    h = 14695981039346656037ULL;
+  return fnv (data, size, h);
+}
+
+uint64_t
+net_image_key (uint64_t h)
+{
+  int build[3] = {NET_IMAGE_VERSION, csr_flag, S.nonoise};
+
+  h = fnv (VERSION, strlen (VERSION), h);
+  return fnv (build, sizeof build, h);
+}
+
+#if defined __linux__
+
+static void
+fill_header (NetImageHeader *h, uint64_t key)
+{
+  memset (h, 0, sizeof *h);
+  memcpy (h->magic, magic, sizeof h->magic);
+  h->version = NET_IMAGE_VERSION;
+  h->sizes[0] = sizeof (Cell);
+  h->sizes[1] = sizeof (Syn);
+  h->sizes[2] = sizeof (Target);
+  h->sizes[3] = sizeof (Fiber);
+  h->sizes[4] = sizeof (Csr);
+  h->sizes[5] = sizeof (void *);
+  h->key = key;
+  h->cellpop_count = S.net.cellpop_count;
+  h->fiberpop_count = S.net.fiberpop_count;
+  h->syntype_count = S.net.syntype_count;
+  h->csr = csr_flag;
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Saving.  The used part of each arena block is copied into the image,
+   and each pointer field is rewritten there as the image offset of what
+   it points to.  Blocks are found by address, and since the walk goes
+   through memory more or less in order the last block found is tried
+   first.
+*/
+
+typedef struct
+{
+  char *data;
+  size_t used;
+  uint64_t at;
+} Span;
+
+static Span *span;
+static int span_count;
+static int span_last;
+static char *out;
+
+static int
+span_cmp (const void *a, const void *b)
+{
+  const Span *x = a, *y = b;
+  return x->data < y->data ? -1 : x->data > y->data;
+}
+
+static uint64_t
+image_off (const void *p)
+{
+  const char *c = p;
+  Span *s = span + span_last;
+  int lo = 0, hi = span_count - 1;
+
+  if (p == 0)
+    return 0;
+  if (c < s->data || c > s->data + s->used)
+  {
+    while (lo < hi)               // the last span starting at or before c
+    {
+      int mid = (lo + hi + 1) / 2;
+      if (span[mid].data <= c)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    s = span + (span_last = lo);
+    (c >= s->data && c <= s->data + s->used) || DIE;
+  }
+  return s->at + (c - s->data);
+}
+
+#define OUT(p)  ((void *) (out + image_off (p)))
+#define REL(p)  ((void *) (uintptr_t) image_off (p))
+
+static void
+save_targets (Target *target, int count)
+{
+  Target *o = OUT (target);
+  int n;
+
+  for (n = 0; n < count; n++)
+    o[n].syn = REL (target[n].syn);
+}
+
+static void
+save_pointers (void)
+{
+  int pn, n, k;
+
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    Cell *oc = OUT (cp->cell);
+    for (n = 0; n < cp->cell_count; n++)
+    {
+      Cell *c = cp->cell + n;
+      Syn *os = OUT (c->syn);
+      oc[n].syn = REL (c->syn);
+      oc[n].target = REL (c->target);
+      for (k = 0; k < c->syn_count; k++)
+        os[k].q = REL (c->syn[k].q);
+      save_targets (c->target, c->target_count);
+    }
+  }
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    Fiber *of = OUT (fp->fiber);
+    for (n = 0; n < fp->fiber_count; n++)
+    {
+      of[n].target = REL (fp->fiber[n].target);
+      save_targets (fp->fiber[n].target, fp->fiber[n].target_count);
+    }
+  }
+  if (S.net.csr)
+  {
+    Csr *csr = CSR (&S.net), *o = OUT (csr);
+    o->target_pool = REL (csr->target_pool);
+    o->syn_pool = REL (csr->syn_pool);
+    o->q_pool = REL (csr->q_pool);
+    o->cell_base = REL (csr->cell_base);
+    o->fiber_base = REL (csr->fiber_base);
+    o->off = REL (csr->off);
+    o->delay = REL (csr->delay);
+    o->strength = REL (csr->strength);
+    o->syn = REL (csr->syn);
+  }
+}
+
+static void
+write_image (const NetImageHeader *h)
+{
+  CellPopImage *cpi = (CellPopImage *) (out + h->pops);
+  FiberPopImage *fpi = (FiberPopImage *) (cpi + S.net.cellpop_count);
+  int n;
+
+  memcpy (out, h, sizeof *h);
+  for (n = 0; n < S.net.cellpop_count; n++)
+  {
+    cpi[n].cell = image_off (S.net.cellpop[n].cell);
+    cpi[n].noise_seed = S.net.cellpop[n].noise_seed;
+  }
+  for (n = 0; n < S.net.fiberpop_count; n++)
+  {
+    FiberPop *fp = S.net.fiberpop + n;
+    fpi[n].fiber = image_off (fp->fiber);
+    fpi[n].start = fp->start;
+    fpi[n].stop = fp->stop;
+    fpi[n].next_stim = fp->next_stim;
+    fpi[n].next_fixed = fp->next_fixed;
+  }
+  for (n = 0; n < span_count; n++)
+    memcpy (out + span[n].at, span[n].data, span[n].used);
+  save_pointers ();
+}
+
+/* Written to name.tmp and renamed, so a reader never sees half an
+   image.  A failure is reported and the run goes on.
+*/
+static bool
+image_save (const char *name, uint64_t key, const void *state, size_t state_size, const char *what)
+{
+  double start = now ();
+  ArenaSpan *as;
+  NetImageHeader h;
+  uint64_t at;
+  char *tmp;
+  int fd, n, err = 0;
+  bool ok = false;
+
+  fill_header (&h, key);
+  span_count = arena_spans (S.net.arena, &as);
+  TMALLOC (span, span_count + 1);
+  for (n = 0; n < span_count; n++)
+  {
+    span[n].data = as[n].data;
+    span[n].used = as[n].used;
+  }
+  free (as);
+  qsort (span, span_count, sizeof *span, span_cmp);
+  span_last = 0;
+
+  h.pops = sizeof h;
+  at = h.pops + S.net.cellpop_count * sizeof (CellPopImage)
+       + S.net.fiberpop_count * sizeof (FiberPopImage);
+  if (state_size)
+  {
+    h.state = at;
+    h.state_size = state_size;
+    at += state_size;
+  }
+  h.arena = at = (at + NET_IMAGE_ALIGN - 1) & ~(uint64_t) (NET_IMAGE_ALIGN - 1);
+  for (n = 0; n < span_count; n++)
+  {
+    span[n].at = at;
+    at = (at + span[n].used + NET_IMAGE_ALIGN - 1) & ~(uint64_t) (NET_IMAGE_ALIGN - 1);
+  }
+  h.size = at;
+  h.csr_at = image_off (S.net.csr);
+
+  if (asprintf (&tmp, "%s.tmp", name) == -1) exit (1);
+  if ((fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC, 0666)) != -1
+      && ftruncate (fd, h.size) == 0
+      && (out = mmap (0, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED)
+  {
+    write_image (&h);
+    if (state_size)
+      memcpy (out + h.state, state, state_size);
+    ok = msync (out, h.size, MS_SYNC) == 0;
+    munmap (out, h.size);
+  }
+  ok = ok && rename (tmp, name) == 0;
+  err = errno;
+  if (fd != -1)
+    close (fd);
+  if (ok)
+    fprintf (stdout, "SIMRUN: %s %s saved in %.3f s, %.1f MB\n",
+             what, name, now () - start, h.size / 1048576.);
+  else
+  {
+    fprintf (stdout, "SIMRUN: cannot save the %s %s: %s\n", what, name, strerror (err));
+    unlink (tmp);
+  }
+  fflush (stdout);
+  free (tmp);
+  free (span);
+  span = 0;
+  out = 0;
+  return ok;
+}
+
+bool
+net_image_save (const char *name, uint64_t key)
+{
+  return image_save (name, key, 0, 0, "network image");
+}
+
+/* A checkpoint is an image of the network as it is now, with state, the
+   rest of what the run needs to go on, stored along with it.
+*/
+bool
+net_image_save_state (const char *name, uint64_t key, const void *state, size_t size)
+{
+  return image_save (name, key, state, size, "checkpoint");
+}
+
+/* Loading.  The image is mapped private, so turning its offsets back
+   into pointers only copies the pages that hold pointers.
+*/
+
+static char *map;
+static uint64_t map_size;
+static uint64_t map_state, map_state_size;
+
+static inline void *
+rel (void *v)
+{
+  uintptr_t off = (uintptr_t) v;
+  if (off == 0)
+    return 0;
+  off < map_size || DIE;
+  return map + off;
+}
+
+static void
+unmap (void *data, size_t size)
+{
+  munmap (data, size);
+}
+
+static void
+load_targets (Target *target, int count)
+{
+  int n;
+  for (n = 0; n < count; n++)
+    target[n].syn = rel (target[n].syn);
+}
+
+static void
+load_pointers (const NetImageHeader *h)
+{
+  CellPopImage *cpi = (CellPopImage *) (map + h->pops);
+  FiberPopImage *fpi = (FiberPopImage *) (cpi + h->cellpop_count);
+  int pn, n, k;
+
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    cp->cell = rel ((void *) (uintptr_t) cpi[pn].cell);
+    cp->noise_seed = cpi[pn].noise_seed;
+    for (n = 0; n < cp->cell_count; n++)
+    {
+      Cell *c = cp->cell + n;
+      c->syn = rel (c->syn);
+      c->target = rel (c->target);
+      for (k = 0; k < c->syn_count; k++)
+        c->syn[k].q = rel (c->syn[k].q);
+      load_targets (c->target, c->target_count);
+    }
+  }
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    fp->fiber = rel ((void *) (uintptr_t) fpi[pn].fiber);
+    fp->start = fpi[pn].start;
+    fp->stop = fpi[pn].stop;
+    fp->next_stim = fpi[pn].next_stim;
+    fp->next_fixed = fpi[pn].next_fixed;
+    for (n = 0; n < fp->fiber_count; n++)
+    {
+      Fiber *f = fp->fiber + n;
+      f->target = rel (f->target);
+      load_targets (f->target, f->target_count);
+    }
+  }
+  S.net.csr = rel ((void *) (uintptr_t) h->csr_at);
+  if (S.net.csr)
+  {
+    Csr *csr = CSR (&S.net);
+    csr->target_pool = rel (csr->target_pool);
+    csr->syn_pool = rel (csr->syn_pool);
+    csr->q_pool = rel (csr->q_pool);
+    csr->cell_base = rel (csr->cell_base);
+    csr->fiber_base = rel (csr->fiber_base);
+    csr->off = rel (csr->off);
+    csr->delay = rel (csr->delay);
+    csr->strength = rel (csr->strength);
+    csr->syn = rel (csr->syn);
+  }
+}
+
+/* Returns false, after saying why, if the image cannot be used, and the
+   caller builds the network instead.  Otherwise this does what
+   build_network would have.
+*/
+bool
+net_image_load (const char *name, uint64_t key)
+{
+  double start = now ();
+  NetImageHeader h, want;
+  struct stat st;
+  int fd, pn;
+
+  fill_header (&want, key);
+  if ((fd = open (name, O_RDONLY)) == -1)
+  {
+    fprintf (stdout, "SIMRUN: cannot open the network image %s: %s\n", name, strerror (errno));
+    return false;
+  }
+  if (fstat (fd, &st) == -1 || pread (fd, &h, sizeof h, 0) != sizeof h
+      || memcmp (h.magic, magic, sizeof magic) || h.version != want.version
+      || memcmp (h.sizes, want.sizes, sizeof h.sizes) || h.size != (uint64_t) st.st_size
+      || h.state > h.size || h.state_size > h.size - h.state)
+  {
+    fprintf (stdout, "SIMRUN: %s is not a network image from this simrun\n", name);
+    close (fd);
+    return false;
+  }
+  if (h.key != want.key || h.cellpop_count != want.cellpop_count
+      || h.fiberpop_count != want.fiberpop_count || h.syntype_count != want.syntype_count
+      || h.csr != want.csr)
+  {
+    fprintf (stdout, "SIMRUN: network image %s was built from other inputs or options\n", name);
+    close (fd);
+    return false;
+  }
+  map_size = h.size;
+  map = mmap (0, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf (stdout, "SIMRUN: cannot map the network image %s: %s\n", name, strerror (errno));
+    return false;
+  }
+
+  map_state = h.state;
+  map_state_size = h.state_size;
+  S.net.arena = arena_adopt (map, map_size, unmap);
+  load_pointers (&h);
+
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    if (cp->haveLearn)
+    {
+      haveLearn = 1;
+      learnCPop[numCPop++] = pn;
+    }
+    cellstate_alloc (cp);
+  }
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    if (fp->haveLearn)
+    {
+      haveLearn = true;
+      learnFPop[numFPop++] = pn;
+    }
+    if (fp->pop_subtype == AFFERENT)
+      openExternalSource (fp);
+  }
+  compile_ic_expressions ();
+
+  fprintf (stdout, "SIMRUN: network loaded from %s in %.3f s, %.1f MB\n",
+           name, now () - start, map_size / 1048576.);
+  fflush (stdout);
+  return true;
+}
+
+/* The checkpoint state of the image net_image_load loaded, 0 if it had
+   none.  It stays mapped along with the arena.
+*/
+const void *
+net_image_state (size_t *size)
+{
+  *size = map_state_size;
+  return map && map_state ? map + map_state : 0;
+}
+
+#else
+
+bool
+net_image_save (const char *name, uint64_t key)
+{
+  (void) key;
+  fprintf (stdout, "SIMRUN: cannot save the network image %s, this system has no mmap\n", name);
+  return false;
+}
+
+bool
+net_image_save_state (const char *name, uint64_t key, const void *state, size_t size)
+{
+  (void) key;
+  (void) state;
+  (void) size;
+  fprintf (stdout, "SIMRUN: cannot save the checkpoint %s, this system has no mmap\n", name);
+  return false;
+}
+
+bool
+net_image_load (const char *name, uint64_t key)
+{
+  (void) key;
+  fprintf (stdout, "SIMRUN: cannot load the network image %s, this system has no mmap\n", name);
+  return false;
+}
+
+const void *
+net_image_state (size_t *size)
+{
+  *size = 0;
+  return 0;
+}
+
+#endif
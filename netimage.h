@@ -0,0 +1,63 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef NETIMAGE_H
+#define NETIMAGE_H
+
+/* Binary images of a built network (simrun --save-network and
+   --load-network).
+
+   An image holds the network arena as build_network left it (cells,
+   fibers, terminals, synapses and their q rings, and the CSR arrays with
+   --csr), with every pointer in it stored as an offset into the file,
+   and the per pop values build_network sets.  Loading maps the file and
+   turns the offsets back into pointers, so the arena pages come straight
+   from the page cache.
+
+   An image is keyed by a hash of the .sim and .snd files, simrun's
+   version and the options that change the build (--csr and --nonoise).
+   read_sim folds the inputs in with net_image_hash as it reads them, and
+   an image with a different key is refused.  The .sim and .snd files are
+   still read, since the pop parameters and the rest of S come from them.
+
+   A checkpoint (simrun --checkpoint) is an image taken during a run, with
+   the rest of the run's state in a block of its own that simloop writes
+   and reads back with --resume.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t net_image_hash (const void *data, size_t size, uint64_t h);
+uint64_t net_image_key (uint64_t h);
+bool net_image_save (const char *name, uint64_t key);
+bool net_image_load (const char *name, uint64_t key);
+bool net_image_save_state (const char *name, uint64_t key, const void *state, size_t size);
+const void *net_image_state (size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
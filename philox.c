@@ -0,0 +1,85 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Batched Philox draws.  See philox.h. */
+
+#include "philox.h"
+
+#define LANES 8
+
+// the counter for draw d is {d / 4, step, pop, stream}, the key {seed, PHILOX_KEY}
+double
+philox_ran (uint32_t seed, int stream, int pop, int step, uint32_t draw)
+{
+  Philox4 r = philox4x32 (draw >> 2, step, pop, stream, seed, PHILOX_KEY);
+  return philox_uniform (r.v[draw & 3]);
+}
+
+/* Draws first .. first+count-1 into out.  The middle of the range is done
+   LANES calls at a time with the rounds written across the lanes, which
+   the compiler turns into vector multiplies; the ends go one call at a
+   time.
+*/
+void
+philox_fill (uint32_t seed, int stream, int pop, int step, uint32_t first, int count, double *out)
+{
+  uint32_t d = first, end = first + count;
+
+  while (d < end && (d & 3))
+    *out++ = philox_ran (seed, stream, pop, step, d++);
+
+  while (end - d >= 4 * LANES)
+  {
+    uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+    uint32_t k0 = seed, k1 = PHILOX_KEY;
+    int l, round;
+
+    for (l = 0; l < LANES; l++)
+    {
+      c0[l] = (d >> 2) + l;
+      c1[l] = step;
+      c2[l] = pop;
+      c3[l] = stream;
+    }
+    for (round = 0; round < 10; round++)
+    {
+      for (l = 0; l < LANES; l++)
+      {
+        uint64_t p0 = (uint64_t) 0xD2511F53 * c0[l];
+        uint64_t p1 = (uint64_t) 0xCD9E8D57 * c2[l];
+        c0[l] = (uint32_t) (p1 >> 32) ^ c1[l] ^ k0;
+        c2[l] = (uint32_t) (p0 >> 32) ^ c3[l] ^ k1;
+        c1[l] = (uint32_t) p1;
+        c3[l] = (uint32_t) p0;
+      }
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    for (l = 0; l < LANES; l++)
+    {
+      *out++ = philox_uniform (c0[l]);
+      *out++ = philox_uniform (c1[l]);
+      *out++ = philox_uniform (c2[l]);
+      *out++ = philox_uniform (c3[l]);
+    }
+    d += 4 * LANES;
+  }
+
+  while (d < end)
+    *out++ = philox_ran (seed, stream, pop, step, d++);
+}
@@ -0,0 +1,102 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <stdint.h>
+
+/* Counter-based random numbers, Philox4x32-10 (Salmon et al., "Parallel
+   random numbers: as easy as 1, 2, 3", SC11).  Selected with
+   simrun --rng philox; the 69069 LCG in ran() stays the default so old
+   results can be reproduced.
+
+   Instead of stepping a seed, every draw is a pure function of where it
+   is used: the stream (what the number is for), the population, the
+   step and a draw number within them, usually the cell or fiber index.
+   The pop's seed is the key, noise_seed for cells and infsed for fibers,
+   so changing the seeds in the model changes the numbers as with the lcg.
+   Any cell's or fiber's numbers can be computed without the ones before
+   it, in any order, on any thread.  One Philox call gives four draws, so
+   draws d .. d+3 with d a multiple of 4 share a call.
+*/
+
+enum
+{
+  RNG_LCG,
+  RNG_PHILOX
+};
+
+enum
+{
+  PHILOX_CELL_NOISE,    // two per cell, draw 2*cn and 2*cn+1
+  PHILOX_PSR,           // one per PSR cell
+  PHILOX_FIBER,         // one per fiber
+  PHILOX_STIM,          // electric stim fuzz, one per pop
+  PHILOX_FIBER_SKIP     // --fiber-skip gaps, counted within the pop and step
+};
+
+#define PHILOX_KEY 314159      // second key word, the seed is the first
+
+typedef struct
+{
+  uint32_t v[4];
+} Philox4;
+
+static inline Philox4
+philox4x32 (uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1)
+{
+  Philox4 r;
+  int round;
+  for (round = 0; round < 10; round++)
+  {
+    uint64_t p0 = (uint64_t) 0xD2511F53 * c0;
+    uint64_t p1 = (uint64_t) 0xCD9E8D57 * c2;
+    c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+    c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t) p1;
+    c3 = (uint32_t) p0;
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+  r.v[0] = c0;
+  r.v[1] = c1;
+  r.v[2] = c2;
+  r.v[3] = c3;
+  return r;
+}
+
+// Same scale as ran(): 0.0 <= x < 1.0
+static inline double
+philox_uniform (uint32_t x)
+{
+  return x / 4294967296.0;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+double philox_ran (uint32_t seed, int stream, int pop, int step, uint32_t draw);
+void philox_fill (uint32_t seed, int stream, int pop, int step, uint32_t first, int count, double *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,8 @@ This file is part of the USF Neural Simulator suite.
 #include "lung.h"
 #include "c_globals.h"
 #include "sample_cells.h"
+#include "netimage.h"
+#include "adjexport.h"
 
 #if defined WIN32
 #include <libloaderapi.h>
@@ -54,6 +56,22 @@ extern int snd_size;
 extern int condi_flag;
 extern char inPath[];
 extern char outPath[];
+extern char *save_network_name;
+extern char *load_network_name;
+extern char *checkpoint_name;
+extern char *resume_name;
+
+// hash of the .sim and .snd files, for --save-network and --load-network,
+// and the image key made from it, which simloop's checkpoints use too
+static uint64_t input_hash;
+static bool first_read = true;
+uint64_t input_key;
+
+static bool
+want_input_hash (void)
+{
+  return first_read && (save_network_name || load_network_name || checkpoint_name || resume_name);
+}
 
 struct StructInfo *(*struct_info_fn) (const char *str, unsigned int len);
 struct StructMembers *(*struct_members_fn) (const char *str, unsigned int len);
@@ -350,7 +368,7 @@ quiet_model ()
 
 void read_snd()
 {
-  FILE *f = NULL;
+  LoadBuf b;
   memset (D.inode, 0, sizeof D.inode);
   struct_info_fn = inode_struct_info;
   struct_members_fn = inode_struct_members;
@@ -370,8 +388,7 @@ void read_snd()
           free(fname);
           exit(1);
        }
-       f = fopen(fname,"r");
-       if (!f)
+       if (!load_buf_open(&b,fname))
        {
           printf("Cannot open model paramter file %s, exiting program. . .\n", fname);
           free(fname);
@@ -382,8 +399,7 @@ void read_snd()
     }
     else
     {
-       f = fopen(S.snd_file_name,"r");
-       if (!f)
+       if (!load_buf_open(&b,S.snd_file_name))
        {
           printf("Cannot open model paramter file %s, exiting program. . .\n", S.snd_file_name);
           exit(1);
@@ -391,31 +407,17 @@ void read_snd()
     }
   }
   else
+    load_buf_mem(&b,snd_ptr,snd_size);
+  if (want_input_hash ())
+    input_hash = net_image_hash (b.base, b.size, input_hash);
+  if (load_buf_read_version(&b)) 
   {
-#if defined __linux__
-    f = fmemopen(snd_ptr,snd_size,"r");
-#else
-    char namebuff[MAX_PATH];
-    unsigned int randno;
-    HANDLE hnd1, hnd2;
-
-    rand_s(&randno);
-    snprintf(&namebuff,sizeof(namebuff),"sndrun%x.tmp",randno);
-    hnd1 = CreateFile(namebuff, GENERIC_READ | GENERIC_WRITE, 0, NULL, 
-      CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
-    hnd2 = _open_osfhandle((intptr_t)hnd1,_O_RDONLY);
-    f = _fdopen(hnd2,"r+");
-    fwrite(snd_ptr,1, snd_size, f);
-    rewind(f);
-#endif
-  }
-  if (load_struct_read_version(f)) 
-  {
-    load_struct (f, "inode_global", &D, 1);
-    fclose (f);
+    load_struct_buf (&b, "inode_global", &D, 1);
+    load_buf_close (&b);
   }
   else // too old
   {
+     load_buf_close (&b);
      return;
   }
 
@@ -436,14 +438,16 @@ void read_snd()
   }
 }
 
+// Read the .sim and .snd files into S, without building the network.
 // If we are using the direct connect, the sim file has already been
 // obtained from simbuild. Otherwise, read from file.
-int read_sim()
+void load_sim()
 {
+  LoadBuf b;
+
   if (sim_ptr == 0)
   {
-    S.ifile = fopen(sim_fname,"r");
-    if (!S.ifile)
+    if (!load_buf_open(&b,sim_fname))
     {
        printf("Cannot open simulator parameter file %s, exiting program. . .\n",sim_fname);
        exit(1);
@@ -451,30 +455,18 @@ int read_sim()
   }
   else
   {
-#if defined __linux__
     fprintf(stdout,"Using direct connect image\n");
     fflush(stdout);
-    S.ifile = fmemopen(sim_ptr,sim_size,"r");
-#else
-    char namebuff[MAX_PATH];
-    unsigned int randno;
-    HANDLE hnd1, hnd2;
-
-    rand_s(&randno);
-    snprintf(&namebuff,sizeof(namebuff),"simrun%x.tmp",randno);
-    hnd1 = CreateFile(namebuff, GENERIC_READ | GENERIC_WRITE, 0, NULL, 
-      CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
-    hnd2 = _open_osfhandle((intptr_t)hnd1,_O_RDONLY);
-    S.ifile = _fdopen(hnd2,"r+");
-    fwrite(sim_ptr,1, sim_size, S.ifile);
-    rewind(S.ifile);
-#endif
+    load_buf_mem(&b,sim_ptr,sim_size);
   }
 
+  if (want_input_hash ())
+    input_hash = net_image_hash (b.base, b.size, 0);
   struct_info_fn = simulator_struct_info;
   struct_members_fn = simulator_struct_members;
-  if (load_struct_read_version (S.ifile)) {
-    load_struct (S.ifile, "simulator_global", &S, 1);
+  if (load_buf_read_version (&b)) {
+    load_struct_buf (&b, "simulator_global", &S, 1);
+    load_buf_close (&b);
     lmmfr = S.lmmfr;
   }
   else {
@@ -497,20 +489,50 @@ int read_sim()
     exit (0);
   }
 
-  fprintf(stdout,"SIMRUN: Building network. . .\n");
   if (S.nonoise)
     quiet_model ();
-  build_network ();
-  find_sample_cells ();
-  if (condi_flag) 
-    condi();
-  fprintf(stdout,"network built, running sim\n");
   if (sim_ptr)
   {
      free(sim_ptr);
      sim_ptr = 0;
      sim_size = 0;
   }
+}
 
+// Build the network S describes, or load it from an image.
+void build_sim()
+{
+  // only the first network comes from an image, not a mid-run update
+  if (first_read)
+    input_key = net_image_key (input_hash);
+  if (first_read && resume_name)
+  {
+    if (!net_image_load (resume_name, input_key))
+    {
+      fprintf(stdout,"SIMRUN: cannot resume from %s, exiting program. . .\n", resume_name);
+      exit(1);
+    }
+  }
+  else if (!(first_read && load_network_name
+             && net_image_load (load_network_name, input_key)))
+  {
+    fprintf(stdout,"SIMRUN: Building network. . .\n");
+    build_network ();
+    if (first_read && save_network_name)
+      net_image_save (save_network_name, input_key);
+  }
+  if (first_read && adjacency_name)
+    adj_export (adjacency_name, adjacency_format);
+  first_read = false;
+  find_sample_cells ();
+  if (condi_flag) 
+    condi();
+  fprintf(stdout,"network built, running sim\n");
+}
+
+int read_sim()
+{
+  load_sim();
+  build_sim();
   return 0;
 }
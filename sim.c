@@ -60,8 +60,11 @@ This file is part of the USF Neural Simulator suite.
 #include <libgen.h>
 #include "simulator.h"
 #include "simrun_wrap.h"
+#include "philox.h"
 #include "simrun_wrap.h"
 #include "inode.h"
+#include "sweep.h"
+#include "adjexport.h"
 
 extern int have_cmd_socket();
 extern int have_data_socket();
@@ -76,6 +79,8 @@ int write_analog;
 int write_smr;
 int write_smr_wave;
 int noWaveFiles = 0;
+int text_waves = 0;
+int text_socket = 0;
 int isedt = false;
 char bdt_fmt[] = "%5d%8d";
 char edt_fmt[] = "%5d%10d";
@@ -96,6 +101,17 @@ char inPath[2048];
 char outPath[2048];
 bool haveAff = false;
 int condi_flag = 0;
+int num_threads = 1;
+int lung_thread_flag = 0;
+int csr_flag = 0;
+char *save_network_name;
+char *load_network_name;
+char *checkpoint_name;
+char *resume_name;
+int checkpoint_steps = 100000;
+double checkpoint_secs;
+int rng_type = RNG_LCG;
+int fiber_skip_flag = 0;
 int haveLearn = 0;
 int learnCPop[MAX_INODES];
 int numCPop;
@@ -184,6 +200,18 @@ static double get_dbl (char *prompt, double min, double max)
   return val;
 }
 
+// The two header lines of a bdt/edt file. A run resumed from a checkpoint
+// goes on with the file it was writing, which has them already.
+static void bdt_header (int code, int time)
+{
+  if (resume_name)
+    return;
+  fprintf (S.ofile, fmt, code, time);
+  fprintf (S.ofile, "%c",0x0a);
+  fprintf (S.ofile, fmt, code, time);
+  fprintf (S.ofile, "%c",0x0a);
+}
+
 int sigterm;
 
 static void sigterm_handler (int signum)
@@ -685,7 +713,7 @@ SPIKETIMES:
       read = getline (&ofile_name, &ofname_len, stdin);
       delete_newline (ofile_name, &read);
     } while ((nograph (ofile_name, read)
-         || (S.ofile = fopen (ofile_name, "wb")) == 0)
+         || (S.ofile = fopen (ofile_name, resume_name ? "r+b" : "wb")) == 0)
         && printf ("\n       ***** ERROR OPENING OUTPUT FILE, FILE EXISTS *****\n")
         && (isatty (0) || DIE)
         );
@@ -702,19 +730,13 @@ SPIKETIMES:
       {
          fmt = edt_fmt;
          dt_step = 0.1;
-         fprintf (S.ofile, fmt, 33, 3333333);
-         fprintf (S.ofile, "%c",0x0a);
-         fprintf (S.ofile, fmt, 33, 3333333);
-         fprintf (S.ofile, "%c",0x0a);
+         bdt_header (33, 3333333);
       }
       else
       {
          fmt = bdt_fmt;
          dt_step = 0.5;
-         fprintf (S.ofile, fmt, 11, 1111111);
-         fprintf (S.ofile, "%c",0x0a);
-         fprintf (S.ofile, fmt, 11, 1111111);
-         fprintf (S.ofile, "%c",0x0a);
+         bdt_header (11, 1111111);
       }
     }
     printf ("  ENTER I.D. CODES OF CELLS AND FIBERS WHOSE SPIKE TIMES WILL BE INCLUDED\n"
@@ -884,24 +906,18 @@ SPIKETIMES:
        if (StrStrIA(ofile_name,".edt"))
 #endif
         isedt=true;
-      S.ofile = fopen (outFname, "wb");
+      S.ofile = fopen (outFname, resume_name ? "r+b" : "wb");
       if (isedt)
       {
          fmt = edt_fmt;
          dt_step = 0.1;
-         fprintf (S.ofile, fmt, 33, 3333333);
-         fprintf (S.ofile, "%c",0x0a);
-         fprintf (S.ofile, fmt, 33, 3333333);
-         fprintf (S.ofile, "%c",0x0a);
+         bdt_header (33, 3333333);
       }
       else
       {
          fmt = bdt_fmt;
          dt_step = 0.5;
-         fprintf (S.ofile, fmt, 11, 1111111);
-         fprintf (S.ofile, "%c",0x0a);
-         fprintf (S.ofile, fmt, 11, 1111111);
-         fprintf (S.ofile, "%c",0x0a);
+         bdt_header (11, 1111111);
       }
     }
 
@@ -942,7 +958,7 @@ SPIKETIMES:
 
 void usage(char* name)
 {
-   printf("usage %s [--script [optional path]script_name] [--condi] [--file | --socket --port port number] [--bdt] [--smr] [--wave] [--output optional output path]\n"
+   printf("usage %s [--script [optional path]script_name] [--condi] [--file | --socket --port port number] [--bdt] [--smr] [--wave] [--output optional output path] [--threads N] [--lung-thread] [--csr] [--rng lcg|philox] [--fiber-skip] [--text-waves] [--text-socket] [--sweep file.csv [--sweep-jobs N]] [--save-network file] [--load-network file] [--adjacency file [--adjacency-format mtx|bin]] [--checkpoint file [--checkpoint-every N|Ns]] [--resume file]\n"
          "where:\n"
          "--condi create condi csv files\n"
          "--file reads .sim and .snd files\n"
@@ -951,6 +967,39 @@ void usage(char* name)
          "--smr creates a Spike2 file that contains bdt information\n"
          "--wave creates a Spike2 file that contains waveforminformation\n"
          "--output saves the files in the output path\n"
+         "--threads N splits the cell update across N threads\n"
+         "--lung-thread integrates the lung model on its own thread, alongside\n"
+         "      the cell update\n"
+         "--csr builds the connectivity in pooled CSR arrays\n"
+         "--rng philox draws cell noise and fiber firing from a counter-based\n"
+         "      generator instead of the default lcg\n"
+         "--fiber-skip draws only for the fibers that fire, by skipping over\n"
+         "      the ones that do not.  Much faster for fibers that seldom fire,\n"
+         "      but the spikes differ from a default run with the same seeds\n"
+         "--text-waves writes a wave.NN.NNNN text file every 100 steps instead\n"
+         "      of appending to the binary wave.NN.bin file\n"
+         "--text-socket sends plot data to simviewer in the old text blocks\n"
+         "      instead of binary frames\n"
+         "--sweep file.csv builds the network once and runs one simulation per\n"
+         "      line of file.csv, with the parameters named in its first line\n"
+         "      set to that line's values, output in sweep.NNNN directories\n"
+         "--sweep-jobs N runs N sweep simulations at a time, the default is\n"
+         "      one per CPU divided by --threads\n"
+         "--save-network file writes the built network to file\n"
+         "--load-network file uses the network in file instead of building it,\n"
+         "      if file was saved from the same .sim and .snd files and options\n"
+         "--adjacency file writes the connections of the built network, as\n"
+         "      file.N.mtx Matrix Market files, one per synapse type N\n"
+         "--adjacency-format bin writes them to file as binary CSR arrays\n"
+         "      instead, see adjexport.h\n"
+         "--checkpoint file saves everything the run needs to go on to file\n"
+         "      every so often, replacing the last one\n"
+         "--checkpoint-every N saves a checkpoint every N steps, or with Ns\n"
+         "      every N seconds, the default is every 100000 steps.  Either is\n"
+         "      rounded up to the next 100 step wave block\n"
+         "--resume file goes on with a run from a checkpoint it saved, given the\n"
+         "      same script, .sim and .snd files and options.  The bdt/edt and\n"
+         "      wave files are cut back to the checkpoint and continued\n"
          ,name);
 
 }
@@ -969,6 +1018,22 @@ const static struct option long_options[] =
    {"bdt",no_argument,&write_bdt,1},
    {"smr",no_argument,&write_smr,1},
    {"wave",no_argument,&write_smr_wave,1},
+   {"threads",required_argument,0,'t'},
+   {"lung-thread",no_argument,&lung_thread_flag,1},
+   {"csr",no_argument,&csr_flag,1},
+   {"rng",required_argument,0,'g'},
+   {"fiber-skip",no_argument,&fiber_skip_flag,1},
+   {"text-waves",no_argument,&text_waves,1},
+   {"text-socket",no_argument,&text_socket,1},
+   {"sweep",required_argument,0,'w'},
+   {"sweep-jobs",required_argument,0,'j'},
+   {"save-network",required_argument,0,'S'},
+   {"load-network",required_argument,0,'N'},
+   {"adjacency",required_argument,0,'A'},
+   {"adjacency-format",required_argument,0,'F'},
+   {"checkpoint",required_argument,0,'C'},
+   {"checkpoint-every",required_argument,0,'E'},
+   {"resume",required_argument,0,'R'},
    {"help",no_argument,0,'h'},
    {"h",no_argument,0,'h'},
    {0,0,0,0}
@@ -979,6 +1044,7 @@ int main (int argc, char **argv)
   int c;
   bool have_script=false;
   char scriptname[1024]={0};
+  char *sweep_csv = 0;
   char *tmp_path;
   FILE *script;
 
@@ -1031,6 +1097,82 @@ int main (int argc, char **argv)
              fprintf(stdout,"SIMRUN: Got host name %s\n",host_name);
            }
            break;
+        case 't':
+           if (optarg)
+           {
+              sscanf(optarg, "%d",&num_threads);
+              if (num_threads < 1)
+                 num_threads = 1;
+              fprintf(stdout,"SIMRUN: Using %d threads\n",num_threads);
+           }
+           break;
+        case 'g':
+           if (optarg && strcmp(optarg,"philox") == 0)
+              rng_type = RNG_PHILOX;
+           else if (optarg && strcmp(optarg,"lcg") == 0)
+              rng_type = RNG_LCG;
+           else
+           {
+              fprintf(stdout,"SIMRUN: Unknown random number generator %s\n",optarg ? optarg : "");
+              usage(argv[0]);
+              exit(1);
+           }
+           fprintf(stdout,"SIMRUN: Using the %s random number generator\n",
+                   rng_type == RNG_PHILOX ? "philox" : "lcg");
+           break;
+        case 'w':
+           sweep_csv = optarg;
+           break;
+        case 'j':
+           if (optarg)
+           {
+              sscanf(optarg, "%d",&sweep_jobs);
+              if (sweep_jobs < 1)
+                 sweep_jobs = 1;
+           }
+           break;
+        case 'S':
+           save_network_name = optarg;
+           break;
+        case 'N':
+           load_network_name = optarg;
+           break;
+        case 'A':
+           adjacency_name = optarg;
+           break;
+        case 'F':
+           if (optarg && strcmp(optarg,"mtx") == 0)
+              adjacency_format = ADJ_MTX;
+           else if (optarg && strcmp(optarg,"bin") == 0)
+              adjacency_format = ADJ_BIN;
+           else
+           {
+              fprintf(stdout,"SIMRUN: Unknown adjacency format %s\n",optarg ? optarg : "");
+              usage(argv[0]);
+              exit(1);
+           }
+           break;
+        case 'C':
+           checkpoint_name = optarg;
+           break;
+        case 'E':
+           {
+              double every = 0;
+              char unit = 0;
+              if (!optarg || sscanf(optarg, "%lf%c", &every, &unit) < 1
+                  || every <= 0 || (unit && unit != 's'))
+              {
+                 fprintf(stdout,"SIMRUN: Bad checkpoint interval %s\n",optarg ? optarg : "");
+                 usage(argv[0]);
+                 exit(1);
+              }
+              checkpoint_steps = unit ? 0 : ceil(every);
+              checkpoint_secs = unit ? every : 0;
+           }
+           break;
+        case 'R':
+           resume_name = optarg;
+           break;
         case 'h':
            usage(argv[0]);
            exit(1);
@@ -1044,6 +1186,17 @@ int main (int argc, char **argv)
   if (strlen(inPath) > 0 && strlen(outPath) == 0)
      strcpy(outPath,inPath);
 
+  if (sweep_csv && simbuild_port != 0)
+  {
+     fprintf(stdout,"SIMRUN: --sweep cannot be used with --port\n");
+     exit(1);
+  }
+  if ((checkpoint_name || resume_name) && (simbuild_port != 0 || sweep_csv))
+  {
+     fprintf(stdout,"SIMRUN: --checkpoint and --resume cannot be used with --port or --sweep\n");
+     exit(1);
+  }
+
 #if defined WIN32
   // Windows does not have standard locations that are always on the PATH.
   // Many users have no idea how to modify their PATH. Find out dir we 
@@ -1142,7 +1295,11 @@ int main (int argc, char **argv)
   }
   else
      interactive();
+  if (sweep_csv)
+     sweep_run(sweep_csv); // only returns in the worker for one variant
   signal (SIGTERM, sigterm_handler);
+  if (resume_name && (S.save_smr == 'y' || S.save_smr_wave == 'y'))
+     fprintf(stdout,"SIMRUN: Spike2 files cannot be continued, those of a resumed run start at the checkpoint\n");
   if (S.save_smr == 'y')
   {
      write_smr = true;
@@ -44,6 +44,15 @@ This file is part of the USF Neural Simulator suite.
 #include "wavemarkers.h"
 #include "simrun_wrap.h"
 #include "common_def.h"
+#include "cellstate.h"
+#include "threadpool.h"
+#include "csr.h"
+#include "philox.h"
+#include "wavefile.h"
+#include "wavesend.h"
+#include "bdtout.h"
+#include "lungthread.h"
+#include "netimage.h"
 
 #ifdef __linux__
 extern int sock_fd;
@@ -62,8 +71,9 @@ extern int write_analog;
 extern int write_smr;
 extern int write_smr_wave;
 extern int noWaveFiles;
+extern int text_waves;
+extern int text_socket;
 extern int isedt;
-extern char *fmt;
 extern double dt_step;
 extern char simmsg[];
 extern char inPath[];
@@ -77,6 +87,10 @@ extern int learnCPop[MAX_INODES];
 extern int numCPop;
 extern int learnFPop[MAX_INODES];
 extern int numFPop;
+extern int num_threads;
+extern int lung_thread_flag;
+extern int rng_type;
+extern int fiber_skip_flag;
 
 /*
 ; exp(-.5/2)
@@ -230,11 +244,81 @@ void waitForDone()
   fflush(stdout);
 }
 
-// send via network or write results to the next wave file
+// binary wave file or simviewer stream, see wavefile.h and wavesend.h
+static WaveFile *wave_out;
+static WavePlot *wave_plot;
+static float *wave_vals;
+static unsigned char *wave_spikes;
+
+static void
+wave_out_start (void)
+{
+  static int plot_size;
+  static char *name;
+  int n;
+
+  if (!wave_out && have_data_socket())
+  {
+    wavesend_start ();
+    (wave_out = wave_create_sink (wavesend_chunk, NULL, S.spawn_number, S.step)) || DIE;
+  }
+  else if (!wave_out)
+  {
+    if (asprintf (&name, "%swave.%02d.bin", outPath, S.spawn_number) == -1) exit (1);
+    (wave_out = wave_create (name, S.spawn_number, S.step)) || DIE;
+    free (name);
+  }
+  if (plot_size < S.plot_count)
+  {
+    plot_size = S.plot_count;
+    TREALLOC (wave_plot, plot_size);
+    TREALLOC (wave_vals, plot_size * 100);
+    TREALLOC (wave_spikes, plot_size * 100);
+  }
+  for (n = 0; n < S.plot_count; n++)
+  {
+    wave_plot[n].pop = S.plot[n].pop;
+    wave_plot[n].cell = S.plot[n].cell;
+    wave_plot[n].var = S.plot[n].var;
+    wave_plot[n].type = S.plot[n].type;
+    wave_plot[n].lbl = S.plot[n].lbl;
+  }
+  wave_write_plots (wave_out, S.plot_count, wave_plot) == 0 || DIE;
+}
+
+  // one column per plot, for the plots the block started with
+static void
+wave_out_sample (int rec, int nrecs)
+{
+  int count = S.plot_count < wave_out->plot_count ? S.plot_count : wave_out->plot_count;
+
+  for (int n = 0; n < count; n++)
+  {
+    wave_vals[n * nrecs + rec] = S.plot[n].val;
+    wave_spikes[n * nrecs + rec] = S.plot[n].spike != 0;
+  }
+}
+
+  // finish the file, or send what is left of the stream
+static void
+wave_out_close (void)
+{
+  if (wave_out)
+  {
+    wave_close (wave_out) == 0 || DIE;
+    wave_out = 0;
+  }
+  wavesend_stop ();
+}
+
+// where simoutsned is in the wave blocks, out here for the checkpoints
+static int recctr, flctr, blkctr, nrecs;
+
+// send via network or write results to the wave file(s)
 static void
 simoutsned (void)
 {
-  static int recctr, flctr, nrecs;
+  static bool binary;
   static FILE *wfile = 0;
   int n;
   static char *wfile_name=0;
@@ -248,29 +332,41 @@ simoutsned (void)
   if (recctr == 0)  // new wave block set up
   {
     nrecs = S.step_count - S.stepnum >= 100 ? 100 : S.step_count - S.stepnum;
+    binary = have_data_socket() ? !text_socket : !noWaveFiles && !text_waves;
+    if (binary)
+    {
+      wave_out_start ();
+      wave_out_sample (0, nrecs);
+    }
  
     if (have_data_socket())
     {
-      sprintf(line,"%c%d\n%d\n", MSG_START, S.spawn_number,flctr);
-      memcpy(buffptr,line,strlen(line)); // don't want null
-      buffptr += strlen(line);
-      sprintf (line, "%12d %f\n", nrecs, S.step);
-      memcpy(buffptr,line,strlen(line));
-      buffptr += strlen(line);
-      sprintf (line, "%12d\n", S.plot_count);
-      memcpy(buffptr,line,strlen(line));
-        buffptr += strlen(line);
-      for (n = 0; n < S.plot_count; n++)
+      if (!binary)
       {
-        sprintf(line, "%3d %3d %3d %d %s\n", S.plot[n].pop, S.plot[n].cell, S.plot[n].var, S.plot[n].type, S.plot[n].lbl);
+        sprintf(line,"%c%d\n%d\n", MSG_START, S.spawn_number,flctr);
+        memcpy(buffptr,line,strlen(line)); // don't want null
+        buffptr += strlen(line);
+        sprintf (line, "%12d %f\n", nrecs, S.step);
         memcpy(buffptr,line,strlen(line));
         buffptr += strlen(line);
+        sprintf (line, "%12d\n", S.plot_count);
+        memcpy(buffptr,line,strlen(line));
+          buffptr += strlen(line);
+        for (n = 0; n < S.plot_count; n++)
+        {
+          sprintf(line, "%3d %3d %3d %d %s\n", S.plot[n].pop, S.plot[n].cell, S.plot[n].var, S.plot[n].type, S.plot[n].lbl);
+          memcpy(buffptr,line,strlen(line));
+          buffptr += strlen(line);
+        }
       }
       for (n = 0; n < S.plot_count; n++)
       {
-        sprintf (line, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
-        memcpy(buffptr,line,strlen(line));
-        buffptr += strlen(line);
+        if (!binary)
+        {
+          sprintf (line, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
+          memcpy(buffptr,line,strlen(line));
+          buffptr += strlen(line);
+        }
         if (write_smr_wave)
         {
            if (S.plot[n].var != STD_FIBER && S.plot[n].var != AFFERENT_EVENT && S.plot[n].var != AFFERENT_BOTH)
@@ -285,11 +381,11 @@ simoutsned (void)
       
          // don't let simviewer see file until it is complete
          // write header and first block of wave values
-         if (asprintf (&wfile_name, "%swave.%02d.%04d", outPath, S.spawn_number, flctr) == -1) exit (1);
-         if (asprintf (&wfile_name_tmp, "%swave.%02d.%04d.tmp", outPath, S.spawn_number, flctr) == -1) exit (1);
+         if (text_waves && asprintf (&wfile_name, "%swave.%02d.%04d", outPath, S.spawn_number, flctr) == -1) exit (1);
+         if (text_waves && asprintf (&wfile_name_tmp, "%swave.%02d.%04d.tmp", outPath, S.spawn_number, flctr) == -1) exit (1);
          
          // JAH: if simrun is run with a script it no longer produces the wave* files
-         if (!noWaveFiles) 
+         if (!noWaveFiles && text_waves)
          {
             (wfile = fopen (wfile_name_tmp, "w")) || DIE;
             fprintf (wfile, "%12d %f\n", nrecs, S.step);
@@ -300,7 +396,7 @@ simoutsned (void)
          }
          for (n = 0; n < S.plot_count; n++)
          {
-            if (!noWaveFiles) 
+            if (!noWaveFiles && text_waves)
             {
                  fprintf (wfile, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
             }
@@ -322,17 +418,22 @@ simoutsned (void)
     return;
   }
      // set up done if here, accumlate results
+  if (binary)
+    wave_out_sample (recctr, nrecs);
   for (n = 0; n < S.plot_count; n++)  
   {
-    sprintf (line, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
     if (have_data_socket())
     {
-      memcpy(buffptr,line,strlen(line));
-      buffptr += strlen(line);
+      if (!binary)
+      {
+        sprintf (line, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
+        memcpy(buffptr,line,strlen(line));
+        buffptr += strlen(line);
+      }
     }
     else
     {
-     if (!noWaveFiles) {
+     if (!noWaveFiles && text_waves) {
         fprintf (wfile, "%12.8f %d\n", S.plot[n].val, S.plot[n].spike);
      }
     }
@@ -346,7 +447,18 @@ simoutsned (void)
   }
   if (++recctr == nrecs) 
   {
-    if (use_socket)
+    if (binary)
+    {
+       wave_write_block (wave_out, blkctr, nrecs, wave_vals, wave_spikes) == 0 || DIE;
+       if (wavesend_lost ())
+       {
+          fprintf(stdout,"SIMRUN: Connection to simviewer lost.\n");
+          fflush(stdout);
+          wave_out_close ();
+          destroy_view_socket();
+       }
+    }
+    else if (use_socket)
     {
        sprintf(line,"%c", MSG_END);
        memcpy(buffptr,line,strlen(line));
@@ -373,6 +485,7 @@ simoutsned (void)
        }
     }
     recctr = 0;
+    blkctr++;
     if (++flctr == 10000)  // wrap 9999+1 back to 0.
       flctr = 0;
   }
@@ -431,13 +544,31 @@ mup_error (muParserHandle_t hParser)
   error (1, 0, "%s", msg);
 }
 
-static double
-spikes_per_s_per_cell (int pn)
+// Spikes this step per source pop, cell pops first, then fiber pops.
+// integrate_all and the fiber pass fill it in, and everything that wants a
+// pop's rate reads it from here rather than adding up its cells.
+static int *pop_fired;
+static CellPop *pop_fired_net;  // the S.net.cellpop the cell counts are for
+
+static int
+cellpop_fired (int pn)
 {
   CellPop *p = S.net.cellpop + pn;
   int spike_count = 0;
+
+  if (pop_fired_net == S.net.cellpop)
+    return pop_fired[pn];
+    // no step done on this network yet
   for (int cn = 0; cn < p->cell_count; cn++)
-    spike_count += p->cell[cn].spike;
+    spike_count += CELLSTATE (p)->spike[cn];
+  return spike_count;
+}
+
+static double
+spikes_per_s_per_cell (int pn)
+{
+  CellPop *p = S.net.cellpop + pn;
+  int spike_count = cellpop_fired (pn);
   if (0) {
     static FILE *f;
     if (f == NULL) f = fopen ("phrenic_spike_counts", "w");
@@ -579,8 +710,7 @@ get_GE0 (CellPop *p)
 {
   if (!p->ic_expression)
     return p->GE0;
-  if (!p->ic_evaluator)
-    assert ((p->ic_evaluator = (char *) xp_set (p->ic_expression)));
+    // compiled by build_network
 //  printf("volume %f\n", state.volume);
   return xp_eval ((Expr *)p->ic_evaluator, state.volume);
 }
@@ -685,587 +815,1591 @@ void chk_for_cmd()
   } while (pause);
 }
 
-static void decayLearnCells()
+// Learning history. When a sender fires into a learning synapse the spike
+// is pending until it ages out, and is usable by a reward once it is
+// within lrnWindow steps of arriving. reward_cell only needs how many
+// there are of each, so a spike is just two events on its target pop's
+// wheel of steps: the step it becomes usable and the step it goes away.
+// The age of a spike used to be counted down once for every terminal of a
+// learning pop that lands on the synapse, so it runs lrn_rate steps per
+// simulation step.
+enum {LRN_USABLE, LRN_GONE, LRN_GONE_USED};
+
+typedef struct
 {
-   CellPop *cp;
-   for (int pn = 0; pn < numCPop; ++pn)
-   {
-      cp = S.net.cellpop + learnCPop[pn];
-      Cell *c = cp->cell;
-      for (int cn = 0; cn < cp->cell_count; cn++, ++c) 
-      {
-           Target *target = c->target;
-           for (int tidx = 0; tidx < c->target_count; tidx++, ++target)
-           {
-              Syn *syn = target->syn;
-              if (S.net.syntype[syn->stidx].SYN_TYPE == SYN_LEARN)
-              {
-                 LEARN *lrn_ptr = syn->lrn;
-                 for (int slot = 0; slot < syn->lrn_size; ++slot,++lrn_ptr)
-                 {
-                    if (lrn_ptr->recv_pop != LRN_FREE)
-                    {
-                       if (lrn_ptr->ariv_time <= 1)  // remove
-                       {
-                          lrn_ptr->recv_pop = LRN_FREE;
-                          lrn_ptr->send_term = 0;
-                          lrn_ptr->recv_term = 0;
-                          lrn_ptr->ariv_time = 0;
-                       }
-                       else
-                          --lrn_ptr->ariv_time;
-                    }
-                 }
-              }
-           }
-       }
-    }
+  Syn *syn;
+  int what;
+} LrnEvent;
+
+typedef struct
+{
+  int count;
+  int size;
+  LrnEvent *ev;
+} LrnSlot;
+
+typedef struct
+{
+  int mask;           // slot count - 1
+  LrnSlot *slot;      // slot for step n is n & mask
+} LrnWheel;
+
+static LrnWheel *lrn_wheel;   // per target cell pop, no slots if no learning syns
+static int lrn_wheel_count;
+
+static inline void
+lrn_event (LrnWheel *w, int step, Syn *syn, int what)
+{
+  LrnSlot *sl = w->slot + (step & w->mask);
+  if (sl->count == sl->size)
+  {
+    sl->size = sl->size ? sl->size * 2 : 16;
+    TREALLOC (sl->ev, sl->size);
+  }
+  sl->ev[sl->count].syn = syn;
+  sl->ev[sl->count].what = what;
+  sl->count++;
 }
 
-// Sender has fired, add to target history
-static void updateLrnSyns(Target *target, Syn* syn, int sender)
+static void
+lrn_rate_targets (Target *target, int target_count)
 {
-   LEARN *lrn_ptr = syn->lrn;
-   bool found = false;
-   int slot, old_size, new_size;
+  int tidx;
+  for (tidx = 0; tidx < target_count; tidx++, ++target)
+    if (target->syn->syntype == SYN_LEARN)
+      target->syn->lrn_rate++;
+}
 
-   for (slot = 0; slot < syn->lrn_size; ++slot,++lrn_ptr)
-   {
-      if (lrn_ptr->recv_pop == LRN_FREE)
-      {
-         found = true;
-         break;
-      }
-   }
-   if (!found) // grow the array, init the new slots
-   {
-      old_size = syn->lrn_size;
-      new_size = old_size  + LRN_GROWBY;
-      syn->lrn_size = new_size;
-      lrn_ptr = realloc(target->syn->lrn,sizeof(LEARN) *new_size);
-      target->syn->lrn = lrn_ptr;
-      lrn_ptr += old_size; // skip to start of new slots
-      for (slot = old_size; slot < new_size; ++slot,++lrn_ptr)
+static void
+free_lrn_wheels (void)
+{
+  int pn, n;
+  for (pn = 0; pn < lrn_wheel_count; pn++)
+  {
+    if (lrn_wheel[pn].slot)
+      for (n = 0; n <= lrn_wheel[pn].mask; n++)
+        free (lrn_wheel[pn].slot[n].ev);
+    free (lrn_wheel[pn].slot);
+  }
+  free (lrn_wheel);
+  lrn_wheel = NULL;
+  lrn_wheel_count = 0;
+}
+
+// A spike can be around for at most q_count + lrnWindow steps, which sizes
+// each pop's wheel.
+static void
+build_lrn_wheels (void)
+{
+  int pn, cn, sidx, size;
+
+  free_lrn_wheels ();
+  if (!haveLearn)
+    return;
+  lrn_wheel_count = S.net.cellpop_count;
+  TCALLOC (lrn_wheel, lrn_wheel_count + 1);
+  for (pn = 0; pn < numCPop; ++pn)
+  {
+    CellPop *cp = S.net.cellpop + learnCPop[pn];
+    for (cn = 0; cn < cp->cell_count; cn++)
+      lrn_rate_targets (cp->cell[cn].target, cp->cell[cn].target_count);
+  }
+  for (pn = 0; pn < numFPop; ++pn)
+  {
+    FiberPop *fp = S.net.fiberpop + learnFPop[pn];
+    for (cn = 0; cn < fp->fiber_count; cn++)
+      lrn_rate_targets (fp->fiber[cn].target, fp->fiber[cn].target_count);
+  }
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    int span = 0;
+    for (cn = 0; cn < cp->cell_count; cn++)
+      for (sidx = 0; sidx < cp->cell[cn].syn_count; sidx++)
       {
-        lrn_ptr->recv_pop = LRN_FREE;
-        lrn_ptr->send_term = 0;
-        lrn_ptr->recv_term = 0;
-        lrn_ptr->ariv_time = 0;
+        Syn *syn = cp->cell[cn].syn + sidx;
+        if (syn->syntype == SYN_LEARN)
+          span = MAX (span, syn->q_count + MAX (syn->lrnWindow, 0) + 2);
       }
+    if (span == 0)
+      continue;
+    for (size = 16; size < span; size *= 2)
+      ;
+    lrn_wheel[pn].mask = size - 1;
+    TCALLOC (lrn_wheel[pn].slot, size);
+  }
+}
 
-      lrn_ptr = target->syn->lrn + old_size; // 1st new slot
-   }
-   lrn_ptr->send_term = sender;
-   lrn_ptr->recv_pop = syn->cpidx;
-   lrn_ptr->recv_term = syn->cidx;
+// Sender has fired, add to target history
+static void updateLrnSyns(Syn* syn, int delay, int sender)
+{
+   LrnWheel *w = lrn_wheel + syn->cpidx;
+   int rate = syn->lrn_rate > 0 ? syn->lrn_rate : 1;
    // the fortran program from the MacG book generated a random number
    // between 1 and the conductance time. We more or less have already
    // done with the target->delay calculation for each terminal.
-   lrn_ptr->ariv_time = target->delay + 1 + syn->lrnWindow; 
+   int ariv_time = delay + 1 + syn->lrnWindow;
+   int usable = S.stepnum + (delay + rate) / rate;
+   int gone = S.stepnum + MAX ((ariv_time + rate - 1) / rate, 1);
+
+   (void) sender;
+   gone - S.stepnum <= w->mask || DIE;
+   syn->lrn_pending++;
+   if (usable < gone)
+   {
+      lrn_event (w, usable, syn, LRN_USABLE);
+      lrn_event (w, gone, syn, LRN_GONE_USED);
+   }
+   else
+      lrn_event (w, gone, syn, LRN_GONE);
 }
 
-
-static void decayLearnFibers()
+// End of step: apply the events due at the start of the next one.
+static void decayLearn()
 {
-   FiberPop *p;
-   for (int pn = 0; pn < numFPop; ++pn)
+   int pn, n;
+   for (pn = 0; pn < lrn_wheel_count; pn++)
    {
-      p = S.net.fiberpop + learnFPop[pn];
-      Fiber *f = p->fiber;
-      for (int fn = 0; fn < p->fiber_count; ++fn, ++f) 
+      LrnWheel *w = lrn_wheel + pn;
+      LrnSlot *sl;
+      if (!w->slot)
+         continue;
+      sl = w->slot + ((S.stepnum + 1) & w->mask);
+      for (n = 0; n < sl->count; n++)
       {
-         Target *target = f->target;
-         for (int tidx = 0; tidx < f->target_count; tidx++, ++target)
+         Syn *syn = sl->ev[n].syn;
+         switch (sl->ev[n].what)
          {
-            Syn *syn = target->syn;
-            if (S.net.syntype[syn->stidx].SYN_TYPE == SYN_LEARN)
-            {
-               LEARN *lrn_ptr = syn->lrn;
-               for (int slot = 0; slot < syn->lrn_size; ++slot,++lrn_ptr)
-               {
-                  if (lrn_ptr->recv_pop != LRN_FREE)
-                  {
-                     if (lrn_ptr->ariv_time <= 1) 
-                     {
-                        lrn_ptr->recv_pop = LRN_FREE;
-                        lrn_ptr->send_term = 0;
-                        lrn_ptr->recv_term = 0;
-                        lrn_ptr->ariv_time = 0;
-                      }
-                      else
-                        --lrn_ptr->ariv_time;
-                    }
-                 }
-              }
-           }
-       }
-    }
+            case LRN_USABLE:
+               syn->lrn_active++;
+               break;
+            case LRN_GONE_USED:
+               syn->lrn_active--;
+               /* fall through */
+            case LRN_GONE:
+               syn->lrn_pending--;
+               break;
+         }
+      }
+      sl->count = 0;
+   }
 }
 
-/* This is the simulation calculation engine.
+/* A simulation step is done in passes:
+     integrate  - new Vm, Gk, Thr and spike for every cell, and a list of
+                  the cells that spiked
+     record     - bdt/smr output for the cells that spiked
+     fibers     - fiber firing and output, and a list of the fibers that fired
+     deliver    - the spike lists are turned into q array updates and
+                  learning rewards, one target population at a time
+     decay      - fold the current q slot into each synapse's G
+   Integrate and decay only touch a cell's own state and its own input
+   synapses, so they are split into chunks of cells that can be handed to
+   the thread pool. Delivery only writes into synapses of the target pop
+   it is working on, so target pops can be done in parallel too. Within a
+   target pop the sources are visited in the order the old single loop
+   fired them (cell pops in order, then fiber pops), so every q slot sees
+   its additions in the same order and the results do not change.
 */
-void simloop ()
+#define CELL_CHUNK 512
+
+typedef struct
 {
-  int nf;
-  double noise_decay = exp (-S.step / 1.5);
-  S.seed = 314159;
-  double ticks_in_sec = ceil(1000.0/S.step);
-  char msg[2048]={0};
-  bool lung_is_used = check_lung_used ();
-  bool doFibCalc, skipFib;
-  MotorPops m;
-  double signal;
-  if (Debug)
-    fprintf (stdout, "\n%s line %d, cellpop_count %d\n", __FILE__, __LINE__,
-             S.net.cellpop_count);
+  int pn;
+  int cn0;
+  int cn1;
+  int serial;       // with the lcg, PSR pops all draw from S.seed, integrate them in order
+  int fired_count;
+  int *fired;       // cells in [cn0,cn1) that spiked this step, ascending
+} CellChunk;
+
+// A run of terminals that every cell/fiber of a source pop has in one
+// target pop, at the same offset in each one's target array.
+typedef struct
+{
+  int tidx0;
+  int count;
+} TargetBlock;
 
-  if (lung_is_used) 
-  {
-    if (!S.phrenic_equation || S.phrenic_equation[0] == 0)
-      S.phrenic_equation = strdup ("P0/100");
-    if (!S.lumbar_equation || S.lumbar_equation[0] == 0)
-      S.lumbar_equation = strdup ("L0/20");
-    m = get_motor_pops ();
+// Everything one source pop sends to one target pop. Sources are numbered
+// cell pops first, then fiber pops after them.
+typedef struct
+{
+  int src;
+  int block_count;
+  TargetBlock *block;
+} Projection;
 
-    fprintf(stdout,"motor pops are: phrenic");
-    for (int i = 0; i < m.phrenic.count; i++)
-      if (m.phrenic.num[i] >= 0)
-        fprintf(stdout," %d", m.phrenic.num[i] + 1);
-    fprintf(stdout,", abdominal");
-    for (int i = 0; i < m.abdominal.count; i++)
-      if (m.abdominal.num[i] >= 0)
-        fprintf(stdout," %d", m.abdominal.num[i] + 1);
-    fprintf (stdout,", elm/ta %d, ilm/pca %d", m.ta.num[0] + 1, m.pca.num[0] + 1);
-#ifdef INTERCOSTALS
-    fprintf(stdout,", ext %d, int %d", m.ta.num[0] + 1, m.pca.num[0] + 1, m.inspic.num[0] + 1, m.expic.num[0] + 1);
-#endif
-    fprintf(stdout,"\n");
-    
-    state = lung ((Motor) {0,0,0,0}, S.step);
-  }
-  else 
-     fprintf(stdout,"Lung model is not used\n");
-  if (Debug)
+typedef struct
+{
+  int proj_count;
+  Projection *proj;   // ascending src
+} Inputs;
+
+  /* --fiber-skip: the fibers of a pop over the steps to come are taken as
+     one sequence, next is the place in it of the next one to fire,
+     counting from fiber 0 of this step. prob is the probability it was
+     drawn with, a new one starts over. */
+typedef struct
+{
+  int64_t next;
+  double prob;
+  double log_q;     // log (1 - prob)
+} FibSkip;
+
+static CellChunk *chunk;
+static int chunk_count;
+static int *pop_chunk0;       // first chunk of each cell pop
+static int *par_chunk;        // chunks the pool may integrate in any order
+static int par_chunk_count;
+static int **fib_fired;       // fibers that fired this step, per fiber pop
+static int *fib_fired_count;
+static double *fib_ran;       // philox draws for one fiber pop
+static FibSkip *fib_skip;     // --fiber-skip state per fiber pop
+static Inputs *inputs;        // per target cell pop
+static int table_cellpops;    // pop counts the tables were built with
+static int table_fiberpops;
+static CellPop *table_net;    // the S.net.cellpop the tables were built for
+static double *pop_GE0;       // injected current per pop for this step
+static double noise_decay;
+
+enum {PH_LUNG, PH_INTEGRATE, PH_RECORD, PH_FIBERS, PH_DELIVER, PH_DECAY,
+      PH_OUTPUT, PH_OTHER, PH_COUNT};
+static const char *phase_name[PH_COUNT] = {"lung", "integrate", "record", "fibers",
+                                           "deliver", "decay", "plot/output", "other"};
+static double phase_time[PH_COUNT];
+static long spike_total;       // cells and fibers that fired
+
+static double
+now_sec (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Charge the time since the last call to a phase.
+static inline void
+phase_done (int phase, double *mark)
+{
+  double t = now_sec ();
+  phase_time[phase] += t - *mark;
+  *mark = t;
+}
+
+static void
+add_projection (Inputs *in, int src, TargetPop *targetpop, int targetpop_count, int tcpidx)
+{
+  Projection *pr;
+  int tpidx, tidx0 = 0;
+
+  TREALLOC (in->proj, in->proj_count + 1);
+  pr = in->proj + in->proj_count++;
+  pr->src = src;
+  pr->block_count = 0;
+  TMALLOC (pr->block, targetpop_count + 1);
+  for (tpidx = 0; tpidx < targetpop_count; tpidx++)
   {
-     fprintf (stdout, "\n%s line %d, cellpop_count %d\n", __FILE__, __LINE__,
-               S.net.cellpop_count);
-     fprintf (stdout, "\n%s line %d\n", __FILE__, __LINE__);
+    TargetPop *tp = targetpop + tpidx;
+    if (tp->NT <= 0)
+      continue;
+    if (tp->IRCP - 1 == tcpidx)
+    {
+      pr->block[pr->block_count].tidx0 = tidx0;
+      pr->block[pr->block_count].count = tp->NT;
+      pr->block_count++;
+    }
+    tidx0 += tp->NT;
   }
+}
 
-   // MAIN LOOP, work until done or get a TERM signal or get a quit command
-  for ( ; S.stepnum < S.step_count && !sigterm; S.stepnum++) 
+static bool
+projects_to (TargetPop *targetpop, int targetpop_count, int tcpidx)
+{
+  int tpidx;
+  for (tpidx = 0; tpidx < targetpop_count; tpidx++)
+    if (targetpop[tpidx].NT > 0 && targetpop[tpidx].IRCP - 1 == tcpidx)
+      return true;
+  return false;
+}
+
+static void
+free_tables (void)
+{
+  int n, pn;
+
+  for (n = 0; n < chunk_count; n++)
+    free (chunk[n].fired);
+  free (chunk);
+  free (pop_chunk0);
+  free (par_chunk);
+  free (pop_GE0);
+  chunk = NULL;
+  chunk_count = 0;
+  for (pn = 0; pn < table_fiberpops; pn++)
+    free (fib_fired[pn]);
+  free (fib_fired);
+  free (fib_fired_count);
+  free (fib_ran);
+  free (fib_skip);
+  fib_fired = NULL;
+  fib_ran = NULL;
+  fib_skip = NULL;
+  for (pn = 0; pn < table_cellpops; pn++)
   {
-    double GEsum0; // debug var
-    int pn;
-    static time_t now, last_time = 0;
+    for (n = 0; n < inputs[pn].proj_count; n++)
+      free (inputs[pn].proj[n].block);
+    free (inputs[pn].proj);
+  }
+  free (inputs);
+  inputs = NULL;
+  free (pop_fired);
+  pop_fired = NULL;
+  pop_fired_net = NULL;
+  free_lrn_wheels ();
+}
 
-    Motor mr;
-    State next_state = {0};
-    
-    if (lung_is_used) 
-    {
-      mr.phrenic = mup_eval (m.phrenic, S.phrenic_equation, &S.pe_evaluator);
-      mr.abdominal = mup_eval (m.abdominal, S.lumbar_equation, &S.le_evaluator);
-      
-      // JAH: lma (laryngeal muscle activation) is defined in lung.c as pca-ta and goes from 1 (open) to -1 (closed)
-      mr.pca = mup_eval (m.pca, 0, 0);
-      mr.ta = mup_eval (m.ta, 0, 0);
-#ifdef INTERCOSTALS
-      mr.expic = mup_eval (m.expic, 0, 0);
-      mr.inspic = mup_eval (m.inspic, 0, 0);
-#endif
-     // printf("phrenic: %f \n", mr.phrenic);
-      next_state   = lung (mr, S.step);
-    }
+// (Re)build the per step tables when the network changes.
+static void
+build_tables (void)
+{
+  int pn, n, tcpidx;
 
-    if (have_cmd_socket() && (S.stepnum % (int) ticks_in_sec) == 0)
+  if (table_net == S.net.cellpop && chunk)
+    return;
+  free_tables ();
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    chunk_count += (S.net.cellpop[pn].cell_count + CELL_CHUNK - 1) / CELL_CHUNK;
+  TCALLOC (chunk, chunk_count + 1);
+  TMALLOC (par_chunk, chunk_count + 1);
+  TMALLOC (pop_chunk0, S.net.cellpop_count + 1);
+  TCALLOC (pop_GE0, S.net.cellpop_count + 1);
+  par_chunk_count = 0;
+  n = 0;
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *p = S.net.cellpop + pn;
+    int cn0;
+    pop_chunk0[pn] = n;
+    for (cn0 = 0; cn0 < p->cell_count; cn0 += CELL_CHUNK, n++)
     {
-        snprintf(msg,sizeof(msg)-1,"TIME\n%d\n", (int)(S.stepnum/ticks_in_sec));
-        sendMsg(msg); // progress rpt for simbuild 
+      chunk[n].pn = pn;
+      chunk[n].cn0 = cn0;
+      chunk[n].cn1 = MIN (cn0 + CELL_CHUNK, p->cell_count);
+      chunk[n].serial = p->pop_subtype == PSR_POP && rng_type == RNG_LCG;
+      TMALLOC (chunk[n].fired, chunk[n].cn1 - cn0);
+      if (!chunk[n].serial)
+        par_chunk[par_chunk_count++] = n;
     }
-    if ((now = time (0)) > last_time)
-	    global_last_time = last_time = now;
+  }
+  pop_chunk0[pn] = n;
 
-    nf = 0;
-    for (pn = 0; pn < S.net.cellpop_count; pn++)  // cells
+  TCALLOC (fib_fired, S.net.fiberpop_count + 1);
+  TCALLOC (fib_fired_count, S.net.fiberpop_count + 1);
+  n = 0;
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    TMALLOC (fib_fired[pn], S.net.fiberpop[pn].fiber_count + 1);
+    n = MAX (n, S.net.fiberpop[pn].fiber_count);
+  }
+  TMALLOC (fib_ran, n + 1);
+  TMALLOC (fib_skip, S.net.fiberpop_count + 1);
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    fib_skip[pn].prob = -1;
+  TCALLOC (pop_fired, S.net.cellpop_count + S.net.fiberpop_count + 1);
+
+    // a pop's own entry is always there, its cells' learning rewards are
+    // done in the same pass as the deliveries into it
+  TCALLOC (inputs, S.net.cellpop_count + 1);
+  for (tcpidx = 0; tcpidx < S.net.cellpop_count; tcpidx++)
+  {
+    Inputs *in = inputs + tcpidx;
+    for (pn = 0; pn < S.net.cellpop_count; pn++)
     {
       CellPop *p = S.net.cellpop + pn;
-      int cn;
-      for (cn = 0; cn < p->cell_count; cn++) 
-      {
-        Cell *c = p->cell + cn;
+      if (pn == tcpidx || projects_to (p->targetpop, p->targetpop_count, tcpidx))
+        add_projection (in, pn, p->targetpop, p->targetpop_count, tcpidx);
+    }
+    for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    {
+      FiberPop *p = S.net.fiberpop + pn;
+      if (projects_to (p->targetpop, p->targetpop_count, tcpidx))
+        add_projection (in, S.net.cellpop_count + pn, p->targetpop, p->targetpop_count, tcpidx);
+    }
+  }
+  if (!S.ispresynaptic)
+    for (pn = 0; pn < S.net.cellpop_count; pn++)
+      if (!SYNSTATE (S.net.cellpop + pn))
+        synstate_alloc (S.net.cellpop + pn, S.stepnum);
+
+  if (write_bdt || write_smr)
+    bdt_map ();
+  build_lrn_wheels ();
+
+  table_net = S.net.cellpop;
+  table_cellpops = S.net.cellpop_count;
+  table_fiberpops = S.net.fiberpop_count;
+}
 
-        double Gsum = 0, GEsum = 0, Prob = 0, Vm, Gk;
-        int sidx, tidx, pp_idx;
+// Membrane update for one chunk of cells.
+static void
+integrate_cells (CellChunk *ch)
+{
+  CellPop *p = S.net.cellpop + ch->pn;
+  CellState *cs = CELLSTATE (p);
+  SynState *ss = SYNSTATE (p);
+  int pn = ch->pn;
+  int cn;
+    // each cell takes two noise numbers, start where the cells before
+    // this chunk would have left the pop's generator
+  int noise_seed = p->noise_amp ? ran_skip (p->noise_seed, 2UL * ch->cn0) : 0;
+  double noise_ran[2 * CELL_CHUNK];
+
+  if (p->noise_amp && rng_type == RNG_PHILOX)
+    philox_fill (p->noise_seed, PHILOX_CELL_NOISE, pn, S.stepnum, 2 * ch->cn0, 2 * (ch->cn1 - ch->cn0), noise_ran);
+
+  ch->fired_count = 0;
+  for (cn = ch->cn0; cn < ch->cn1; cn++) 
+  {
+    Cell *c = p->cell + cn;
 
-        for (sidx = 0; sidx < c->syn_count; sidx++) 
-        {
-          Syn *s = c->syn + sidx;
+    double Gsum = 0, GEsum = 0, Prob = 0, Vm, Gk;
+    double GEsum0; // debug var
+    int sidx;
 
-          if (S.ispresynaptic) 
-          {
-            int type_of_syn = S.net.syntype[s->stidx].SYN_TYPE;
-            if (type_of_syn == SYN_NOT_USED) // you've got a bug
-              fprintf(stdout,"Unexpected unused synapse in simloop\n");
-            if (type_of_syn == SYN_NORM)
-            {
-               Syn *chk = c->syn;
-               double post = 1;
-                  // do we have a post item associated with us?
-               for (pp_idx = 0; pp_idx < c->syn_count; ++pp_idx, ++chk) 
-               {
-                  if (chk->synparent && chk->synparent == s->stidx+1)
-                  {
-                     if (chk->syntype == SYN_POST)
-                     {
-                       post = chk->G;
-                       break; // at most one of these
-                     }
-                  }
-               }
-                // Normalize Conductance sum += syn Normalized Conductance
-                // * Post syn Normalized Conductance or 1
-               Gsum += s->G * post;
-
-               // Excitatory Conductance sum += syn Normalized Conductance
-               // * Post syn Normalized Conductance or 1 
-               // * (syn Equlibrium Potentential - offset if burster)
-               GEsum += s->G * post * (s->EQ - (p->pop_subtype  == BURSTER_POP ? 65. : 0));
-
-               if (p->pop_subtype == PSR_POP) 
-                  // for pulmonary stretch receptor
-                  // Probabilty += syn Normalized Conductance
-                  // * post syn Normalized Conductance or 1
-                  // * 1 / syn Decay of Potential in a Compartment
-                  // NOTE: Prob is always zero except for this case.
-                  Prob += s->G * post * (1. - s->DCS); /* PSR or other external object */
-            }
-          }
-          else  // NOT pre/post synaptic
-          {
+    if (S.ispresynaptic) 
+    {
+      for (sidx = 0; sidx < c->syn_count; sidx++) 
+      {
+        Syn *s = c->syn + sidx;
+        int type_of_syn = s->syntype;
+        if (type_of_syn == SYN_NOT_USED) // you've got a bug
+          fprintf(stdout,"Unexpected unused synapse in simloop\n");
+        if (type_of_syn == SYN_NORM)
+        {
+              // post syn modifier for this one, linked by build_network
+           double post = s->post >= 0 ? c->syn[s->post].G : 1;
             // Normalize Conductance sum += syn Normalized Conductance
-            Gsum += s->G;
-
-            // Excitatory Conductance sum += syn Normalized Conductance
-            // * (syn Equlibrium Potentential - offset if burster)
-            GEsum += (double)s->G * (s->EQ - (p->pop_subtype == BURSTER_POP ? 65. : 0));
-
-            if (p->pop_subtype == PSR_POP) 
-               // for pulmonary stretch receptor
-               // probabilty += syn Normalized Conductance
-               // * 1 / syn Decay of Potential in a Compartment
-               Prob += s->G * (1. - s->DCS); /* PSR or other external object */
-           }
+            // * Post syn Normalized Conductance or 1
+           Gsum += s->G * post;
+
+           // Excitatory Conductance sum += syn Normalized Conductance
+           // * Post syn Normalized Conductance or 1 
+           // * (syn Equlibrium Potentential - offset if burster)
+           GEsum += s->G * post * (s->EQ - (p->pop_subtype  == BURSTER_POP ? 65. : 0));
+
+           if (p->pop_subtype == PSR_POP) 
+              // for pulmonary stretch receptor
+              // Probabilty += syn Normalized Conductance
+              // * post syn Normalized Conductance or 1
+              // * 1 / syn Decay of Potential in a Compartment
+              // NOTE: Prob is always zero except for this case.
+              Prob += s->G * post * (1. - s->DCS); /* PSR or other external object */
         }
+      }
+    }
+    else  // NOT pre/post synaptic
+    {
+      // The decay pass has already added up, over this cell's synapses,
+      // Normalize Conductance sum += syn Normalized Conductance,
+      // Excitatory Conductance sum += syn Normalized Conductance
+      // * (syn Equlibrium Potentential - offset if burster),
+      // and for a pulmonary stretch receptor, probabilty += syn
+      // Normalized Conductance * 1 / syn Decay of Potential in a Compartment
+      Gsum = ss->Gsum[cn];
+      GEsum = ss->GEsum[cn];
+      if (p->pop_subtype == PSR_POP) 
+        Prob = ss->Prob[cn];
+    }
 #define NOISE_FIRING_PROBABILITY .05
 #define NOISE_EQ 70
 
-        if (p->noise_amp)
+    if (p->noise_amp)
+    {
+      double ran_e, ran_i;
+      double gnoise_e = cs->gnoise_e[cn];
+      double gnoise_i = cs->gnoise_i[cn];
+      gnoise_e *= noise_decay;
+      gnoise_i *= noise_decay;
+      if (rng_type == RNG_PHILOX)
+      {
+        ran_e = noise_ran[2 * (cn - ch->cn0)];
+        ran_i = noise_ran[2 * (cn - ch->cn0) + 1];
+      }
+      else
+      {
+        ran_e = ran (&noise_seed);
+        ran_i = ran (&noise_seed);
+      }
+      if (ran_e < NOISE_FIRING_PROBABILITY)
+        gnoise_e += p->noise_amp;
+      if (ran_i < NOISE_FIRING_PROBABILITY)
+        gnoise_i += p->noise_amp;
+      // Excitatory Conductance sum += some noise
+      Gsum += gnoise_e + gnoise_i;
+      // Excitatory Conductance sum += some noise
+      GEsum += gnoise_e * ( NOISE_EQ - (p->pop_subtype == BURSTER_POP ? 65. : 0));
+      GEsum += gnoise_i * (-NOISE_EQ - (p->pop_subtype == BURSTER_POP ? 65. : 0));
+      cs->gnoise_e[cn] = gnoise_e;
+      cs->gnoise_i[cn] = gnoise_i;
+    }
+    GEsum0 = GEsum; // this only used in a debug statement later
+
+    // Vm is potential in millivolts?  V in MacGregor is Potential
+    // Copy Potential(mv) 
+    // V in Mac. is Potential
+    Vm = cs->Vm_prev[cn] = cs->Vm[cn];
+
+    // copy Potassium Conductance for cell
+    Gk = cs->Gk[cn];
+    if (p->pop_subtype == PSR_POP)  /* PSR or other external object */
+    {
+       // if Potential < Prob then DC = Decay Constant For Threshold
+       // else DC = Decay Constant for Potassium Action
+      double DC = Vm < Prob ? p->DCTH : p->DCG;
+      if (S.stepnum == 0) // special case, 1st time in loop
+        Vm = 0;
+      // Potential = Potential - Prob * Decay Constant + Prob
+      Vm = (Vm - Prob) * DC + Prob;
+      // Thr is Resting Threshold + random gaussian number * optional std dev
+      // if Potential > Thr then if random # <= Potential  - threshold
+      // spike is 1 (fired) else 0 (not)
+      cs->spike[cn] = (Vm > cs->Thr[cn]) ? ((rng_type == RNG_PHILOX ? philox_ran (p->noise_seed, PHILOX_PSR, pn, S.stepnum, cn)
+                                                                    : ran (&S.seed)) <= (Vm - cs->Thr[cn])) : 0;
+    }
+    else 
+    {
+         /* hybrid Integrate and Fire (IF) cell (Breen, et. al. model) */
+      if (p->pop_subtype == BURSTER_POP)   
+      {
+        double G_NaP;
+        // m_inf=1/(1 + exp ((Potential - c_thresh_active_iak) / c_max_conductance_ika))
+        double m_inf = 1 / (1 + exp ((Vm - p->theta_m) / p->sigma_m));
+
+        // h_inf=1/(1+exp((Potential - rebound_time_k) / max_conductance_ika))
+        double h_inf = 1 / (1 + exp ((Vm - p->theta_h) / p->sigma_h));
+
+        // tau_h= accomodation / cosh((Potential-rebound_time_k) / (2 * max_conductance_ika)
+        double tau_h = p->taubar_h / cosh ((Vm - p->theta_h) / (2 * p->sigma_h));
+        if (S.stepnum == 0)  // special case, 1st time
+        {
+           Gk = .43;  // initial Potassium Conductance
+           Vm = -52;  // initial millivolts
+        }
+        // Potassium Conductance = h_inf + (Potassium Conductance) * exp(-S.step/tau_h)
+        Gk = h_inf + (Gk - h_inf) * exp (-S.step / tau_h);
+
+        // G_NaP = Persisten Sodium Current(?) * m_inf * Potassium conductance.
+        G_NaP = p->g_NaP_h * m_inf * Gk;
+         // more complicated stuff
+        Gsum += G_NaP + g_L;
+        GEsum += G_NaP * E_Na + g_L * E_L + pop_GE0[pn];
+      }
+      else 
+      {
+        // if (spike) Potassium Conductance = Sensitivity to Potassium Conductance
+        //            + (Potassium Conductance - Sensitivity to Potassium Conductance)
+        // else       Potassium Conductance = Potassium Conductance 
+        //                                  * Decay Constant for Potassium Action
+        Gk = cs->spike[cn] ? p->B + (Gk - p->B) * p->DCG : Gk * p->DCG;
+
+        // Normalized Conductance sum +=  Potassium Conductance + Gm0
+        // (I can't find any place in the code where Gm0 is anything but 1.)
+        Gsum += Gk + S.Gm0;
+
+        // Something to do with Excitatory Conductance derived from an
+        // injected expression based on a formula or an evaluated equation.
+        // Formula is: if Decay Constant for Potassium == -1
+        //                GE0 = DC Injected Current * 0 
+        //             else
+        //                GE0 = DC Injected Current *  Gm0 * Vm0;
+        //             GM0 seems to always be 1, Vm0 seems to always be 0
+        double GE0 = pop_GE0[pn];
+
+        // Excitatory Conductance sum += Excitatory Conductance from injected current
+        //                  * Potassium Conductance * Potassium Equilibrium Potential
+        GEsum += GE0 + Gk * S.Ek;
+      }
+
+      // R0 is 0 for PSR, otherwise,
+      // R0 = -.5 * step size in ms / membrane time constant  * Gm0(always 1?)
+      // Potential = Excitatory Conductance sum / Normalized Conductance sum
+      //             + (Potential - Excitatory Conducance sum/Normalized Conductance sum
+      //             * exp(Normalized Conductance sim * R0
+      //
+      Vm = GEsum/Gsum + (Vm - GEsum/Gsum) * exp(Gsum * p->R0);
+
+     if (0) // debug stuff, 0 -> 1 to turn it on
+     {
+       static FILE *f;
+       if (f == NULL)
+         f = fopen ("simloop.dbg", "w");
+       if (pn == 37)
+       fprintf (f, "step: %d, cn: %d, Vm: %g %g %g %g %g %g %g %g %g %d %g %g | %g %g %g %g %g\n",
+                S.stepnum, cn, Vm, GEsum, Gsum, cs->Vm[cn], p->R0, GEsum0, p->GE0, Gk, S.Ek, cs->spike[cn], p->B, p->DCG,
+                cs->Thr[cn], p->Th0, p->MGC, S.Vm0, p->DCTH);
+        if (S.stepnum == 6) 
         {
-          double ranval;
-          double gnoise_e = c->gnoise_e;
-          double gnoise_i = c->gnoise_i;
-          gnoise_e *= noise_decay;
-          gnoise_i *= noise_decay;
-          if ((ranval = ran (&p->noise_seed)) < NOISE_FIRING_PROBABILITY)
-            gnoise_e += p->noise_amp;
-          if ((ranval = ran (&p->noise_seed)) < NOISE_FIRING_PROBABILITY)
-            gnoise_i += p->noise_amp;
-          // Excitatory Conductance sum += some noise
-          Gsum += gnoise_e + gnoise_i;
-          // Excitatory Conductance sum += some noise
-          GEsum += gnoise_e * ( NOISE_EQ - (p->pop_subtype == BURSTER_POP ? 65. : 0));
-          GEsum += gnoise_i * (-NOISE_EQ - (p->pop_subtype == BURSTER_POP ? 65. : 0));
-          c->gnoise_e = gnoise_e;
-          c->gnoise_i = gnoise_i;
+          fclose (f);
+          exit (0);
         }
-        GEsum0 = GEsum; // this only used in a debug statement later
+     }
+   
+     if (p->pop_subtype == BURSTER_POP)
+        // Thr = Threshold Voltage
+       cs->Thr[cn] = p->Vthresh;
+     else 
+     {
+        // Potential time(?) = Resting Threshold + Accomodation Paramter 
+        //                     * (Potential - Vm0(always 0?))
+       double Vt = p->Th0 + p->MGC * (Vm - S.Vm0);
+
+       // Thr starts as Resting Threshold + random gaussian number * optional std dev
+       // Thr = Vt + (Thr - Vt) * Decay Constant for Threshold
+       cs->Thr[cn] = Vt + (cs->Thr[cn] - Vt) * p->DCTH;
+     }
+     // spike is 1 if Potential >= Threshold
+     //          0 if not
+     cs->spike[cn] = Vm >= cs->Thr[cn];
+   }
+
+   if (cs->spike[cn])  // fired?
+   {
+     ch->fired[ch->fired_count++] = cn;
+     if (p->pop_subtype == BURSTER_POP) 
+     {
+       Vm = ((11.085 * Gk) - 6.5825) * Gk + p->Vreset;
+       Gk += p->delta_h - .5 * 0.0037 * Gk;
+     }
+   }
+   cs->Vm[cn] = Vm; // remember these for next time around the loop
+   cs->Gk[cn] = Gk;
+  }
+}
+
+static void
+integrate_task (int task, void *arg)
+{
+  (void) arg;
+  integrate_cells (chunk + par_chunk[task]);
+}
+
+// Integrate every cell and count the spikes in each pop. Returns the
+// number of spikes in the analog output pop.
+static int
+integrate_all (void)
+{
+  int pn, n;
+
+  build_tables ();
+    // the injected current expression is the same for every cell in a pop,
+    // and muparser is not safe to call from several threads at once
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *p = S.net.cellpop + pn;
+    if (p->pop_subtype != PSR_POP && p->cell_count)
+      pop_GE0[pn] = get_GE0 (p);
+  }
+  pool_run (integrate_task, NULL, par_chunk_count);
+  for (n = 0; n < chunk_count; n++)
+    if (chunk[n].serial)
+      integrate_cells (chunk + n);
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *p = S.net.cellpop + pn;
+    if (p->noise_amp && rng_type == RNG_LCG)
+      p->noise_seed = ran_skip (p->noise_seed, 2UL * p->cell_count);
+  }
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    pop_fired[pn] = 0;
+  for (n = 0; n < chunk_count; n++)
+    pop_fired[chunk[n].pn] += chunk[n].fired_count;
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    spike_total += pop_fired[pn];
+  pop_fired_net = S.net.cellpop;
+  return S.nanlgpop > 0 && S.nanlgpop <= S.net.cellpop_count ? pop_fired[S.nanlgpop - 1] : 0;
+}
+
+// bdt/smr output for a cell that spiked
+static void
+record_cell (int pn, int cn)
+{
+  const int *code;
+  int n, count = bdt_codes (bdt_cell_map, pn, cn, &code);
+  int time = (int)((S.stepnum + 1) * S.step / dt_step);
+
+  if (write_bdt)
+    for (n = 0; n < count; n++)
+      bdt_event (abs (code[n]), time);
+  if (write_smr)
+    for (n = 0; n < count; n++)
+    {
+      if (code[n] > 0)
+        writeSpike (code[n], time);
+      else if (S.ofile) /* Thu Feb  1 08:42:27 EST 2007: what is this? ROC */
+        bdt_event (-code[n], time);   // the wildcard goes to the bdt file
+    }
+}
+
+static void
+record_cells (void)
+{
+  int n, f;
+
+  if (!write_bdt && !write_smr)
+    return;
+  for (n = 0; n < chunk_count; n++)
+    for (f = 0; f < chunk[n].fired_count; f++)
+      record_cell (chunk[n].pn, chunk[n].fired[f]);
+}
+
+// The fiber fired.
+static void
+fire_fiber (FiberPop *p, int pn, int fn)
+{
+  int widx;
+
+  if(Debug){printf("Fiber fire\n");}
+  p->fiber[fn].state = 1; // an event occurred
+  if (write_bdt || write_smr)
+  {
+    const int *code;
+    int count = bdt_codes (bdt_fiber_map, pn, fn, &code);
+    if (write_bdt)
+      for (widx = 0; widx < count; widx++)
+        bdt_event (code[widx], (int)((S.stepnum + 1) * S.step / dt_step));
+    if (write_smr)
+      for (widx = 0; widx < count; widx++)
+        writeSpike(code[widx], (int)((S.stepnum + 1) * S.step / dt_step));
+  }
+  fib_fired[pn][fib_fired_count[pn]++] = fn;
+}
+
+// How many fibers do not fire before the next one that does, a geometric
+// draw. draw counts the philox draws for this pop and step.
+static int64_t
+fiber_gap (FiberPop *p, int pn, uint32_t *draw)
+{
+  double u = rng_type == RNG_PHILOX ? philox_ran (p->infsed, PHILOX_FIBER_SKIP, pn, S.stepnum, (*draw)++)
+                                    : ran (&p->infsed);
+  double gap = floor (log1p (-u) / fib_skip[pn].log_q);
 
-        // Vm is potential in millivolts?  V in MacGregor is Potential
-        // Copy Potential(mv) 
-        // V in Mac. is Potential
-        Vm = c->Vm_prev = c->Vm;
+  return gap < (double) (INT64_MAX / 4) ? (int64_t) gap : INT64_MAX / 4;
+}
+
+/* --fiber-skip firing for one step. Each fiber still fires with the pop's
+   probability, but only the ones that fire take a random number, so a pop
+   of many fibers that seldom fire costs next to nothing. The numbers are
+   not those of the fiber by fiber draws, use the default for old runs.
+*/
+static void
+fire_fibers_skip (FiberPop *p, int pn)
+{
+  FibSkip *fs = fib_skip + pn;
+  uint32_t draw = 0;
+  int fn;
+
+  if (p->probability <= 0)
+    return;
+  if (p->probability >= 1)
+  {
+    for (fn = 0; fn < p->fiber_count; fn++)
+      fire_fiber (p, pn, fn);
+    return;
+  }
+  if (fs->prob != p->probability)
+  {
+    fs->prob = p->probability;
+    fs->log_q = log1p (-fs->prob);
+    fs->next = fiber_gap (p, pn, &draw);
+  }
+  while (fs->next < p->fiber_count)
+  {
+    fire_fiber (p, pn, (int) fs->next);
+    fs->next += 1 + fiber_gap (p, pn, &draw);
+  }
+  fs->next -= p->fiber_count;
+}
 
-        // copy Potassium Conductance for cell
-        Gk = c->Gk;
-        if (p->pop_subtype == PSR_POP)  /* PSR or other external object */
+// The cell fired. If it has any learning input synapses, reward them.
+static void
+reward_cell (int pn, int cn)
+{
+  Cell *c = S.net.cellpop[pn].cell + cn;
+  double delta;
+  Syn* lsyn = c->syn;
+  int lsyn_num, lrn_num;
+  for (lsyn_num = 0; lsyn_num < c->syn_count; ++lsyn_num, ++lsyn)
+  {
+     if (lsyn->syntype != SYN_LEARN)
+        continue;
+     {if(Debug)printf("Using learn synapse for pop: %d cell: %d\n",pn,cn);}
+       // once for each pending input event inside the learning window
+     for (lrn_num = 0; lrn_num < lsyn->lrn_active; ++lrn_num)
+     {
+        // Hebbian learning equation from MacGregor
+        delta = lsyn->lrnStrDelta * (fabs(lsyn->lrnStrMax - lsyn->lrn_strength));
+        lsyn->lrn_strength += delta;
+        // can overflow if initial > max 
+        // or underflow because it does if neg delta
+        if (lsyn->lrnStrDelta > 0)
         {
-           // if Potential < Prob then DC = Decay Constant For Threshold
-           // else DC = Decay Constant for Potassium Action
-          double DC = Vm < Prob ? p->DCTH : p->DCG;
-          if (S.stepnum == 0) // special case, 1st time in loop
-            Vm = 0;
-          // Potential = Potential - Prob * Decay Constant + Prob
-          Vm = (Vm - Prob) * DC + Prob;
-          // Thr is Resting Threshold + random gaussian number * optional std dev
-          // if Potential > Thr then if random # <= Potential  - threshold
-          // spike is 1 (fired) else 0 (not)
-          c->spike = (Vm > c->Thr) ? (ran (&S.seed) <= (Vm - c->Thr)) : 0;
+           if (lsyn->lrn_strength > lsyn->lrnStrMax)
+              lsyn->lrn_strength = lsyn->lrnStrMax;
         }
-        else 
+        else if (lsyn->lrnStrDelta < 0)
         {
-             /* hybrid Integrate and Fire (IF) cell (Breen, et. al. model) */
-          if (p->pop_subtype == BURSTER_POP)   
-          {
-            double G_NaP;
-            // m_inf=1/(1 + exp ((Potential - c_thresh_active_iak) / c_max_conductance_ika))
-            double m_inf = 1 / (1 + exp ((Vm - p->theta_m) / p->sigma_m));
+           if (lsyn->lrn_strength < lsyn->lrnStrMax)
+              lsyn->lrn_strength = lsyn->lrnStrMax;
+        }
 
-            // h_inf=1/(1+exp((Potential - rebound_time_k) / max_conductance_ika))
-            double h_inf = 1 / (1 + exp ((Vm - p->theta_h) / p->sigma_h));
+        {if(Debug)printf("tick: %d cell fire USE HISTORY: pop: %d cell %d syn: %d new str: %lf\n" ,S.stepnum,pn, cn,lsyn_num,lsyn->lrn_strength);
+        fflush(stdout);}
+     }
 
-            // tau_h= accomodation / cosh((Potential-rebound_time_k) / (2 * max_conductance_ika)
-            double tau_h = p->taubar_h / cosh ((Vm - p->theta_h) / (2 * p->sigma_h));
-            if (S.stepnum == 0)  // special case, 1st time
-            {
-               Gk = .43;  // initial Potassium Conductance
-               Vm = -52;  // initial millivolts
-            }
-            // Potassium Conductance = h_inf + (Potassium Conductance) * exp(-S.step/tau_h)
-            Gk = h_inf + (Gk - h_inf) * exp (-S.step / tau_h);
-
-            // G_NaP = Persisten Sodium Current(?) * m_inf * Potassium conductance.
-            G_NaP = p->g_NaP_h * m_inf * Gk;
-             // more complicated stuff
-            Gsum += G_NaP + g_L;
-            GEsum += G_NaP * E_Na + g_L * E_L + get_GE0 (p);
-          }
-          else 
-          {
-            // if (spike) Potassium Conductance = Sensitivity to Potassium Conductance
-            //            + (Potassium Conductance - Sensitivity to Potassium Conductance)
-            // else       Potassium Conductance = Potassium Conductance 
-            //                                  * Decay Constant for Potassium Action
-            Gk = c->spike ? p->B + (Gk - p->B) * p->DCG : Gk * p->DCG;
-
-            // Normalized Conductance sum +=  Potassium Conductance + Gm0
-            // (I can't find any place in the code where Gm0 is anything but 1.)
-            Gsum += Gk + S.Gm0;
-
-            // Something to do with Excitatory Conductance derived from an
-            // injected expression based on a formula or an evaluated equation.
-            // Formula is: if Decay Constant for Potassium == -1
-            //                GE0 = DC Injected Current * 0 
-            //             else
-            //                GE0 = DC Injected Current *  Gm0 * Vm0;
-            //             GM0 seems to always be 1, Vm0 seems to always be 0
-            double GE0 = get_GE0 (p);
-
-            if(Debug)
-            {
-               static char done[100];
-               if (!done[pn]) 
-               {
-                 // printf ("pn = %d, GE0: %g\n", pn, GE0);
-                 done[pn] = 1;
-              }
+     // if cell fired but no pending input events, unlearn
+     if (lsyn->lrn_pending == 0)
+     {
+        delta = lsyn->lrnStrDelta * (fabs(lsyn->lrnStrMax - lsyn->lrn_strength));
+        lsyn->lrn_strength -= delta;
+        if (lsyn->lrnStrDelta >= 0)
+        {
+           if (lsyn->lrn_strength < lsyn->initial_strength)
+              lsyn->lrn_strength = lsyn->initial_strength;
+        }
+        else
+        {
+           if (lsyn->lrn_strength > lsyn->initial_strength)
+              lsyn->lrn_strength = lsyn->initial_strength;
+        }
+        {if(Debug)printf("tick: %d cell fire NO HISTORY pop: %d cell %d syn %d new str: %lf\n",S.stepnum,pn,cn,lsyn_num,lsyn->lrn_strength);}
+        fflush(stdout);
+     }
+  }
+}
 
-              static double last_volume = -1;
-              if (p->ic_expression && state.volume != last_volume) 
-              {
-                //  printf ("pn = %d, GE0: %.17e, volume: %.17e\n", pn, GE0, state.volume);
-                last_volume = state.volume;
-              }
-            }
-            // Excitatory Conductance sum += Excitatory Conductance from injected current
-            //                  * Potassium Conductance * Potassium Equilibrium Potential
-            GEsum += GE0 + Gk * S.Ek;
-          }
+// A cell spiked, increase strength value in the current slot of the q
+// array of one of its terminals.
+static inline void
+cell_terminal (Syn *syn, int delay, float strength, int cn)
+{
+  if (Debug) {printf("Cell Fire\n");}
+  int type_of_syn=S.net.syntype[syn->stidx].SYN_TYPE;
+  switch (type_of_syn)
+  {
+     case SYN_NORM:
+        syn->q[(S.stepnum + delay) % syn->q_count] += strength;
+        break;
+     case SYN_LEARN: 
+        syn->q[(S.stepnum + delay) % syn->q_count] += syn->lrn_strength;
+        {if(Debug)printf("update target %d slot: %d\n",syn->cidx,(S.stepnum + delay) % syn->q_count);}
+        updateLrnSyns(syn,delay,cn);
+        break;
+      case SYN_PRE:
+      case SYN_POST: // == 1 has no effect
+         if (strength < 1)
+            syn->q[(S.stepnum + delay) % syn->q_count] *= strength;
+          else  if (strength > 1)
+             syn->q[(S.stepnum + delay) % syn->q_count] += syn->lrn_strength;
+          break;
+      default:
+         printf("Unknown synapse type %d\n",type_of_syn);
+         break;
+  }
 
-          // R0 is 0 for PSR, otherwise,
-          // R0 = -.5 * step size in ms / membrane time constant  * Gm0(always 1?)
-          // Potential = Excitatory Conductance sum / Normalized Conductance sum
-          //             + (Potential - Excitatory Conducance sum/Normalized Conductance sum
-          //             * exp(Normalized Conductance sim * R0
-          //
-          Vm = GEsum/Gsum + (Vm - GEsum/Gsum) * exp(Gsum * p->R0);
+  if(Debug){ printf("Cell %d %d %.2lf\n",delay, (S.stepnum + delay) % syn->q_count, syn->q[(S.stepnum + delay) % syn->q_count]);}
+}
 
-         if (0) // debug stuff, 0 -> 1 to turn it on
-         {
-           static FILE *f;
-           if (f == NULL)
-             f = fopen ("simloop.dbg", "w");
-           if (pn == 37)
-           fprintf (f, "step: %d, cn: %d, Vm: %g %g %g %g %g %g %g %g %g %d %g %g | %g %g %g %g %g\n",
-                    S.stepnum, cn, Vm, GEsum, Gsum, c->Vm, p->R0, GEsum0, p->GE0, Gk, S.Ek, c->spike, p->B, p->DCG,
-                    c->Thr, p->Th0, p->MGC, S.Vm0, p->DCTH);
-            if (S.stepnum == 6) 
-            {
-              fclose (f);
-              exit (0);
-            }
-         }
-       
-         if (p->pop_subtype == BURSTER_POP)
-            // Thr = Threshold Voltage
-           c->Thr = p->Vthresh;
-         else 
-         {
-            // Potential time(?) = Resting Threshold + Accomodation Paramter 
-            //                     * (Potential - Vm0(always 0?))
-           double Vt = p->Th0 + p->MGC * (Vm - S.Vm0);
+// Targets means terminals. The starting origin for the q delay 
+// arrays are randomly set during build_network.
+// Fiber fired. Increase strength value in the q arrays at the
+// current index determined by the index expression below.
+// In effect, potentials are stored in a delay array.
+// ** Only the sender knows when it fires, so it has to add  
+// ** history to the receiver's history list.
+// ** Only the receiver knows when it fires, so it has to 
+// ** do the searching and rewarding. 
+static inline void
+fiber_terminal (Syn *syn, int delay, float strength, int fn)
+{
+  int type_of_syn = S.net.syntype[syn->stidx].SYN_TYPE;
+    // if NORM, one calc, LEARN, also update history, 
+    // both pre and post get same calc, depending on sign
+   switch (type_of_syn)
+   {
+      case SYN_NORM:
+         syn->q[(S.stepnum + delay) % syn->q_count] += strength;
+        break;
+      case SYN_LEARN:
+        syn->q[(S.stepnum + delay) % syn->q_count] += syn->lrn_strength;
+        updateLrnSyns(syn,delay,fn);
+         break;
+      case SYN_PRE:
+      case SYN_POST: // == 1 has no effect
+         if (strength < 1)
+            syn->q[(S.stepnum + delay) % syn->q_count] *= strength;
+          else  if (strength > 1)
+             syn->q[(S.stepnum + delay) % syn->q_count] += strength - 1.;
+          break;
+      default:
+          printf("Unknown synapse type %d\n",type_of_syn);
+          break;
+    }
+   if(Debug){printf("  Fiber: cpop %d  cell %d  syntype %d delay: %d index: %d val: %.2lf\n", 
+            syn->cpidx, syn->cidx, syn->stidx,
+            delay,
+            (S.stepnum + delay) % syn->q_count,
+            syn->q[(S.stepnum + delay) % syn->q_count]);}
+}
 
-           // Thr starts as Resting Threshold + random gaussian number * optional std dev
-           // Thr = Vt + (Thr - Vt) * Decay Constant for Threshold
-           c->Thr = Vt + (c->Thr - Vt) * p->DCTH;
-         }
-         // spike is 1 if Potential >= Threshold
-         //          0 if not
-         c->spike = Vm >= c->Thr;
-       }
+// The terminals of a cell that land in one target pop.
+static inline void
+deliver_cell (Target *targets, Projection *pr, int cn)
+{
+  int bn, tidx;
 
-       if (c->spike)  // fired?
-       {
-         int widx;
-         if (write_bdt)
-         {
-           for (widx = 0; widx < S.cwrit_count; widx++)
-           {
-             if (S.cwrit[widx].pop == pn + 1) 
-             {
-               if  (S.cwrit[widx].cell == cn + 1)
-               {
-                 fprintf (S.ofile, fmt, 100 + widx + 1, (int)((S.stepnum + 1) * S.step / dt_step));
-                 fprintf (S.ofile, "%c",0x0a);
-               }
-               else if (S.cwrit[widx].cell == 999999999) /* Thu Feb  1 08:42:27 EST 2007: what is this? ROC */
-               {
-                    fprintf (S.ofile, fmt, 21 + cn, (int)((S.stepnum + 1) * S.step / dt_step));
-                      // if running in DOS, no way now to view bdt, 
-                      // so use Linux newline char
-                    fprintf (S.ofile, "%c",0x0a);
-               }
-             }
-           }
-         }
-         if (write_smr)
-         {
-           for (widx = 0; widx < S.cwrit_count; widx++)
-           {
-             if (S.cwrit[widx].pop == pn + 1) 
-             {
-               if  (S.cwrit[widx].cell == cn + 1)
-               {
-                 writeSpike(100 + widx + 1, (int)((S.stepnum + 1) * S.step / dt_step));
-               }
-               else 
-                  if (S.cwrit[widx].cell == 999999999) /* Thu Feb  1 08:42:27 EST 2007: what is this? ROC */
-                  {
-                    fprintf (S.ofile, fmt, 21 + cn, (int)((S.stepnum + 1) * S.step / dt_step));
-                    fprintf (S.ofile, "%c",0x0a); // if running in DOS, no way now to view 
-                                                  // bdt, so make this linux text format
-                  }
-             }
-           }
-         }
-         if (pn + 1 == S.nanlgpop) 
-           nf++;
-           // Increase strength value in current slot in the q array
-         for (tidx = 0; tidx < c->target_count; tidx++) 
-         {
-           if (Debug) {printf("Cell Fire\n");}
-           Target *target = c->target + tidx;
-           Syn *syn = target->syn;
-           if (target->disabled)
-             continue;
-           int type_of_syn=S.net.syntype[syn->stidx].SYN_TYPE;
-           switch (type_of_syn)
-           {
-              case SYN_NORM:
-                 syn->q[(S.stepnum + target->delay) % syn->q_count] += target->strength;
-                 break;
-              case SYN_LEARN: 
-                 syn->q[(S.stepnum + target->delay) % syn->q_count] += target->syn->lrn_strength;
-                 {if(Debug)printf("update target %d slot: %d\n",target->syn->cidx,(S.stepnum + target->delay) % syn->q_count);}
-                 updateLrnSyns(target,syn,cn);
-                 break;
-               case SYN_PRE:
-               case SYN_POST: // == 1 has no effect
-                  if (target->strength < 1)
-                     syn->q[(S.stepnum + target->delay) % syn->q_count] *= target->strength;
-                   else  if (target->strength > 1)
-                      syn->q[(S.stepnum + target->delay) % syn->q_count] += target->syn->lrn_strength;
-                   break;
-               default:
-                  printf("Unknown synapse type %d\n",type_of_syn);
-                  break;
-           }
+  for (bn = 0; bn < pr->block_count; bn++)
+  {
+    Target *target = targets + pr->block[bn].tidx0;
+    for (tidx = 0; tidx < pr->block[bn].count; tidx++, ++target) 
+      if (!target->disabled)
+        cell_terminal (target->syn, target->delay, target->strength, cn);
+  }
+}
 
-           if(Debug){ printf("Cell %d %d %.2lf\n",target->delay, (S.stepnum + target->delay) % syn->q_count, syn->q[(S.stepnum + target->delay) % syn->q_count]);}
-         }
-         // we fired. If we we have any learning
-         // input synapses, reward them.
-         LEARN *lrn_ptr;
-         double delta;
-         Syn* lsyn = c->syn;
-         int lsyn_num, lrn_num;
-         for (lsyn_num = 0; lsyn_num < c->syn_count; ++lsyn_num, ++lsyn)
-         {
-            if (lsyn->syntype != SYN_LEARN)
-               continue;
-            lrn_ptr = lsyn->lrn;
-            bool have_history = false;
-            {if(Debug)printf("Using learn synapse for pop: %d cell: %d\n",pn,cn);}
-            for (lrn_num = 0; lrn_num < lsyn->lrn_size; ++lrn_num,++lrn_ptr)
-            {
-               if (lrn_ptr->recv_pop == LRN_FREE)
-                  continue;
-               if (lrn_ptr->ariv_time > lsyn->lrnWindow)
-               {
-                  have_history = true; // may not use it, but pending
-                  continue;            // so don't forget below
-               }
-               have_history = true;
-//               {if(Debug)printf("tick: %d pop: %d cell:%d rcv: %d %lf ->" ,S.stepnum, pn, cn, lrn_ptr->recv_term,lsyn->lrn_strength);}
-               // Hebbian learning equation from MacGregor
-               delta = lsyn->lrnStrDelta * (fabs(lsyn->lrnStrMax - lsyn->lrn_strength));
-               lsyn->lrn_strength += delta;
-               // can overflow if initial > max 
-               // or underflow because it does if neg delta
-               if (lsyn->lrnStrDelta > 0)
-               {
-                  if (lsyn->lrn_strength > lsyn->lrnStrMax)
-                     lsyn->lrn_strength = lsyn->lrnStrMax;
-               }
-               else if (lsyn->lrnStrDelta < 0)
-               {
-                  if (lsyn->lrn_strength < lsyn->lrnStrMax)
-                     lsyn->lrn_strength = lsyn->lrnStrMax;
-               }
+static inline void
+deliver_fiber (Target *targets, Projection *pr, int fn)
+{
+  int bn, tidx;
 
-               {if(Debug)printf("tick: %d cell fire USE HISTORY: pop: %d cell %d syn: %d new str: %lf\n" ,S.stepnum,pn, cn,lsyn_num,lsyn->lrn_strength);
-               fflush(stdout);}
-            }
+  for (bn = 0; bn < pr->block_count; bn++)
+  {
+    Target *target = targets + pr->block[bn].tidx0;
+    for (tidx = 0; tidx < pr->block[bn].count; tidx++, ++target)
+      fiber_terminal (target->syn, target->delay, target->strength, fn);
+  }
+}
 
-            // if cell fired but no pending input events, unlearn
-            if (!have_history)
-            {
-               delta = lsyn->lrnStrDelta * (fabs(lsyn->lrnStrMax - lsyn->lrn_strength));
-               lsyn->lrn_strength -= delta;
-               if (lsyn->lrnStrDelta >= 0)
-               {
-                  if (lsyn->lrn_strength < lsyn->initial_strength)
-                     lsyn->lrn_strength = lsyn->initial_strength;
-               }
-               else
-               {
-                  if (lsyn->lrn_strength > lsyn->initial_strength)
-                     lsyn->lrn_strength = lsyn->initial_strength;
-               }
-               {if(Debug)printf("tick: %d cell fire NO HISTORY pop: %d cell %d syn %d new str: %lf\n",S.stepnum,pn,cn,lsyn_num,lsyn->lrn_strength);}
-               fflush(stdout);
-            }
-         }
-         if (p->pop_subtype == BURSTER_POP) 
-         {
-           Vm = ((11.085 * Gk) - 6.5825) * Gk + p->Vreset;
-           Gk += p->delta_h - .5 * 0.0037 * Gk;
-         }
-       }
-       c->Vm = Vm; // remember these for next time around the loop
-       c->Gk = Gk;
+// The same, reading the packed CSR arrays from terminal t0 on.
+static inline void
+deliver_cell_csr (Csr *csr, size_t t0, Projection *pr, int cn)
+{
+  int bn;
+  size_t t, t1;
+
+  for (bn = 0; bn < pr->block_count; bn++)
+  {
+    t = t0 + pr->block[bn].tidx0;
+    t1 = t + pr->block[bn].count;
+    for (; t < t1; t++)
+      if (csr->syn[t] >= 0)
+        cell_terminal (csr->syn_pool + csr->syn[t], csr->delay[t], csr->strength[t], cn);
+  }
+}
+
+static inline void
+deliver_fiber_csr (Csr *csr, size_t t0, Projection *pr, int fn)
+{
+  int bn;
+  size_t t, t1;
+
+  for (bn = 0; bn < pr->block_count; bn++)
+  {
+    t = t0 + pr->block[bn].tidx0;
+    t1 = t + pr->block[bn].count;
+    for (; t < t1; t++)
+      if (csr->syn[t] >= 0)
+        fiber_terminal (csr->syn_pool + csr->syn[t], csr->delay[t], csr->strength[t], fn);
+  }
+}
+
+// Everything that lands in one target pop this step, in firing order.
+static void
+deliver_task (int tcpidx, void *arg)
+{
+  Inputs *in = inputs + tcpidx;
+  Csr *csr = CSR (&S.net);
+  int n, k, f;
+
+  (void) arg;
+  for (n = 0; n < in->proj_count; n++)
+  {
+    Projection *pr = in->proj + n;
+    if (pr->src < S.net.cellpop_count)
+    {
+      CellPop *p = S.net.cellpop + pr->src;
+      for (k = pop_chunk0[pr->src]; k < pop_chunk0[pr->src + 1]; k++)
+        for (f = 0; f < chunk[k].fired_count; f++)
+        {
+          int cn = chunk[k].fired[f];
+          if (csr)
+            deliver_cell_csr (csr, csr->off[csr->cell_base[pr->src] + cn], pr, cn);
+          else
+            deliver_cell (p->cell[cn].target, pr, cn);
+          if (pr->src == tcpidx)
+            reward_cell (tcpidx, cn);
+        }
+    }
+    else
+    {
+      int fpn = pr->src - S.net.cellpop_count;
+      FiberPop *p = S.net.fiberpop + fpn;
+      for (f = 0; f < fib_fired_count[fpn]; f++)
+      {
+        int fn = fib_fired[fpn][f];
+        if (csr)
+          deliver_fiber_csr (csr, csr->off[csr->fiber_base[fpn] + fn], pr, fn);
+        else
+          deliver_fiber (p->fiber[fn].target, pr, fn);
+      }
+    }
+  }
+}
+
+static void
+deliver_spikes (void)
+{
+  pool_run (deliver_task, NULL, S.net.cellpop_count);
+}
+
+// Fold this step's q slot into G for the input synapses of a chunk of cells.
+static void
+decay_cells (CellChunk *ch)
+{
+  CellPop *p = S.net.cellpop + ch->pn;
+  int cn;
+
+  if (!S.ispresynaptic) 
+  {
+    SynState *ss = SYNSTATE (p);
+    int k0 = ss->syn_off[ch->cn0], k1 = ss->syn_off[ch->cn1];
+    if(Debug){
+      for (int k = k0; k < k1; k++)
+      {
+        printf("step: %d ", S.stepnum);
+        if (ss->sd.q[k][ss->sd.qpos[k]])
+           printf("Cell Using slot %d %.2lf\n", ss->sd.qpos[k], ss->sd.q[k][ss->sd.qpos[k]]);
+        else
+           printf(" Cell Delay slot %d\n", ss->sd.qpos[k]);
+      }
+    }
+     // this is where the q array values are used
+    syn_decay.decay (&ss->sd, k0, k1);
+    synstate_sums (p, ch->cn0, ch->cn1);
+    return;
+  }
+  for (cn = ch->cn0; cn < ch->cn1; cn++) 
+  {
+    Cell *c = p->cell + cn;
+    int sidx;
+
+      // Walk through the syn list. For normal type, if using pre/post
+      // synaptic modifiers, apply any that belong to current normal syn
+    for (sidx = 0; sidx < c->syn_count; ++sidx) 
+    {
+      Syn *norm, *pre = 0, *post = 0;
+      float *norm_q;
+      int type_of_syn = c->syn[sidx].syntype;
+      if (type_of_syn == SYN_PRE || type_of_syn == SYN_POST)
+        continue;
+      norm = c->syn + sidx;
+      norm_q = norm->q + S.stepnum % norm->q_count;
+        // pre and/or post items associated with current normal
+      if (norm->pre >= 0)
+        pre = c->syn + norm->pre;
+      if (norm->post >= 0)
+        post = c->syn + norm->post;
+      if (pre) 
+      {
+        float *pre_q = pre->q + S.stepnum % pre->q_count;
+        double G = pre->G;
+        norm_q[0] *= G;
+        G = (G - 1) * pre->DCS + 1;
+        if (pre_q[0]  < 1) 
+           G *= (double)pre_q[0];
+        else
+           G += (double)pre_q[0] - 1;
+        pre_q[0] = 1;
+        pre->G = G;
+      }
+      norm->G = (double)norm->G * norm->DCS + norm_q[0];
+      norm_q[0] = 0;
+      if (post) 
+      {
+        float *post_q = post->q + S.stepnum % post->q_count;
+        double G = post->G;
+        G = (G - 1) * post->DCS + 1;
+        if (post_q[0] < 1)
+          G *= (double)post_q[0];
+        else
+          G += (double)post_q[0] - 1;
+        post_q[0] = 1;
+        post->G = G;
+      }
+    }
+  }
+}
+
+static void
+decay_task (int task, void *arg)
+{
+  (void) arg;
+  decay_cells (chunk + task);
+}
+
+static void
+decay_all (void)
+{
+  int pn;
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+    if (SYNSTATE (S.net.cellpop + pn))
+      synstate_sync (S.net.cellpop + pn, S.stepnum);
+  pool_run (decay_task, NULL, chunk_count);
+}
+
+static void
+print_phase_times (void)
+{
+  double total = 0;
+  int ph;
+
+  for (ph = 0; ph < PH_COUNT; ph++)
+    total += phase_time[ph];
+  fprintf (stdout, "Step timing for %d steps, %ld spikes, %d thread%s:\n",
+           S.stepnum, spike_total, pool_size (), pool_size () > 1 ? "s" : "");
+  for (ph = 0; ph < PH_COUNT; ph++)
+    fprintf (stdout, "  %-12s %10.3f s  %5.1f%%\n", phase_name[ph], phase_time[ph],
+             total > 0 ? 100 * phase_time[ph] / total : 0);
+  fprintf (stdout, "  %-12s %10.3f s\n", "total", total);
+  if (lung_thread_flag && check_lung_used ())
+    fprintf (stdout, "  lung ran on its own thread, the cell update waited %.3f s for it\n",
+             lung_thread_waited ());
+  if (write_bdt)
+  {
+    long events;
+    double sec;
+    bdt_stats (&events, &sec);
+    fprintf (stdout, "  bdt/edt: %ld events, %.0f events/sec of run time, %.3f s formatting and writing\n",
+             events, total > 0 ? events / total : 0, sec);
+  }
+}
+
+// Rolling spike counts for the pop rate plots, indexed by plot, and the
+// analog pop total. Out here for the checkpoints.
+static struct {int spkcntcnt; int sum; int *spkcntlst;} *pop_plot;
+static int pop_plot_size;
+static int nanlgtot, nanlgcnt, nanlglst;
+
+/* Checkpoints (simrun --checkpoint and --resume).  A checkpoint is a
+   network image, see netimage.h, taken with the cell and synapse state
+   put back in the Cell and Syn records, so the image has them along with
+   the q rings, fiber states and the per pop seeds and stimulus times.
+   Everything else the run carries from one step to the next goes in the
+   image's state block, written and read here in the same order.
+
+   Checkpoints are only taken at the end of a 100 step wave block, when
+   simoutsned has no block half done and the text wave file of the block
+   has been closed.  The bdt/edt and wave files are flushed, and their
+   lengths saved; a resumed run cuts them back to that and goes on.
+*/
+#define CKPT_VERSION 2
+
+extern char *checkpoint_name;
+extern char *resume_name;
+extern int checkpoint_steps;
+extern double checkpoint_secs;
+extern uint64_t input_key;
+
+typedef struct
+{
+  char *data;
+  size_t size;
+  size_t used;
+} CkptBuf;
+
+static int ckpt_step;       // step of the last checkpoint, or the start
+static double ckpt_time;
+
+static void
+ckpt_put (CkptBuf *b, const void *p, size_t n)
+{
+  if (b->used + n > b->size)
+  {
+    b->size = MAX (2 * b->size, b->used + n + 4096);
+    TREALLOC (b->data, b->size);
+  }
+  memcpy (b->data + b->used, p, n);
+  b->used += n;
+}
+
+static void
+ckpt_fail (const char *why)
+{
+  fprintf (stdout, "SIMRUN: cannot resume from %s: %s\n", resume_name, why);
+  exit (1);
+}
+
+static void
+ckpt_get (CkptBuf *b, void *p, size_t n)
+{
+  if (b->used + n > b->size)
+    ckpt_fail ("the checkpoint is cut short");
+  memcpy (p, b->data + b->used, n);
+  b->used += n;
+}
+
+#define CKPT_PUT(b, v) ckpt_put ((b), &(v), sizeof (v))
+#define CKPT_GET(b, v) ckpt_get ((b), &(v), sizeof (v))
+
+// Called at the end of step S.stepnum.
+static bool
+checkpoint_due (void)
+{
+  int done = S.stepnum + 1;
+
+  if (!checkpoint_name || done % WAVE_BLOCK_STEPS || done >= S.step_count)
+    return false;
+  if (checkpoint_steps)
+    return done - ckpt_step >= checkpoint_steps;
+  return now_sec () - ckpt_time >= checkpoint_secs;
+}
+
+static void
+checkpoint_save (bool lung_is_used)
+{
+  CkptBuf b = {0};
+  int pn, n, k, stepnum = S.stepnum + 1;
+  int head[7] = {CKPT_VERSION, S.net.cellpop_count, S.net.fiberpop_count,
+                 S.plot_count, lung_is_used, lrn_wheel_count, fiber_skip_flag};
+  int64_t off;
+
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    cellstate_scatter (S.net.cellpop + pn);
+    synstate_scatter (S.net.cellpop + pn);
+  }
+  CKPT_PUT (&b, head);
+  CKPT_PUT (&b, stepnum);
+  CKPT_PUT (&b, S.seed);
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    ExternalPos pos = {0};
+    int have_pos = getExternalPos (fp, &pos);
+    CKPT_PUT (&b, fp->infsed);
+    CKPT_PUT (&b, fp->probability);
+    CKPT_PUT (&b, fp->prev_signal);
+    CKPT_PUT (&b, have_pos);
+    CKPT_PUT (&b, pos);
+  }
+  if (lung_is_used)
+  {
+    size_t size = lung_get_state (0);
+    char *ls;
+    TMALLOC (ls, size);
+    lung_get_state (ls);
+    CKPT_PUT (&b, size);
+    ckpt_put (&b, ls, size);
+    CKPT_PUT (&b, state);
+    free (ls);
+  }
+  ckpt_put (&b, pop_fired, (S.net.cellpop_count + S.net.fiberpop_count) * sizeof *pop_fired);
+  if (fiber_skip_flag)
+    ckpt_put (&b, fib_skip, S.net.fiberpop_count * sizeof *fib_skip);
+
+    // a learning event's synapse is saved as its cell and its place there
+  for (pn = 0; pn < lrn_wheel_count; pn++)
+  {
+    LrnWheel *w = lrn_wheel + pn;
+    int mask = w->slot ? w->mask : -1;
+    CKPT_PUT (&b, mask);
+    for (n = 0; n <= mask; n++)
+    {
+      LrnSlot *sl = w->slot + n;
+      CKPT_PUT (&b, sl->count);
+      for (k = 0; k < sl->count; k++)
+      {
+        Syn *syn = sl->ev[k].syn;
+        int ev[3] = {syn->cidx, syn - S.net.cellpop[pn].cell[syn->cidx].syn, sl->ev[k].what};
+        CKPT_PUT (&b, ev);
+      }
+    }
+  }
+
+  CKPT_PUT (&b, pop_plot_size);
+  for (n = 0; n < pop_plot_size; n++)
+  {
+    CKPT_PUT (&b, pop_plot[n].spkcntcnt);
+    CKPT_PUT (&b, pop_plot[n].sum);
+    if (pop_plot[n].spkcntlst)
+      ckpt_put (&b, pop_plot[n].spkcntlst, pop_plot[n].spkcntcnt * sizeof *pop_plot[n].spkcntlst);
+  }
+  CKPT_PUT (&b, nanlgtot);
+  CKPT_PUT (&b, nanlgcnt);
+  CKPT_PUT (&b, nanlglst);
+  CKPT_PUT (&b, flctr);
+  CKPT_PUT (&b, blkctr);
+
+  off = wave_out && wave_out->fp ? ftello (wave_out->fp) : -1;
+  CKPT_PUT (&b, off);
+  off = -1;
+  if (S.ofile)   // --smr alone still writes its wildcard cells here
+  {
+    bdt_flush ();
+    fflush (S.ofile);
+    off = ftello (S.ofile);
+  }
+  CKPT_PUT (&b, off);
+
+  net_image_save_state (checkpoint_name, input_key, b.data, b.used);
+  free (b.data);
+  ckpt_step = stepnum;
+  ckpt_time = now_sec ();
+}
+
+// Pick up where the run that saved the checkpoint read_sim loaded left
+// off. Called after the first lung () and before the first step.
+static void
+checkpoint_resume (bool lung_is_used)
+{
+  CkptBuf b = {0};
+  int pn, n, k, count;
+  int head[7], want[7] = {CKPT_VERSION, S.net.cellpop_count, S.net.fiberpop_count,
+                          S.plot_count, lung_is_used, 0, fiber_skip_flag};
+  int64_t off;
+  size_t size;
+
+  if ((b.data = (char *) net_image_state (&size)) == 0)
+    ckpt_fail ("it is a network image, not a checkpoint");
+  b.size = size;
+  CKPT_GET (&b, head);
+  want[5] = head[5];
+  if (memcmp (head, want, sizeof head))
+    ckpt_fail ("it was saved by another version or with another script or options");
+  CKPT_GET (&b, S.stepnum);
+  CKPT_GET (&b, S.seed);
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+  {
+    FiberPop *fp = S.net.fiberpop + pn;
+    ExternalPos pos;
+    int have_pos;
+    CKPT_GET (&b, fp->infsed);
+    CKPT_GET (&b, fp->probability);
+    CKPT_GET (&b, fp->prev_signal);
+    CKPT_GET (&b, have_pos);
+    CKPT_GET (&b, pos);
+    if (have_pos && !setExternalPos (fp, &pos))
+      ckpt_fail ("an afferent source could not be opened");
+  }
+  if (lung_is_used)
+  {
+    CKPT_GET (&b, size);
+    if (b.used + size > b.size || !lung_set_state (b.data + b.used, size))
+      ckpt_fail ("the lung state does not fit this simrun");
+    b.used += size;
+    CKPT_GET (&b, state);
+  }
+
+    // build_lrn_wheels counts the learning terminals on each synapse again
+  for (pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    CellPop *cp = S.net.cellpop + pn;
+    for (n = 0; n < cp->cell_count; n++)
+      for (k = 0; k < cp->cell[n].syn_count; k++)
+        cp->cell[n].syn[k].lrn_rate = 0;
+  }
+  build_tables ();
+  ckpt_get (&b, pop_fired, (S.net.cellpop_count + S.net.fiberpop_count) * sizeof *pop_fired);
+  pop_fired_net = S.net.cellpop;
+  if (fiber_skip_flag)
+    ckpt_get (&b, fib_skip, S.net.fiberpop_count * sizeof *fib_skip);
+    // the fibers that fired in the saved step are not known, --fiber-skip
+    // only clears those
+  for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    for (n = 0; n < S.net.fiberpop[pn].fiber_count; n++)
+      S.net.fiberpop[pn].fiber[n].state = 0;
+
+  if (head[5] != lrn_wheel_count)
+    ckpt_fail ("its learning synapses are not those of this network");
+  for (pn = 0; pn < lrn_wheel_count; pn++)
+  {
+    LrnWheel *w = lrn_wheel + pn;
+    CellPop *cp = S.net.cellpop + pn;
+    int mask;
+    CKPT_GET (&b, mask);
+    if (mask != (w->slot ? w->mask : -1))
+      ckpt_fail ("its learning synapses are not those of this network");
+    for (n = 0; n <= mask; n++)
+    {
+      CKPT_GET (&b, count);
+      for (k = 0; k < count; k++)
+      {
+        int ev[3];
+        CKPT_GET (&b, ev);
+        if (ev[0] < 0 || ev[0] >= cp->cell_count || ev[1] < 0 || ev[1] >= cp->cell[ev[0]].syn_count)
+          ckpt_fail ("its learning synapses are not those of this network");
+        lrn_event (w, n, cp->cell[ev[0]].syn + ev[1], ev[2]);
       }
     }
+  }
+
+  CKPT_GET (&b, count);
+  if (count > pop_plot_size)
+  {
+    TREALLOC (pop_plot, count);
+    memset (pop_plot + pop_plot_size, 0, (count - pop_plot_size) * sizeof *pop_plot);
+    pop_plot_size = count;
+  }
+  for (n = 0; n < count; n++)
+  {
+    CKPT_GET (&b, pop_plot[n].spkcntcnt);
+    CKPT_GET (&b, pop_plot[n].sum);
+    free (pop_plot[n].spkcntlst);
+    pop_plot[n].spkcntlst = 0;
+    if (pop_plot[n].spkcntcnt > 0)
+    {
+      TMALLOC (pop_plot[n].spkcntlst, pop_plot[n].spkcntcnt);
+      ckpt_get (&b, pop_plot[n].spkcntlst, pop_plot[n].spkcntcnt * sizeof *pop_plot[n].spkcntlst);
+    }
+  }
+  CKPT_GET (&b, nanlgtot);
+  CKPT_GET (&b, nanlgcnt);
+  CKPT_GET (&b, nanlglst);
+  CKPT_GET (&b, flctr);
+  CKPT_GET (&b, blkctr);
+
+  CKPT_GET (&b, off);
+  if (off >= 0 && write_waves && !have_data_socket() && !noWaveFiles && !text_waves)
+  {
+    char *name;
+    if (asprintf (&name, "%swave.%02d.bin", outPath, S.spawn_number) == -1) exit (1);
+    if ((wave_out = wave_append (name, off)) == 0)
+      ckpt_fail ("the wave file is not the one it was writing");
+    free (name);
+  }
+  CKPT_GET (&b, off);
+  if (off >= 0)
+  {
+    if (!S.ofile || fseeko (S.ofile, off, SEEK_SET) || ftruncate (fileno (S.ofile), off))
+      ckpt_fail ("the bdt/edt file is not the one it was writing");
+  }
+
+  fprintf (stdout, "SIMRUN: resuming at step %d of %d from %s\n", S.stepnum, S.step_count, resume_name);
+  fflush (stdout);
+}
+
+/* This is the simulation calculation engine.
+*/
+void simloop ()
+{
+  int nf;
+  noise_decay = exp (-S.step / 1.5);
+  S.seed = 314159;
+  double ticks_in_sec = ceil(1000.0/S.step);
+  char msg[2048]={0};
+  bool lung_is_used = check_lung_used ();
+  bool doFibCalc, skipFib;
+  MotorPops m;
+  double signal;
+  if (Debug)
+    fprintf (stdout, "\n%s line %d, cellpop_count %d\n", __FILE__, __LINE__,
+             S.net.cellpop_count);
+
+  if (lung_is_used) 
+  {
+    if (!S.phrenic_equation || S.phrenic_equation[0] == 0)
+      S.phrenic_equation = strdup ("P0/100");
+    if (!S.lumbar_equation || S.lumbar_equation[0] == 0)
+      S.lumbar_equation = strdup ("L0/20");
+    m = get_motor_pops ();
+
+    fprintf(stdout,"motor pops are: phrenic");
+    for (int i = 0; i < m.phrenic.count; i++)
+      if (m.phrenic.num[i] >= 0)
+        fprintf(stdout," %d", m.phrenic.num[i] + 1);
+    fprintf(stdout,", abdominal");
+    for (int i = 0; i < m.abdominal.count; i++)
+      if (m.abdominal.num[i] >= 0)
+        fprintf(stdout," %d", m.abdominal.num[i] + 1);
+    fprintf (stdout,", elm/ta %d, ilm/pca %d", m.ta.num[0] + 1, m.pca.num[0] + 1);
+#ifdef INTERCOSTALS
+    fprintf(stdout,", ext %d, int %d", m.ta.num[0] + 1, m.pca.num[0] + 1, m.inspic.num[0] + 1, m.expic.num[0] + 1);
+#endif
+    fprintf(stdout,"\n");
+    
+    state = lung ((Motor) {0,0,0,0}, S.step);
+    if (lung_thread_flag)
+    {
+      lung_thread_start ();
+      fprintf(stdout,"Running the lung model on its own thread\n");
+    }
+  }
+  else 
+     fprintf(stdout,"Lung model is not used\n");
+  pool_start (num_threads);
+  if (pool_size () > 1)
+     fprintf(stdout,"Using %d threads for the cell update\n", pool_size ());
+  fprintf(stdout,"Using the %s synaptic decay kernel\n", syn_decay_init ());
+  if (fiber_skip_flag)
+    fprintf(stdout,"Fibers fire by skipping to the next one that fires\n");
+  if (resume_name)
+    checkpoint_resume (lung_is_used);
+  ckpt_step = S.stepnum;
+  ckpt_time = now_sec ();
+  if (Debug)
+  {
+     fprintf (stdout, "\n%s line %d, cellpop_count %d\n", __FILE__, __LINE__,
+               S.net.cellpop_count);
+     fprintf (stdout, "\n%s line %d\n", __FILE__, __LINE__);
+  }
+
+   // MAIN LOOP, work until done or get a TERM signal or get a quit command
+  for ( ; S.stepnum < S.step_count && !sigterm; S.stepnum++) 
+  {
+    int pn;
+    static time_t now, last_time = 0;
+    double mark = now_sec ();
+
+    Motor mr;
+    State next_state = {0};
+    
+    if (lung_is_used) 
+    {
+      mr.phrenic = mup_eval (m.phrenic, S.phrenic_equation, &S.pe_evaluator);
+      mr.abdominal = mup_eval (m.abdominal, S.lumbar_equation, &S.le_evaluator);
+      
+      // JAH: lma (laryngeal muscle activation) is defined in lung.c as pca-ta and goes from 1 (open) to -1 (closed)
+      mr.pca = mup_eval (m.pca, 0, 0);
+      mr.ta = mup_eval (m.ta, 0, 0);
+#ifdef INTERCOSTALS
+      mr.expic = mup_eval (m.expic, 0, 0);
+      mr.inspic = mup_eval (m.inspic, 0, 0);
+#endif
+     // printf("phrenic: %f \n", mr.phrenic);
+        // next_state is not used until the next step, so the lung thread
+        // can work on it while the cells are updated
+      if (lung_thread_flag)
+        lung_thread_post (mr, S.step);
+      else
+        next_state   = lung (mr, S.step);
+    }
+    phase_done (PH_LUNG, &mark);
+
+    if (have_cmd_socket() && (S.stepnum % (int) ticks_in_sec) == 0)
+    {
+        snprintf(msg,sizeof(msg)-1,"TIME\n%d\n", (int)(S.stepnum/ticks_in_sec));
+        sendMsg(msg); // progress rpt for simbuild 
+    }
+    if ((now = time (0)) > last_time)
+	    global_last_time = last_time = now;
+
+    phase_done (PH_OTHER, &mark);
+
+    nf = integrate_all ();
+    phase_done (PH_INTEGRATE, &mark);
+    record_cells ();
+    phase_done (PH_RECORD, &mark);
+
 //edit here to continue equation comments
    for (pn = 0; pn < S.net.fiberpop_count; pn++)      // fibers
    {
@@ -1273,8 +2407,12 @@ void simloop ()
       skipFib = false;
       doFibCalc = false;
       int fn;
-      int widx;
       signal = 0.0;
+        // with --fiber-skip only the fibers that fired are cleared
+      if (fiber_skip_flag)
+        for (fn = 0; fn < fib_fired_count[pn]; fn++)
+          p->fiber[fib_fired[pn][fn]].state = 0;
+      fib_fired_count[pn] = 0;
       if (S.stepnum >= p->start - 1 && S.stepnum < p->stop - 1)
       {
         if (p->pop_subtype == ELECTRIC_STIM)
@@ -1293,7 +2431,9 @@ void simloop ()
                 case STIM_FUZZY:
                    p->next_fixed += ticks_in_sec / p->frequency;
                    int fuzz_min = -(((p->fuzzy_range/2)/S.step));
-                   int fuzz = (int)(ran(&p->infsed) * (p->fuzzy_range/S.step));
+                   double ranval = rng_type == RNG_PHILOX ? philox_ran (p->infsed, PHILOX_STIM, pn, S.stepnum, 0)
+                                                          : ran(&p->infsed);
+                   int fuzz = (int)(ranval * (p->fuzzy_range/S.step));
                    int next_targ = fuzz_min + fuzz;
                    p->next_stim = p->next_fixed + next_targ;
                    break;
@@ -1329,85 +2469,31 @@ void simloop ()
            p->pop_subtype = FIBER;    // assume normal fiber
 
 
+        if (fiber_skip_flag && p->pop_subtype != ELECTRIC_STIM)
+        {
+          if (p->fiber_count && p->fiber[0].signal != signal)
+            for (fn = 0; fn < p->fiber_count; fn++)
+              p->fiber[fn].signal = signal; // same for all
+          fire_fibers_skip (p, pn);
+          continue;
+        }
+        if (rng_type == RNG_PHILOX)
+          philox_fill (p->infsed, PHILOX_FIBER, pn, S.stepnum, 0, p->fiber_count, fib_ran);
         for (fn = 0; fn < p->fiber_count; fn++) 
         {
-          int tidx;
           Fiber *f = p->fiber + fn;
           f->state = 0;
           f->signal = signal; // same for all 
-          double ranval = ran(&p->infsed);
+          double ranval = rng_type == RNG_PHILOX ? fib_ran[fn] : ran(&p->infsed);
           //  force estim evt  or  normal/aff, use prob
           if (doFibCalc        || (!skipFib && ranval <= p->probability))
           {
-            if(Debug){printf("Fiber fire\n");}
-            f->state = 1; // an event occurred
+            fire_fiber (p, pn, fn);
             doFibCalc = false;
-            if (write_bdt)
-            {
-              for (widx = 0; widx < S.fwrit_count; widx++)
-                if (S.fwrit[widx].pop == pn + 1 && S.fwrit[widx].cell == fn + 1)
-                {
-                  fprintf (S.ofile, fmt, 100+ S.cwrit_count + widx + 1, (int)((S.stepnum + 1) * S.step / dt_step));
-                  fprintf (S.ofile, "%c",0x0a);
-                }
-            }
-            if (write_smr)
-            {
-              for (widx = 0; widx < S.fwrit_count; widx++)
-                if (S.fwrit[widx].pop == pn + 1 && S.fwrit[widx].cell == fn + 1)
-                {
-                  writeSpike(100+ S.cwrit_count + widx + 1, (int)((S.stepnum + 1) * S.step / dt_step));
-                }
-            }
-             // Targets means terminals. The starting origin for the q delay 
-             // arrays are randomly set during build_network.
-             // Fiber fired. Increase strength value in the q arrays at the
-             // current index determined by the index expression below.
-             // In effect, potentials are stored in a delay array.
-// ** Only the sender knows when it fires, so it has to add  
-// ** history to the receiver's history list.
-// ** Only the receiver knows when it fires, so it has to 
-// ** do the searching and rewarding. 
-// ** 
-// ** 
-
-            Target *target = f->target;
-            for (tidx = 0; tidx < f->target_count; tidx++, ++target)
-            {
-              Syn *syn = target->syn;
-              int type_of_syn = S.net.syntype[syn->stidx].SYN_TYPE;
-                // if NORM, one calc, LEARN, also update history, 
-                // both pre and post get same calc, depending on sign
-               switch (type_of_syn)
-               {
-                  case SYN_NORM:
-                     syn->q[(S.stepnum + target->delay) % syn->q_count] += target->strength;
-                    break;
-                  case SYN_LEARN:
-                    syn->q[(S.stepnum + target->delay) % syn->q_count] += target->syn->lrn_strength;
-                    updateLrnSyns(target,syn,fn);
-                     break;
-                  case SYN_PRE:
-                  case SYN_POST: // == 1 has no effect
-                     if (target->strength < 1)
-                        syn->q[(S.stepnum + target->delay) % syn->q_count] *= target->strength;
-                      else  if (target->strength > 1)
-                         syn->q[(S.stepnum + target->delay) % syn->q_count] += target->strength - 1.;
-                      break;
-                  default:
-                      printf("Unknown synapse type %d\n",type_of_syn);
-                      break;
-                }
-               if(Debug){printf("  Fiber: cpop %d  cell %d  syntype %d delay: %d index: %d val: %.2lf\n", 
-                        syn->cpidx, syn->cidx, syn->stidx,
-                        target->delay,
-                        (S.stepnum + target->delay) % syn->q_count,
-                        syn->q[(S.stepnum + target->delay) % syn->q_count]);}
-             }
-           }
-         }
+          }
+        }
       }
-      else
+      else if (!fiber_skip_flag || (p->fiber_count && p->fiber[0].signal != 0))
       {
          // If the last state was 1, it persists. Make sure it is zero.
         for (fn = 0; fn < p->fiber_count; fn++) 
@@ -1417,101 +2503,24 @@ void simloop ()
         }
       }
    }
+    for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    {
+      pop_fired[S.net.cellpop_count + pn] = fib_fired_count[pn];
+      spike_total += fib_fired_count[pn];
+    }
+    phase_done (PH_FIBERS, &mark);
+
         // Cells and Fibers states updated for this tick.
         // This appears to propogate action potentials 
         // down the axons by updating the q array of each axon/synapse
-    for (pn = 0; pn < S.net.cellpop_count; pn++) 
-    {
-      CellPop *p = S.net.cellpop + pn;
-      int cn;
-      for (cn = 0; cn < p->cell_count; cn++) 
-      {
-        Cell *c = p->cell + cn;
-        int sidx;
-        if (!S.ispresynaptic) 
-        {
-          for (sidx = 0; sidx < c->syn_count; sidx++) 
-          {
-            Syn *s = c->syn + sidx;
-            if(Debug){
-               printf("step: %d ", S.stepnum);
-               if (s->q[S.stepnum % s->q_count])
-                  printf("Cell Using slot %d %.2lf\n", S.stepnum % s->q_count,
-                                                       s->q[S.stepnum % s->q_count]);
-               else
-                  printf(" Cell Delay slot %d\n", S.stepnum % s->q_count);
-            }
-
-             // this is where the q array values are used
-            s->G = (double)s->G * s->DCS + s->q[S.stepnum % s->q_count];
-            s->q[S.stepnum % s->q_count] = 0;
-          }
-        }
-        else 
-        {
-          int pp_idx;
-
-            // Walk through the syn list. For normal type, if using pre/post
-            // synaptic modifiers, look for any that belong to current normal syn
-          for (sidx = 0; sidx < c->syn_count; ++sidx) 
-          {
-            Syn *norm, *pre = 0, *post = 0;
-            float *norm_q;
-            int stidx = c->syn[sidx].stidx;
-            int type_of_syn=S.net.syntype[stidx].SYN_TYPE;
-            if (type_of_syn == SYN_PRE || type_of_syn == SYN_POST)
-              continue;
-            norm = c->syn + sidx;
-            norm_q = norm->q + S.stepnum % norm->q_count;
-            Syn *chk = c->syn;
-              // do we have a pre and/or post item associated with current normal?
-            for (pp_idx = 0; pp_idx < c->syn_count; ++pp_idx, ++chk) 
-            {
-               if (chk->synparent && chk->synparent == norm->stidx+1)
-               {
-                  if (chk->syntype == SYN_PRE)
-                     pre = chk;
-                  else if (chk->syntype == SYN_POST)
-                     post = chk;
-               }
-            }
-            if (pre) 
-            {
-              float *pre_q = pre->q + S.stepnum % pre->q_count;
-              double G = pre->G;
-              norm_q[0] *= G;
-              G = (G - 1) * pre->DCS + 1;
-              if (pre_q[0]  < 1) 
-                 G *= (double)pre_q[0];
-              else
-                 G += (double)pre_q[0] - 1;
-              pre_q[0] = 1;
-              pre->G = G;
-            }
-            norm->G = (double)norm->G * norm->DCS + norm_q[0];
-            norm_q[0] = 0;
-            if (post) 
-            {
-              float *post_q = post->q + S.stepnum % post->q_count;
-              double G = post->G;
-              G = (G - 1) * post->DCS + 1;
-              if (post_q[0] < 1)
-                G *= (double)post_q[0];
-              else
-                G += (double)post_q[0] - 1;
-              post_q[0] = 1;
-              post->G = G;
-            }
-          }
-        }
-      }
-    }
+    deliver_spikes ();
+    phase_done (PH_DELIVER, &mark);
+    decay_all ();
+    phase_done (PH_DECAY, &mark);
 
     if (S.outsned == 'e')   // save waveforms?
     {
-       int n, i, spike_count, mult;
-       static struct {int spkcntcnt; int sum; int *spkcntlst;} *pop_plot;
-       static int pop_plot_size;
+       int n, spike_count, mult;
          // pop summaries (if we have any) will need this. indexed by n, so
          // some not used.
        if (pop_plot_size < S.plot_count) {
@@ -1534,10 +2543,10 @@ void simloop ()
            case 1:
              if (c < S.net.cellpop[p].cell_count)
              {
-                S.plot[n].val    = S.net.cellpop[p].cell[c].Vm_prev;
+                S.plot[n].val    = CELLSTATE (&S.net.cellpop[p])->Vm_prev[c];
                 if (S.net.cellpop[p].pop_subtype == BURSTER_POP)   /* hybrid IF population */
                   S.plot[n].val += 50;
-                S.plot[n].spike = S.net.cellpop[p].cell[c].spike;
+                S.plot[n].spike = CELLSTATE (&S.net.cellpop[p])->spike[c];
              }
              else
                 S.plot[n].val =  S.plot[n].spike = 0;
@@ -1546,15 +2555,15 @@ void simloop ()
              if (c < S.net.cellpop[p].cell_count)
              {
                 if (S.net.cellpop[p].pop_subtype == BURSTER_POP)
-                  S.plot[n].val    = S.net.cellpop[p].cell[c].Gk * 60;
+                  S.plot[n].val    = CELLSTATE (&S.net.cellpop[p])->Gk[c] * 60;
                 else
-                  S.plot[n].val    = -20 + S.net.cellpop[p].cell[c].Gk * 10;
+                  S.plot[n].val    = -20 + CELLSTATE (&S.net.cellpop[p])->Gk[c] * 10;
              }
              break;
            case 3:
              if (c < S.net.cellpop[p].cell_count)
              {
-                S.plot[n].val    = S.net.cellpop[p].cell[c].Thr;
+                S.plot[n].val    = CELLSTATE (&S.net.cellpop[p])->Thr[c];
                 if (S.net.cellpop[p].pop_subtype == BURSTER_POP)
                   S.plot[n].val += 50;
              }
@@ -1655,9 +2664,7 @@ void simloop ()
                  TCALLOC (pop_plot[n].spkcntlst, spkcntcnt);
                  pop_plot[n].spkcntcnt = spkcntcnt;
                }
-               spike_count = 0;
-               for (i = 0; i < S.net.fiberpop[p].fiber_count; i++)
-                 spike_count += S.net.fiberpop[p].fiber[i].state;
+               spike_count = pop_fired[S.net.cellpop_count + p];
                pop_plot[n].sum += spike_count - pop_plot[n].spkcntlst[sclidx];
                pop_plot[n].spkcntlst[sclidx] = spike_count;
                spikes_per_second_per_fiber = (pop_plot[n].sum / (spkcntcnt * S.step / 1000.0)
@@ -1686,9 +2693,7 @@ void simloop ()
                  TCALLOC (pop_plot[n].spkcntlst, spkcntcnt);
                  pop_plot[n].spkcntcnt = spkcntcnt;
                }
-               spike_count = 0;
-               for (i = 0; i < S.net.cellpop[p].cell_count; i++)
-                 spike_count += S.net.cellpop[p].cell[i].spike;
+               spike_count = pop_fired[p];
                pop_plot[n].sum += spike_count - pop_plot[n].spkcntlst[sclidx];
                pop_plot[n].spkcntlst[sclidx] = spike_count;
                spikes_per_second_per_cell = (pop_plot[n].sum / (spkcntcnt * S.step / 1000.0)
@@ -1703,7 +2708,6 @@ void simloop ()
 
      if (write_analog)
      {
-       static int nanlgtot, nanlgcnt, nanlglst;
        nanlgtot += nf;
        nanlgcnt++;
        if (nanlgcnt == 1 / S.step * S.nanlgrate)
@@ -1719,24 +2723,27 @@ void simloop ()
          int aval = S.nanlgid * 4096 + nval;
          int time = (int)((S.stepnum + 1) * S.step / dt_step);
          if (write_bdt)
-         {
-           fprintf (S.ofile, fmt, aval, time);
-           fprintf (S.ofile, "%c",0x0a);
-         }
+           bdt_event (aval, time);
          if (write_smr)
            writeWave(aval, time); 
          nanlgtot = 0;
          nanlgcnt = 0;
        }
      }
+     phase_done (PH_OUTPUT, &mark);
 
      if (haveLearn)
+        decayLearn();
+     chk_for_cmd();
+     phase_done (PH_OTHER, &mark);
+     if (lung_is_used && lung_thread_flag)
      {
-        decayLearnCells();
-        decayLearnFibers();
+       next_state = lung_thread_wait ();
+       phase_done (PH_LUNG, &mark);
      }
-     chk_for_cmd();
      state = next_state;
+     if (checkpoint_due ())
+       checkpoint_save (lung_is_used);
 
   } // END OF MAIN LOOP
 
@@ -1744,14 +2751,27 @@ void simloop ()
   if (have_cmd_socket())
     send(sock_fd,&msg,strlen(msg),0); // progress rpt for simbuild 
   fprintf(stdout,"simloop exited\n");
+  bdt_flush ();   // with --smr alone there are still the wildcard cells
+  print_phase_times ();
   fflush(stdout);
 
+  pool_stop ();
+  lung_thread_stop ();
+
+    // leave the final state where the .sim saver can find it
+  for (int pn = 0; pn < S.net.cellpop_count; pn++)
+  {
+    cellstate_scatter (S.net.cellpop + pn);
+    synstate_scatter (S.net.cellpop + pn);
+  }
+
   if (write_bdt)
   {
     fflush(S.ofile);
     fclose(S.ofile);
     add_IandE();
   }
+  wave_out_close ();
 
   if (have_data_socket())
     waitForDone();
@@ -31,12 +31,14 @@ This file is part of the USF Neural Simulator suite.
 #if defined Q_OS_WIN
 #include "lin2ms.h"
 #endif
+#include "wavefile.h"
 
 const char *argp_program_version = "simpickwave 1.0";
 const char *argp_program_bug_address = "<dshuman@hsc.usf.edu>";
 static char doc[] = "picks a waveform out of a specified set of wave.* files"
 "\vThe wave number for the -w option is the position in the wave.* file.\n"
-"The first position is 1, not 0.\n";
+"The first position is 1, not 0.  With -n, wave.NN.bin is read if it\n"
+"exists, otherwise the wave.NN.NNNN text files.\n";
 
 static char args_doc[] = "[FILE...]";
 
@@ -131,12 +133,42 @@ process_file (char *filename, FILE *f, int wave, int spikes)
   return 1;
 }
 
+static int
+process_binary (char *filename, int wave, int spikes)
+{
+  WaveFile *w;
+  int got, rec;
+
+  if ((w = wave_open (filename)) == 0) {
+    fprintf (stderr, "cannot open %s: %s\n", filename, strerror (errno));
+    return 0;
+  }
+  while ((got = wave_read_block (w)) > 0) {
+    if (wave < 1 || wave > w->plot_count)
+      continue;
+    for (rec = 0; rec < w->nrecs; rec++)
+      if (spikes)
+	printf ("%d\n", wave_spike (w, wave - 1, rec));
+      else
+	printf ("%g\n", wave_val (w, wave - 1, rec));
+  }
+  wave_free (w);
+  if (got < 0) {
+    fprintf (stderr, "%s is not a valid binary wave file\n", filename);
+    return 0;
+  }
+  return 1;
+}
+
 int
 process_filename (char *filename, struct arguments *arguments, int complain)
 {
   int ok;
   FILE *f;
 
+  if (strcmp (filename, "-") && wave_is_binary (filename))
+    return process_binary (filename, arguments->wave, arguments->spikes);
+
   if (strcmp (filename, "-") == 0) {
     while (1)
       if (process_file ("standard input", stdin, arguments->wave, arguments->spikes) == 0)
@@ -170,6 +202,12 @@ main (int argc, char **argv)
   argp_parse (&argp, argc, argv, 0, 0, &arguments);
   if (arguments.spawn >= 0) {
     int n, ok = 1;
+    if (asprintf (&filename, "wave.%02d.bin", arguments.spawn) == -1) exit (1);
+    if (access (filename, R_OK) == 0) {
+      process_binary (filename, arguments.wave, arguments.spikes);
+      ok = 0;
+    }
+    free (filename);
     for (n = 0; n <= 9999 && ok; n++) {
       if (asprintf (&filename, "wave.%02d.%04d", arguments.spawn, n) == -1) exit (1);
       ok = process_filename (filename, &arguments, n == 0);
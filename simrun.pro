@@ -58,7 +58,20 @@ SOURCES += read_sim.c \
            lin2ms.c \
            wavemarkers.c \
            simrun_wrap.cpp \
-           add_IandE.cpp
+           add_IandE.cpp \
+           cellstate.c \
+           csr.c \
+           arena.c \
+           threadpool.c \
+           syndecay.c \
+           philox.c \
+           wavefile.c \
+           bdtout.c \
+           wavesend.c \
+           lungthread.c \
+           sweep.c \
+           netimage.c \
+           adjexport.c
 
 HEADERS += simulator.h \
            util.h \
@@ -72,6 +85,19 @@ HEADERS += simulator.h \
            lin2ms.h \
            wavemarkers.h \
            simrun_wrap.h \
-           common_def.h
+           common_def.h \
+           cellstate.h \
+           csr.h \
+           arena.h \
+           threadpool.h \
+           syndecay.h \
+           philox.h \
+           wavefile.h \
+           bdtout.h \
+           wavesend.h \
+           lungthread.h \
+           sweep.h \
+           netimage.h \
+           adjexport.h
 
 
@@ -27,6 +27,10 @@ This file is part of the USF Neural Simulator suite.
 #include <sstream>
 #include <ctime>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "simulator.h"
 #include "s64.h"
@@ -59,13 +63,151 @@ class Interval
       Interval();
 };
 
+/* Block-buffered reader for the afferent wave channel.
+
+   The simulator wants one sample per call, and a ReadWave call per sample is
+   slow. We keep a block of contiguous samples and answer from it. While the
+   simulator is using one block, a thread reads the next one. Only that thread
+   uses the file while it runs, we wait for it before touching the file
+   again.
+
+   read() has the same result as a one sample ReadWave: the first sample at or
+   after from, if it is before upto. A block starts at the first sample at or
+   after the time it was read from and stops at a gap or the end of the data,
+   so a time past the end of a block that is not in the next one is read
+   again from that time.
+*/
+class WaveReader
+{
+   public:
+      WaveReader(CSon64File *f, TChanNum c, TSTime64 intv) : file(f), chan(c),
+         divide(intv), maxTime(f->ChanMaxTime(c) + 1), busy(false), stop(false)
+      {
+         cur.data.resize(BLOCK);
+         next.data.resize(BLOCK);
+         worker = thread(&WaveReader::run, this);
+      }
+      ~WaveReader()
+      {
+         {
+            lock_guard<mutex> lock(mtx);
+            stop = true;
+         }
+         cv.notify_all();
+         worker.join();
+      }
+
+      int read(float *samp, TSTime64 from, TSTime64 upto, TSTime64 &first)
+      {
+         if (!cur.valid || !cur.has(from))
+         {
+            wait();
+            if (next.valid && next.has(from))
+               swap(cur, next);
+            else
+               fill(cur, from);
+            prefetch();
+         }
+         TSTime64 at = cur.at(from);
+         if (at < 0 || at >= upto)
+            return 0;
+         *samp = cur.data[(at - cur.first) / divide];
+         first = at;
+         return 1;
+      }
+
+   private:
+      static const int BLOCK = 65536;
+      struct Block {
+         bool valid = false;
+         TSTime64 from = 0;   // asked for
+         TSTime64 first = 0;  // time of data[0]
+         int n = 0;
+         TSTime64 divide = 1;
+         vector<float> data;
+         TSTime64 last() const {return first + (n - 1) * divide;}
+          // Is the first sample at or after t in this block, or is there none?
+         bool has(TSTime64 t) const {return t >= from && (n == 0 || t <= last());}
+          // Time of that sample, -1 if none.
+         TSTime64 at(TSTime64 t) const
+         {
+            if (n == 0)
+               return -1;
+            if (t <= first)
+               return first;
+            return first + (t - first + divide - 1) / divide * divide;
+         }
+      };
+
+      void fill(Block &b, TSTime64 from)
+      {
+         TSTime64 got = 0;
+         int res = 0;
+         if (from < maxTime)
+            res = file->ReadWave(chan, b.data.data(), BLOCK, from, maxTime, got);
+         b.from = from;
+         b.first = got;
+         b.n = res > 0 ? res : 0;
+         b.divide = divide;
+         b.valid = true;
+      }
+
+       // Start reading the block after the current one.
+      void prefetch()
+      {
+         if (cur.n == 0)
+            return;
+         {
+            lock_guard<mutex> lock(mtx);
+            next.valid = false;
+            nextFrom = cur.last() + 1;
+            busy = true;
+         }
+         cv.notify_all();
+      }
+
+      void wait()
+      {
+         unique_lock<mutex> lock(mtx);
+         cv.wait(lock, [this] {return !busy;});
+      }
+
+      void run()
+      {
+         unique_lock<mutex> lock(mtx);
+         while (true)
+         {
+            cv.wait(lock, [this] {return busy || stop;});
+            if (stop)
+               return;
+            lock.unlock();
+            fill(next, nextFrom);
+            lock.lock();
+            busy = false;
+            cv.notify_all();
+         }
+      }
+
+      CSon64File *file;
+      TChanNum chan;
+      TSTime64 divide;
+      TSTime64 maxTime;
+      Block cur, next;
+      TSTime64 nextFrom = 0;
+      bool busy, stop;
+      mutex mtx;
+      condition_variable cv;
+      thread worker;
+};
+
 // For managing afferent data source
 class affData {
    public:
       affData() {sFileIn=nullptr;}
-      ~affData(){if (sFileIn) sFileIn->Close();}
+      ~affData(){reader.reset(); if (sFileIn) sFileIn->Close();}
 
       CSon64File *sFileIn;
+      unique_ptr<WaveReader> reader;
       SampFreq currFreq;
       int inputChan;
       double timeBase;
@@ -578,21 +720,32 @@ void openExternalSource(FiberPop *fiber)
       fiber->affStruct = nullptr;
       return;
    }
+    // file.smr:N uses channel N, as Spike2 numbers them, from 1
+   string fname(fiber->afferent_file_name);
+   int wantChan = -1;
+   size_t colon = fname.rfind(':');
+   if (colon != string::npos && colon + 1 < fname.size() &&
+       fname.find_first_not_of("0123456789", colon + 1) == string::npos)
+   {
+      wantChan = stoi(fname.substr(colon + 1)) - 1;
+      fname.erase(colon);
+   }
+
    fiber->affStruct = static_cast<affData*>(new affData());
    affData* aff = static_cast<affData*>(fiber->affStruct);
 
    aff->sFileIn = new TSon32File;        // older format
-   res = aff->sFileIn->Open(fiber->afferent_file_name,1);
+   res = aff->sFileIn->Open(fname.c_str(),1);
    if (res == WRONG_FILE)  // newer format?
    {
       cout << "Not a son32 file (.smr), trying son64 file (.smrx)" << endl;
       delete aff->sFileIn ;
       aff->sFileIn = new TSon64File();
-      res = aff->sFileIn->Open(fiber->afferent_file_name,1);
+      res = aff->sFileIn->Open(fname.c_str(),1);
    }
    if (res != S64_OK)
    {
-      cout << "Error " << res << " opening " << fiber->afferent_file_name << " Is this a CED format file?" << endl;
+      cout << "Error " << res << " opening " << fname << " Is this a CED format file?" << endl;
       delete aff->sFileIn;
       aff->sFileIn = nullptr;
       delete static_cast<affData*>(fiber->affStruct);
@@ -600,7 +753,7 @@ void openExternalSource(FiberPop *fiber)
       return;
    }
 
-   cout << "Reading " <<  fiber->afferent_file_name << endl;
+   cout << "Reading " <<  fname << endl;
    num_chans = aff->sFileIn->MaxChans();
    aff->timeBase = aff->sFileIn->GetTimeBase();
    vers = aff->sFileIn->GetVersion();
@@ -609,9 +762,22 @@ void openExternalSource(FiberPop *fiber)
    cout << "Time base: " << fixed << setprecision(4) << round(aff->timeBase*1000*1000) << " usec  " << aff->bpHz << " Hz" << endl;
    cout << "Version: " << vers/256 << "." << vers % 256 << endl;
 
-    // Assume 1st adc chan is our input source, no way right now to select a chan in the GUI
+    // Use the chan asked for, or the 1st adc chan if none was
+   if (wantChan >= 0)
+   {
+      if (wantChan >= num_chans || (aff->sFileIn->ChanKind(wantChan) != ceds64::TDataKind::Adc
+                              && aff->sFileIn->ChanKind(wantChan) != ceds64::TDataKind::RealWave))
+      {
+         cout << "Channel " << wantChan + 1 << " of " << fname << " is not a waveform channel" << endl;
+         delete static_cast<affData*>(fiber->affStruct);
+         fiber->affStruct = nullptr;
+         return;
+      }
+   }
    for (chan = 0 ; chan < num_chans && !found_one; ++chan)
    {
+      if (wantChan >= 0 && chan != wantChan)
+         continue;
       if (aff->sFileIn->ChanKind(chan) == ceds64::TDataKind::Adc || aff->sFileIn->ChanKind(chan) == ceds64::TDataKind::RealWave)
       {
          found_one = true;
@@ -622,6 +788,7 @@ void openExternalSource(FiberPop *fiber)
          aff->sFileIn->GetChanUnits(chan,sizeof(text),text);
          aff->sFileIn->GetChanYRange(chan,lo,hi);
          aff->sampIntv = aff->sFileIn->ChanDivide(chan);
+         aff->reader = make_unique<WaveReader>(aff->sFileIn, chan, aff->sampIntv);
          cout << "Scale: " << scale << " Offset: " << offset << endl;
          cout << "Sample interval for chan: " << aff->sampIntv << " timebase ticks"  << endl;
          cout << "Units: " << text << endl;
@@ -641,7 +808,7 @@ void openExternalSource(FiberPop *fiber)
          {  // read 1st outside of later function to avoid constant check for 1st read
             float samp = 0.0;
             TSTime64 read;
-            aff->sFileIn->ReadWave(aff->inputChan, &samp, 1, aff->startTime,
+            aff->reader->read(&samp, aff->startTime,
                   aff->startTime + aff->srcInterval->step, read);
             aff->carry = samp;
             cout << 1/relate << " simulator ticks per source tick" << endl;
@@ -678,6 +845,8 @@ void openExternalSource(FiberPop *fiber)
    if the current sample ends exactly on the simulator interval, we carry it
    into the next simulator tick.
 
+   The samples come from the WaveReader's blocks, not the file, so a tick
+   that averages many samples does no file reads most of the time.
 */
 bool nextExternalVal(FiberPop *fiber, double* val)
 {
@@ -689,7 +858,8 @@ bool nextExternalVal(FiberPop *fiber, double* val)
    bool done;
    int have_carry;
    int tick = 1;
-   vector <float> samples;
+   float sum = 0.0;
+   size_t count = 0;
 
    if (!fiber->affStruct)
    {
@@ -702,14 +872,19 @@ bool nextExternalVal(FiberPop *fiber, double* val)
       case SampFreq::FASTER:
          done = false;
          tick = 1;
+          // sum in the same order as before, carry first
+         have_carry = 0;
+         if (!isnan(aff->carry))
+         {
+            sum = aff->carry;
+            have_carry = 1;
+         }
          while (!done)
          {
-            readvals = aff->sFileIn->ReadWave(aff->inputChan,
-                                              &samp, 
-                                              1,
-                                              aff->startTime,
-                                              aff->startTime + aff->srcInterval->step,
-                                              read);
+            readvals = aff->reader->read(&samp,
+                                         aff->startTime,
+                                         aff->startTime + aff->srcInterval->step,
+                                         read);
             if (Debug){
             cout << "tick: " << tick << " read " << readvals << " samples. " << samp << " time " << read * aff->srcInterval->step;}
             if (readvals == 0) // Do not get an EOF condition, just no data
@@ -725,20 +900,14 @@ bool nextExternalVal(FiberPop *fiber, double* val)
             else
             {
               if(Debug){cout << endl;}
-              samples.push_back(samp);
+              sum += samp;
+              ++count;
             }
             aff->startTime += aff->sampIntv;
             ++tick;
          }
-         have_carry = 0;
-         if (!isnan(aff->carry))
-         {
-            avg = aff->carry;
-            have_carry = 1;
-         }
-         for (auto iter = samples.begin(); iter != samples.end(); ++iter)
-            avg += *iter;
-         avg /= samples.size() + have_carry;
+         avg = sum;
+         avg /= count + have_carry;
          if(Debug){cout << "   ****  Avg: " << avg << endl;}
          aff->carry = samp;
          break;
@@ -750,12 +919,10 @@ bool nextExternalVal(FiberPop *fiber, double* val)
          {
             aff->startTime += aff->sampIntv;
             ++(*aff->srcInterval);
-            readvals = aff->sFileIn->ReadWave(aff->inputChan,
-                                              &samp, 
-                                              1,
-                                              aff->startTime,
-                                              aff->startTime + aff->sampIntv,
-                                              read);
+            readvals = aff->reader->read(&samp,
+                                         aff->startTime,
+                                         aff->startTime + aff->sampIntv,
+                                         read);
             aff->carry = samp;
             if(Debug){
             cout << " slower freq: read " << readvals << " samples. " << samp << " time " << read;}
@@ -766,12 +933,10 @@ bool nextExternalVal(FiberPop *fiber, double* val)
 
       case SampFreq::SAME:
       default:
-         readvals = aff->sFileIn->ReadWave(aff->inputChan,
-                                              &avg,
-                                              1,
-                                              aff->startTime,
-                                              aff->startTime + aff->sampIntv,
-                                              read);
+         readvals = aff->reader->read(&avg,
+                                      aff->startTime,
+                                      aff->startTime + aff->sampIntv,
+                                      read);
          if(Debug){cout << " same freq: read " << readvals << " samples. " << samp << " time " << read;}
          if (readvals == 0)
          {
@@ -787,6 +952,39 @@ bool nextExternalVal(FiberPop *fiber, double* val)
    return true;
 }
 
+// The read position, for checkpoints. False if the pop has no source.
+bool getExternalPos(FiberPop *fiber, ExternalPos *pos)
+{
+   affData* aff = static_cast<affData*>(fiber->affStruct);
+
+   if (!aff)
+      return false;
+   pos->startTime = aff->startTime;
+   pos->srcLeft = aff->srcInterval->left;
+   pos->srcRight = aff->srcInterval->right;
+   pos->simLeft = aff->simInterval->left;
+   pos->simRight = aff->simInterval->right;
+   pos->carry = aff->carry;
+   return true;
+}
+
+// Go back to a saved position. The source must have been opened the same
+// way, so the intervals have the same steps.
+bool setExternalPos(FiberPop *fiber, const ExternalPos *pos)
+{
+   affData* aff = static_cast<affData*>(fiber->affStruct);
+
+   if (!aff)
+      return false;
+   aff->startTime = pos->startTime;
+   aff->srcInterval->left = pos->srcLeft;
+   aff->srcInterval->right = pos->srcRight;
+   aff->simInterval->left = pos->simLeft;
+   aff->simInterval->right = pos->simRight;
+   aff->carry = pos->carry;
+   return true;
+}
+
 #ifdef __cplusplus
 }
 #endif
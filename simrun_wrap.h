@@ -19,6 +19,17 @@ This file is part of the USF Neural Simulator suite.
 #ifndef SIMRUN_WRAP_H
 #define SIMRUN_WRAP_H
 
+#include <stdint.h>
+
+// Where an afferent source is in its file, for checkpoints.
+typedef struct
+{
+   int64_t startTime;
+   int64_t srcLeft, srcRight;
+   int64_t simLeft, simRight;
+   float carry;
+} ExternalPos;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,6 +45,8 @@ extern void writeWaveForm(int,int,float);
 extern void writeWaveSpike(int,int);
 extern void openExternalSource(FiberPop *);
 extern bool nextExternalVal(FiberPop*,double*); 
+extern bool getExternalPos(FiberPop*,ExternalPos*);
+extern bool setExternalPos(FiberPop*,const ExternalPos*);
 
 
 #ifdef __cplusplus
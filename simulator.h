@@ -50,21 +50,6 @@ typedef struct {
   unsigned int initialized:1;
 } Slice;
 
-#define LRN_SIZE 5
-#define LRN_FREE -1 
-#define LRN_GROWBY  5
-
-
-// Info learning synapses need to manage the learn process
-typedef struct 
-{ 
-   int recv_pop;  // receiving fiber/cell
-   int send_term;  // receiving fiber/cell
-   int recv_term; // receiving terminal
-   int ariv_time; // arrival time (i.e., delay)
-} LEARN;
-
-
 typedef struct
 {
   float G;//state
@@ -77,13 +62,21 @@ typedef struct
   int stidx; // JAH: SynType index? But this doesn't match syntype(!)
   int syntype;
   int synparent;
+  // c->syn indices of the SYN_PRE and SYN_POST modifiers whose parent is
+  // this synapse, or -1.  Resolved once by build_network.
+  int pre;//skip
+  int post;//skip
   float initial_strength;
   float lrn_strength;
   int   lrnWindow;
   float lrnStrMax;
   float lrnStrDelta;
-  int lrn_size;
-  LEARN *lrn;//indirect
+  // Learning history, kept by simloop as counts. Spikes delivered and not
+  // yet aged out, those of them inside the learning window, and how many
+  // steps a spike ages per simulation step.
+  int lrn_pending;//skip
+  int lrn_active;//skip
+  int lrn_rate;//skip
 } Syn;
 
 typedef struct
@@ -193,6 +186,8 @@ typedef struct
   char *name;
   char *ic_expression;//string
   void *ic_evaluator;
+  void *cellstate;
+  void *synstate;
   int pop_subtype;
   int haveLearn;
 } CellPop;
@@ -227,6 +222,8 @@ typedef struct
   CellPop *cellpop;
   int syntype_count;
   SynType *syntype;//iskip
+  void *csr;
+  void *arena;
 } Network;
 
 typedef struct
@@ -289,9 +286,13 @@ typedef struct
 extern simulator_global S;
 
 double ran (int *i);
+int ran_skip (int i, unsigned long n);
 void build_network (void);
+void compile_ic_expressions (void);
 void simloop (void);
 int read_sim ();
+void load_sim (void);
+void build_sim (void);
 void update (void);
 extern int sigterm;
 void get_cell_coords (char *filename);
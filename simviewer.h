@@ -42,6 +42,7 @@ This file is part of the USF Neural Simulator suite.
 #include <QSpinBox>
 #include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QTcpServer>
+#include "wavefile.h"
 
 
 const int TS=100;     // time steps per wave file (todo: make arbitrary)
@@ -111,6 +112,8 @@ class CellRow : public QGraphicsItem
       virtual ~CellRow();
       void addYVal(float val)      { yVal.push_back(val);}
       void addAP(int val)        { aPot.push_back(val); if (val) haveAP=true;}
+      void addYVals(const float *val, int n);
+      void addAPBits(const unsigned char *bits, int n);
       void addPaintPt(QPoint pt) { paintPts.push_back(pt);}
       void addPaintActPot(QLine line) { paintActPot.push_back(line);}
       void adjustRect(QPoint,QPoint);
@@ -229,6 +232,12 @@ class SimViewer : public QMainWindow
       void doApVisible(int);
       void doColorOn(int);
       void loadWave(std::stringstream&);
+      void loadWaveBlock(WaveFile *);
+      void loadFrame(const char *, qsizetype);
+      void createRows();
+      void setPlotType(int, int, int);
+      void addSample(int, float, int);
+      void waveAdded(int);
       void keyPressEvent(QKeyEvent *) override;
       void CreatePDF();
       void loadAllExisting();
@@ -275,6 +284,9 @@ class SimViewer : public QMainWindow
       lineObj timeLines;
       textObj textItems;
       FILE  *wave_fp=0;
+      WaveFile *waveBin=nullptr;
+      WaveFile *waveNet=nullptr;
+      QByteArray runBuf;
       int   nextWave=0;
       int   currentWave=0;
       int   block=0;
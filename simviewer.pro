@@ -38,12 +38,15 @@ SOURCES += \
     simviewermain.cpp \
     simviewer_impl.cpp \
     lin2ms.c \
-    wavemarkers.c 
+    wavemarkers.c \
+    wavefile.c
 
 HEADERS += \
     simviewer.h \
     lin2ms.h \
-    wavemarkers.c 
+    wavemarkers.c \
+    wavefile.h \
+    wavesend.h
 
 FORMS += \
         simviewer.ui
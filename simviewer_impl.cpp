@@ -59,6 +59,7 @@ This file is part of the USF Neural Simulator suite.
 #include "lin2ms.h"
 #include "c_globals.h"
 #include "wavemarkers.h"
+#include "wavesend.h"
 #include "launch_model.h"
 
 QColor SimViewer::sceneFG=Qt::white;
@@ -259,11 +260,12 @@ void SimViewer::runConnectionClosed()
 }
 
 
-/* This shows up as a stream of bytes. It can be incomplete. The start
-   of block is marked with the "impossible" char value of MSG_START,
-   the end is MSG_END. Accumulate the bytes until we have a complete
-   block.  Then process it as a set of strings
-   A block looks like this:
+/* This shows up as a stream of bytes. It can be incomplete. It is
+   either binary frames (see wavesend.h), or text blocks for the old
+   protocol. The start of a text block is marked with the "impossible"
+   char value of MSG_START, the end is MSG_END. Accumulate the bytes
+   until we have a complete frame or block.
+   A text block looks like this:
    MSG_START
    launch number
    wave number
@@ -273,48 +275,83 @@ void SimViewer::runConnectionClosed()
 void SimViewer::fromSimRun()
 {
    static bool have_start = false;
-   QByteArray msg;
    static stringstream strm;
-   char val;
-   int ret;
-   int read = 0;
+   qsizetype pos = 0;
 
-   while ((ret = runSocket->read(&val,sizeof(val))) != 0)
+   runBuf += runSocket->readAll();
+   while (pos < runBuf.size())
    {
-      ++read;
-      if (ret == -1)
+      unsigned char val = runBuf[pos];
+      if (have_start)  // text block, take it up to MSG_END
       {
-         cout << "error reading from runSocket" << endl;
-         return;
+         qsizetype end = runBuf.indexOf(char(MSG_END), pos);
+         if (end < 0)
+         {
+            strm.write(runBuf.constData() + pos, runBuf.size() - pos);
+            pos = runBuf.size();
+            break;
+         }
+         strm.write(runBuf.constData() + pos, end - pos);
+         createWave(strm);
+         strm.clear();
+         strm.str(string());
+         have_start = false;
+         pos = end + 1;
+      }
+      else if (val == MSG_FRAME)
+      {
+         WaveChunk ch;
+         if (runBuf.size() - pos < WAVE_FRAME_PREFIX + (qsizetype) sizeof ch)
+            break;
+         memcpy(&ch, runBuf.constData() + pos + WAVE_FRAME_PREFIX, sizeof ch);
+         if (ch.size < 0)  // not really a frame, resync on the next marker
+         {
+            ++pos;
+            continue;
+         }
+         qsizetype size = sizeof ch + ch.size;
+         if (runBuf.size() - pos < WAVE_FRAME_PREFIX + size)
+            break;
+         if ((unsigned char) runBuf[pos + 1] != WAVE_FRAME_VERSION)
+            cout << "simrun sent frame version " << int((unsigned char) runBuf[pos + 1])
+                 << ", simviewer only knows " << WAVE_FRAME_VERSION << ", ignoring it." << endl;
+         else
+            loadFrame(runBuf.constData() + pos + WAVE_FRAME_PREFIX, size);
+         pos += WAVE_FRAME_PREFIX + size;
       }
-      if ((unsigned char) val == MSG_EOF)
+      else if (val == MSG_EOF)
       {
          char eof_msg[2];
          eof_msg[0] = MSG_EOF;
          eof_msg[1] = 0;
          runSocket->write(eof_msg);
-         return;
+         ++pos;
       }
-      if ((unsigned char) val == MSG_START)
+      else if (val == MSG_START)
       {
-         if (have_start)
-            cout << " two starts without an end????" << endl;
          have_start = true;
-         continue;
-      }
-      if (have_start)
-      {
-         if ( (unsigned char) val != MSG_END)
-            strm.put(val);
-         else
-         {
-            createWave(strm);
-            strm.clear();
-            strm.str(string());
-            have_start = false;
-            read = 0;
-         }
+         ++pos;
       }
+      else
+         ++pos;
+   }
+   runBuf.remove(0, pos);
+}
+
+// We have a complete binary frame, decode it straight into the rows.
+void SimViewer::loadFrame(const char *chunk, qsizetype size)
+{
+   if (!waveNet)
+      waveNet = wave_decoder();
+   int got = wave_decode(waveNet, chunk, size);
+   if (got < 0)
+      cout << "Error decoding frame from simrun, ignoring it." << endl;
+   else if (got == 1)
+   {
+      currentWave = waveNet->block;
+      nextWave = currentWave + 1;
+      loadWaveBlock(waveNet);
+      tickToc->start(0); // this causes the timer to fire and repaint
    }
 }
 
@@ -470,6 +507,39 @@ void SimViewer::timerFired()
    else if (useFiles)
    {
       int feedback = 0;
+        // a binary wave file takes over from the text ones if it shows up
+        // before we have read any of them
+      sprintf(nextname,"wave.%02d.bin",launchNum);
+      if (!waveBin && nextWave == 0 && access(nextname, R_OK) == 0)
+         waveBin = wave_open(nextname);
+      if (waveBin)
+      {
+         int got;
+         while ((got = wave_read_block(waveBin)) > 0)
+         {
+            currentWave = nextWave;
+            nextWave++;
+            loadWaveBlock(waveBin);
+            if (++feedback % 500 == 0)
+            {
+               ui->infoBox->appendPlainText("Loading...");
+               ui->infoBox->repaint();
+               updatePaint();
+               QCoreApplication::processEvents();
+            }
+         }
+         if (got < 0)
+         {
+            cerr << "***********Problem with " << nextname << endl;
+            wave_free(waveBin);
+            waveBin = nullptr;
+            return;
+         }
+         if (feedback)
+            updatePaint();
+         tickToc->start(checkTime);
+         return;
+      }
       sprintf(nextname,"wave.%02d.%04d",launchNum, nextWave);
       if (access (nextname, R_OK) == 0)
       {
@@ -1236,35 +1306,7 @@ void SimViewer::loadWave(stringstream& waveStrm)
          bailout(5);
       }
 
-         // allocate a display row object for each wave/cell
-      for (int cell = 0; cell < numwaves; cell++)
-      {
-         CellRow* newrow = new CellRow(cell,Qt::cyan,lineParent);
-         cellRows.push_back(newrow);
-         QGraphicsLineItem* new_vline = new QGraphicsLineItem(voltLineParent);
-         voltLines.push_back(new_vline);
-
-         popids.push_back(0);      // reserve slots for header info
-         popcells.push_back(0);
-         popvars.push_back(0);
-         poptype.push_back(0);
-         poplabel.push_back(QString());
-      }
-       // create slots for the text we'll need
-       // first is time/mv text at top of view
-      auto *text = new OverlayText(QString("Sampley"),textParent);
-      text->setZValue(11); // this one always on top of rest of text
-      text->setFont(itemFont);
-      textItems.push_back(text);
-      fontHeight = text->boundingRect().height();
-      topMargin = 0;
-      for (xloop = 0; xloop < numwaves; xloop++)  // then labels for rows
-      {
-         auto *text = new OverlayText(QString(),textParent);
-         text->setZValue(10);
-         text->setFont(itemFont);
-         textItems.push_back(text);
-      }
+      createRows();
 
       // read info for each channel/wave
       int tmp_v1, tmp_v2, wave;
@@ -1277,16 +1319,7 @@ void SimViewer::loadWave(stringstream& waveStrm)
          popcells[wave]=tmp_v2;
          if (sscanf (p = inbuf + n, "%d %d %n", &tmp_v1, &tmp_v2, &n) == 2)
          {
-            popvars[wave] = tmp_v1;
-            poptype[wave] = tmp_v2;
-            if (tmp_v1 <= STD_FIBER && tmp_v1 >= AFFERENT_BOTH)
-            {
-               cellRows[wave]->setPlotType(PlotType::event);
-               if (tmp_v1 == AFFERENT_BOTH)
-                  cellRows[wave]->setApScale(0.25); 
-            }
-            else
-               cellRows[wave]->setPlotType(PlotType::wave);
+            setPlotType(wave, tmp_v1, tmp_v2);
             int e = strlen (p += n) - 1;
             while (e > 0 && !isgraph (p[e]))
                p[e--] = 0;
@@ -1344,20 +1377,111 @@ void SimViewer::loadWave(stringstream& waveStrm)
               bailout(8);
             }
          }
-         cellRows[yloop]->addYVal(tmp_popv);
-         if (cellRows[yloop]->min > tmp_popv) // used for per-box auto scaling
-         {
-            cellRows[yloop]->min = tmp_popv;
-         }
-         if (cellRows[yloop]->max < tmp_popv)
-         {
-            cellRows[yloop]->max = tmp_popv;
-         }
-         cellRows[yloop]->addAP(tmp_popap);
+         addSample(yloop, tmp_popv, tmp_popap);
+      }
+   }
+   waveAdded(numsteps);
+}
+
+/* Same as loadWave, for the next block of the binary wave file or
+   stream. The plots come from its PLOTS chunk instead of a text header,
+   and the last block of a run may be short.
+*/
+void SimViewer::loadWaveBlock(WaveFile *wf)
+{
+   int count;
+
+   if (firstFile)
+   {
+      numsteps = TS;
+      numwaves = wf->plot_count;
+      stepSize = wf->step;
+      createRows();
+      for (int wave = 0; wave < numwaves; wave++)
+      {
+         popids[wave] = wf->plot[wave].pop;
+         popcells[wave] = wf->plot[wave].cell;
+         setPlotType(wave, wf->plot[wave].var, wf->plot[wave].type);
       }
+      firstFile = false;
+   }
+   count = min(numwaves, wf->plot_count);
+   if (wf->plots_changed) // also picks up text changes from mid-run update
+   {
+      for (int wave = 0; wave < count; wave++)
+         poplabel[wave] = wf->plot[wave].lbl;
+      wf->plots_changed = 0;
+   }
+     // the values for each plot are together, a row at a time
+   for (int wave = 0; wave < count; ++wave)
+   {
+      cellRows[wave]->addYVals(wf->val + (size_t) wave * wf->nrecs, wf->nrecs);
+      cellRows[wave]->addAPBits(wf->spike + (size_t) wave * wf->spike_stride, wf->nrecs);
+   }
+   waveAdded(wf->nrecs);
+}
+
+// allocate a display row object for each wave/cell
+void SimViewer::createRows()
+{
+   for (int cell = 0; cell < numwaves; cell++)
+   {
+      CellRow* newrow = new CellRow(cell,Qt::cyan,lineParent);
+      cellRows.push_back(newrow);
+      QGraphicsLineItem* new_vline = new QGraphicsLineItem(voltLineParent);
+      voltLines.push_back(new_vline);
+
+      popids.push_back(0);      // reserve slots for header info
+      popcells.push_back(0);
+      popvars.push_back(0);
+      poptype.push_back(0);
+      poplabel.push_back(QString());
+   }
+    // create slots for the text we'll need
+    // first is time/mv text at top of view
+   auto *text = new OverlayText(QString("Sampley"),textParent);
+   text->setZValue(11); // this one always on top of rest of text
+   text->setFont(itemFont);
+   textItems.push_back(text);
+   fontHeight = text->boundingRect().height();
+   topMargin = 0;
+   for (int row = 0; row < numwaves; row++)  // then labels for rows
+   {
+      auto *text = new OverlayText(QString(),textParent);
+      text->setZValue(10);
+      text->setFont(itemFont);
+      textItems.push_back(text);
+   }
+}
+
+void SimViewer::setPlotType(int wave, int var, int type)
+{
+   popvars[wave] = var;
+   poptype[wave] = type;
+   if (var <= STD_FIBER && var >= AFFERENT_BOTH)
+   {
+      cellRows[wave]->setPlotType(PlotType::event);
+      if (var == AFFERENT_BOTH)
+         cellRows[wave]->setApScale(0.25); 
    }
+   else
+      cellRows[wave]->setPlotType(PlotType::wave);
+}
 
-   currX0 += numsteps;  // this will eventually be the max X value at highest res
+void SimViewer::addSample(int wave, float val, int ap)
+{
+   cellRows[wave]->addYVal(val);
+   if (cellRows[wave]->min > val) // used for per-box auto scaling
+      cellRows[wave]->min = val;
+   if (cellRows[wave]->max < val)
+      cellRows[wave]->max = val;
+   cellRows[wave]->addAP(ap);
+}
+
+// after a block of steps has been added to the rows
+void SimViewer::waveAdded(int steps)
+{
+   currX0 += steps;     // this will eventually be the max X value at highest res
 
    QRect vp = ui->plotView->viewport()->rect();    // max H slider to show
    double pts = cellRows[0]->yVal.size();          // all pts
@@ -1430,6 +1554,11 @@ void SimViewer::doRestart()
    nextWave = 0;
    currX0 = 0;
    firstFile = true;
+   if (waveBin)
+   {
+      wave_free(waveBin);
+      waveBin = nullptr;
+   }
    popids.clear();
    popcells.clear();
    popvars.clear();
@@ -1496,6 +1625,25 @@ void CellRow::Reset()
    max=-1000000;
 }
 
+// a block of values and spike bits from the binary wave format
+void CellRow::addYVals(const float *val, int n)
+{
+   yVal.insert(yVal.end(), val, val + n);
+   for (int i = 0; i < n; ++i)
+   {
+      if (min > val[i]) // used for per-box auto scaling
+         min = val[i];
+      if (max < val[i])
+         max = val[i];
+   }
+}
+
+void CellRow::addAPBits(const unsigned char *bits, int n)
+{
+   for (int i = 0; i < n; ++i)
+      addAP((bits[i / 8] >> (i % 8)) & 1);
+}
+
 QRectF CellRow::boundingRect() const
 {
    return QRectF(topLeft,bottomRight);
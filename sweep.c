@@ -0,0 +1,467 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* simrun --sweep.  See sweep.h.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined __linux__
+#include <sys/wait.h>
+#endif
+#include "simulator.h"
+#include "inode.h"
+#include "hash.h"
+#include "simulator_hash.h"
+#include "simrun_wrap.h"
+#include "csr.h"
+#include "sweep.h"
+#include "threadpool.h"
+
+extern char outPath[];
+extern char outFname[];
+extern int num_threads;
+extern int csr_flag;
+
+int sweep_jobs = 0;   // 0 is one per CPU, allowing for --threads
+
+#if defined __linux__
+
+enum {SWEEP_CELLPOP, SWEEP_FIBERPOP, SWEEP_SYNTYPE};
+
+typedef struct
+{
+  char *name;         // the csv heading
+  char *member;
+  int kind;
+  int pop;            // 0-based pop or synapse type
+  int tp;             // 0-based target pop, or -1
+  StructInfo *v;
+} SweepParam;
+
+static int param_count;
+static SweepParam *param;
+static int variant_count;
+static char ***value;  // value[variant][param]
+
+// Members that are used up building the network, or that set its shape.
+static const char *build_only[] = {
+  "CellPop.orig_cell_count", "CellPop.cell_count", "CellPop.targetpop_count",
+  "CellPop.noise_seed", "CellPop.Th0_sd", "CellPop.pop_subtype", "CellPop.haveLearn",
+  "FiberPop.start", "FiberPop.stop", "FiberPop.infsed", "FiberPop.fiber_count",
+  "FiberPop.targetpop_count", "FiberPop.pop_subtype", "FiberPop.next_stim",
+  "FiberPop.next_fixed", "FiberPop.num_aff", "FiberPop.haveLearn",
+  "SynType.SYN_TYPE", "SynType.PARENT",
+  "TargetPop.MCT", "TargetPop.NCT", "TargetPop.NT", "TargetPop.IRCP",
+  "TargetPop.INSED", "TargetPop.TYPE",
+};
+
+static void
+sweep_error (const char *csv_name, int line, const char *msg, const char *what)
+{
+  fprintf (stdout, "SIMRUN: %s line %d: %s %s\n", csv_name, line, what, msg);
+  exit (1);
+}
+
+static char *
+trim (char *s)
+{
+  char *e = s + strlen (s);
+  while (isspace ((unsigned char) *s))
+    s++;
+  while (e > s && isspace ((unsigned char) e[-1]))
+    *--e = 0;
+  return s;
+}
+
+// Split a csv line in place, return the number of fields.
+static int
+split (char *line, char ***field)
+{
+  int count = 0;
+  char *s = line, *f;
+
+  while ((f = strsep (&s, ",")))
+  {
+    TREALLOC (*field, count + 1);
+    (*field)[count++] = trim (f);
+  }
+  return count;
+}
+
+static void
+parse_param (SweepParam *p, char *name, const char *csv_name)
+{
+  char kind[16], member[64];
+  const char *sname = 0;
+  int pop, tp = 0, n = 0, count = 0;
+  size_t k;
+  char *varname;
+
+  if (!(sscanf (name, "%15[a-z].%d.targetpop.%d.%63s%n", kind, &pop, &tp, member, &n) == 4 && !name[n])
+      && !(tp = 0, sscanf (name, "%15[a-z].%d.%63s%n", kind, &pop, member, &n) == 3 && !name[n]))
+    sweep_error (csv_name, 1, "is not a pop.N.member parameter", name);
+  p->name = strdup (name);
+  p->member = strdup (member);
+  p->pop = pop - 1;
+  p->tp = tp - 1;
+  if (strcmp (kind, "cellpop") == 0)
+    p->kind = SWEEP_CELLPOP, sname = "CellPop", count = S.net.cellpop_count;
+  else if (strcmp (kind, "fiberpop") == 0)
+    p->kind = SWEEP_FIBERPOP, sname = "FiberPop", count = S.net.fiberpop_count;
+  else if (strcmp (kind, "syntype") == 0 && tp == 0)
+    p->kind = SWEEP_SYNTYPE, sname = "SynType", count = S.net.syntype_count;
+  else
+    sweep_error (csv_name, 1, "is not a cellpop, fiberpop or syntype parameter", name);
+  if (p->pop < 0 || p->pop >= count)
+    sweep_error (csv_name, 1, "is not in the model", name);
+  if (tp)
+  {
+    count = p->kind == SWEEP_CELLPOP ? S.net.cellpop[p->pop].targetpop_count
+                                     : S.net.fiberpop[p->pop].targetpop_count;
+    if (p->tp < 0 || p->tp >= count)
+      sweep_error (csv_name, 1, "is not in the model", name);
+    sname = "TargetPop";
+  }
+
+  if (asprintf (&varname, "%s.%s", sname, member) == -1) exit (1);
+  p->v = simulator_struct_info (varname, strlen (varname));
+  if (p->v == 0 || !(p->v->val == ato_float || p->v->val == ato_double || p->v->val == ato_int)
+      || p->v->dim || p->v->ptr)
+    sweep_error (csv_name, 1, "is not a number in the model", name);
+  for (k = 0; k < sizeof build_only / sizeof build_only[0]; k++)
+    if (strcmp (varname, build_only[k]) == 0)
+      sweep_error (csv_name, 1, "is fixed when the network is built and cannot be swept", name);
+  free (varname);
+
+  if (p->kind == SWEEP_CELLPOP && p->tp < 0)
+  {
+    CellPop *cp = S.net.cellpop + p->pop;
+    if (strcmp (member, "TMEM") == 0 && cp->TMEM <= 0)
+      sweep_error (csv_name, 1, "is a PSR pop, which has no membrane time constant", name);
+    if (strcmp (member, "TGK") == 0 && cp->DCG == -1)
+      sweep_error (csv_name, 1, "is a burster pop, which has no K conductance time constant", name);
+  }
+}
+
+static void
+read_csv (const char *csv_name)
+{
+  FILE *f;
+  char *line = 0, **field = 0;
+  size_t len = 0;
+  int lineno = 0, count, n;
+
+  if ((f = fopen (csv_name, "r")) == 0)
+  {
+    fprintf (stdout, "SIMRUN: Cannot open sweep file %s: %s\n", csv_name, strerror (errno));
+    exit (1);
+  }
+  while (getline (&line, &len, f) > 0)
+  {
+    char *s = trim (line);
+    lineno++;
+    if (*s == 0 || *s == '#')
+      continue;
+    count = split (s, &field);
+    if (param == 0)
+    {
+      param_count = count;
+      TCALLOC (param, param_count);
+      for (n = 0; n < count; n++)
+        parse_param (param + n, field[n], csv_name);
+      continue;
+    }
+    if (count != param_count)
+      sweep_error (csv_name, lineno, "values, expected one per parameter", count < param_count ? "too few" : "too many");
+    TREALLOC (value, variant_count + 1);
+    TMALLOC (value[variant_count], param_count);
+    for (n = 0; n < count; n++)
+    {
+      char *end;
+      double x = strtod (field[n], &end);
+      if (*field[n] == 0 || *end || (param[n].v->val == ato_int && x != floor (x)))
+        sweep_error (csv_name, lineno, "is not a value for", field[n]);
+        // the learning wheels would quietly take 0 or less as 1
+      if (param[n].kind == SWEEP_SYNTYPE && strcmp (param[n].member, "lrnWindow") == 0 && x <= 0)
+        sweep_error (csv_name, lineno, "is not a learning window, it must be at least 1", field[n]);
+      value[variant_count][n] = strdup (field[n]);
+    }
+    variant_count++;
+  }
+  fclose (f);
+  free (line);
+  free (field);
+  if (variant_count == 0)
+  {
+    fprintf (stdout, "SIMRUN: %s has no variants to run\n", csv_name);
+    exit (1);
+  }
+}
+
+/* The Target records and the CSR arrays carry copies of the target pop
+   strengths, set by attach_to_synapses.  Redo those copies, in the same
+   order, so that each synapse's learning strengths end up from the same
+   terminal they would after a fresh build.
+*/
+static void
+copy_strengths (Target *target, TargetPop *tps, int targetpop_count)
+{
+  Csr *csr = CSR (&S.net);
+  int tpidx, tidx, tidx0 = 0;
+
+  for (tpidx = 0; tpidx < targetpop_count; tpidx++)
+  {
+    TargetPop *tp = tps + tpidx;
+    for (tidx = 0; tidx < tp->NT; tidx++)
+    {
+      Target *t = target + tidx0 + tidx;
+      if (t->syn == 0)      // no target pop, never attached
+        continue;
+      t->strength = tp->STR;
+      t->syn->initial_strength = tp->STR;
+      t->syn->lrn_strength = tp->STR;
+      if (csr_flag)
+        csr->strength[t - csr->target_pool] = tp->STR;
+    }
+    tidx0 += tp->NT;
+  }
+}
+
+static void
+apply_variant (int vn)
+{
+  bool synapses = false, strengths = false;
+  int n, pn, cn;
+
+  for (n = 0; n < param_count; n++)
+  {
+    SweepParam *p = param + n;
+    char *base;
+    if (p->kind == SWEEP_SYNTYPE)
+      base = (char *) (S.net.syntype + p->pop), synapses = true;
+    else if (p->tp >= 0)
+      base = (char *) ((p->kind == SWEEP_CELLPOP ? S.net.cellpop[p->pop].targetpop
+                                                 : S.net.fiberpop[p->pop].targetpop) + p->tp),
+      strengths = true;
+    else if (p->kind == SWEEP_CELLPOP)
+      base = (char *) (S.net.cellpop + p->pop);
+    else
+      base = (char *) (S.net.fiberpop + p->pop);
+    p->v->val (value[vn][n], base + p->v->offset, p->v->size);
+    fprintf (stdout, "SIMRUN: sweep variant %d: %s = %s\n", vn + 1, p->name, value[vn][n]);
+
+    // these are kept as the per step factors simloop uses
+    if (p->kind == SWEEP_CELLPOP && p->tp < 0)
+    {
+      CellPop *cp = S.net.cellpop + p->pop;
+      if (strcmp (p->member, "TMEM") == 0)
+        cp->R0 = -.5 * S.step / (cp->TMEM * S.Gm0);
+      else if (strcmp (p->member, "TGK") == 0)
+        cp->DCG = exp (-S.step / cp->TGK);
+    }
+  }
+
+  if (synapses)
+    for (pn = 0; pn < S.net.cellpop_count; pn++)
+      for (cn = 0; cn < S.net.cellpop[pn].cell_count; cn++)
+      {
+        Cell *c = S.net.cellpop[pn].cell + cn;
+        for (n = 0; n < c->syn_count; n++)
+        {
+          Syn *s = c->syn + n;
+          SynType *st = S.net.syntype + s->stidx;
+          s->EQ = st->EQ;
+          s->DCS = st->DCS;
+          s->lrnWindow = st->lrnWindow;
+          s->lrnStrMax = st->lrnStrMax;
+          s->lrnStrDelta = st->lrnStrDelta;
+        }
+      }
+
+  if (strengths)
+  {
+    for (pn = 0; pn < S.net.cellpop_count; pn++)
+    {
+      CellPop *cp = S.net.cellpop + pn;
+      for (cn = 0; cn < cp->cell_count; cn++)
+        copy_strengths (cp->cell[cn].target, cp->targetpop, cp->targetpop_count);
+    }
+    for (pn = 0; pn < S.net.fiberpop_count; pn++)
+    {
+      FiberPop *fp = S.net.fiberpop + pn;
+      for (cn = 0; cn < fp->fiber_count; cn++)
+        copy_strengths (fp->fiber[cn].target, fp->targetpop, fp->targetpop_count);
+    }
+  }
+}
+
+/* Point the worker's output at its own directory.  The parent has
+   already written the bdt/edt header to S.ofile, so copy that across.
+*/
+static void
+redirect_output (int vn)
+{
+  char *dir, *log, *name;
+  char *base = strrchr (outFname, '/');
+
+  if (asprintf (&dir, "%ssweep.%04d/", outPath, vn + 1) == -1) exit (1);
+  if (mkdir (dir, 0777) != 0 && errno != EEXIST)
+  {
+    fprintf (stderr, "SIMRUN: cannot make %s: %s\n", dir, strerror (errno));
+    exit (1);
+  }
+  if (asprintf (&log, "%ssimrun.log", dir) == -1) exit (1);
+    // stdout is the log from here on, so trouble goes to stderr
+  if (!freopen (log, "w", stdout))
+  {
+    fprintf (stderr, "SIMRUN: cannot write %s: %s\n", log, strerror (errno));
+    exit (1);
+  }
+  free (log);
+
+  if (outFname[0])
+  {
+    if (asprintf (&name, "%s%s", dir, base ? base + 1 : outFname) == -1) exit (1);
+    if (S.ofile)
+    {
+      FILE *hdr;
+      char buf[256];
+      size_t n;
+      if ((hdr = fopen (outFname, "rb")) == 0)
+      {
+        fprintf (stderr, "SIMRUN: cannot read %s: %s\n", outFname, strerror (errno));
+        exit (1);
+      }
+      fclose (S.ofile);
+      if ((S.ofile = fopen (name, "wb")) == 0)
+      {
+        fprintf (stderr, "SIMRUN: cannot write %s: %s\n", name, strerror (errno));
+        exit (1);
+      }
+      while ((n = fread (buf, 1, sizeof buf, hdr)) > 0)
+        if (fwrite (buf, 1, n, S.ofile) != n)
+        {
+          fprintf (stderr, "SIMRUN: cannot write %s: %s\n", name, strerror (errno));
+          exit (1);
+        }
+      fclose (hdr);
+    }
+    strncpy (outFname, name, 2047);
+    free (name);
+  }
+  strncpy (outPath, dir, 2047);
+  free (dir);
+}
+
+void
+sweep_run (const char *csv_name)
+{
+  pid_t *pid;
+  int jobs = sweep_jobs, running = 0, failed = 0, vn, pn;
+
+  read_csv (csv_name);
+  if (jobs < 1)
+  {
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    jobs = cpus > num_threads ? cpus / num_threads : 1;
+  }
+  if (jobs > variant_count)
+    jobs = variant_count;
+  fprintf (stdout, "SIMRUN: Sweeping %d variants of %d parameters, %d at a time\n",
+           variant_count, param_count, jobs);
+  fflush (stdout);
+  if (S.ofile)
+    fflush (S.ofile);
+
+    // threads do not survive fork, each worker starts its own pool in simloop
+  pool_stop ();
+  TMALLOC (pid, variant_count);
+  for (vn = 0; vn < variant_count || running; )
+  {
+    int status, n;
+    pid_t done;
+
+    if (vn < variant_count && running < jobs)
+    {
+      fflush (stdout);
+      if ((pid[vn] = fork ()) == -1)
+      {
+        fprintf (stdout, "SIMRUN: cannot start sweep variant %d: %s\n", vn + 1, strerror (errno));
+        exit (1);
+      }
+      if (pid[vn] == 0)
+      {
+        redirect_output (vn);
+        apply_variant (vn);
+        // the afferent readers would otherwise share one file offset
+        for (pn = 0; pn < S.net.fiberpop_count; pn++)
+          if (S.net.fiberpop[pn].pop_subtype == AFFERENT && S.net.fiberpop[pn].affStruct)
+            openExternalSource (S.net.fiberpop + pn);
+        return;
+      }
+      vn++, running++;
+      continue;
+    }
+
+    if ((done = wait (&status)) == -1)
+      DIE;
+    running--;
+    for (n = 0; n < vn && pid[n] != done; n++)
+      ;
+    if (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+      fprintf (stdout, "SIMRUN: sweep variant %d done\n", n + 1);
+    else
+    {
+      failed++;
+      fprintf (stdout, "SIMRUN: sweep variant %d failed, see %ssweep.%04d/simrun.log\n",
+               n + 1, outPath, n + 1);
+    }
+    fflush (stdout);
+  }
+
+  // The parent's own bdt/edt file only ever got the header.
+  if (S.ofile)
+  {
+    fclose (S.ofile);
+    unlink (outFname);
+  }
+  fprintf (stdout, "SIMRUN: sweep finished, %d of %d variants failed\n", failed, variant_count);
+  exit (failed != 0);
+}
+
+#else
+
+void
+sweep_run (const char *csv_name)
+{
+  fprintf (stdout, "SIMRUN: --sweep %s needs fork, which this system does not have\n", csv_name);
+  exit (1);
+}
+
+#endif
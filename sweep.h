@@ -0,0 +1,48 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/* Parameter sweeps (simrun --sweep file.csv).
+
+   The network is read and built once, then each row of the csv file is
+   run as its own simulation in a forked copy of simrun, sweep_jobs of
+   them at a time.  The first line names the parameters and each line
+   after it gives one variant's values.  A parameter is a scalar member
+   of a cell pop, fiber pop, synapse type or target pop, spelled the way
+   the .sim file spells it, with 1-based numbers:
+
+      cellpop.3.noise_amp   cellpop.3.TMEM   fiberpop.1.probability
+      syntype.2.EQ          cellpop.3.targetpop.1.STR
+
+   Members that set the shape of the network (cell counts, terminals,
+   delays, seeds and the like) cannot be swept.  Blank lines and lines
+   starting with # are skipped.
+
+   Variant n writes its output files and its log to sweep.NNNN/ under
+   the output path.  sweep_run only returns in the worker for a variant,
+   with the variant's parameters applied and ready for simloop; the
+   parent waits for all of them and exits.  Linux only.
+*/
+
+extern int sweep_jobs;
+
+void sweep_run (const char *csv_name);
+
+#endif
@@ -0,0 +1,220 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Synaptic conductance decay kernels.  See syndecay.h. */
+
+#include <stdlib.h>
+#include "syndecay.h"
+
+#if defined __x86_64__ && defined __GNUC__
+#define SYNDECAY_X86
+#include <immintrin.h>
+#endif
+
+static void
+decay_scalar (SynDecay *sd, int k0, int k1)
+{
+  int k;
+  for (k = k0; k < k1; k++)
+  {
+    float *slot = sd->q[k] + sd->qpos[k];
+    sd->G[k] = (double)sd->G[k] * sd->DCS[k] + *slot;
+    *slot = 0;
+    if (++sd->qpos[k] == sd->q_count[k])
+      sd->qpos[k] = 0;
+  }
+}
+
+static void
+sums_scalar (SynDecay *sd, int k0, int n, int count, double eq_off,
+             double *Gsum, double *GEsum)
+{
+  int c, j;
+  for (c = 0; c < count; c++)
+  {
+    double gs = 0, ges = 0;
+    int k = k0 + c * n;
+    for (j = 0; j < n; j++, k++)
+    {
+      gs += sd->G[k];
+      ges += (double)sd->G[k] * (sd->EQ[k] - eq_off);
+    }
+    Gsum[c] = gs;
+    GEsum[c] = ges;
+  }
+}
+
+#ifdef SYNDECAY_X86
+
+// Each synapse has its own ring, so the current q slots are gathered
+// through the ring pointers: address = q[k] + 4 * qpos[k].
+
+__attribute__ ((target ("avx2"), optimize ("fp-contract=off")))
+static void
+decay_avx2 (SynDecay *sd, int k0, int k1)
+{
+  int k = k0, i;
+  for (; k + 4 <= k1; k += 4)
+  {
+    __m128i pos = _mm_loadu_si128 ((const __m128i *) (sd->qpos + k));
+    __m256i addr = _mm256_add_epi64 (_mm256_loadu_si256 ((const __m256i *) (sd->q + k)),
+                                     _mm256_slli_epi64 (_mm256_cvtepi32_epi64 (pos), 2));
+    __m128 q = _mm256_i64gather_ps ((const float *) 0, addr, 1);
+    __m256d g = _mm256_mul_pd (_mm256_cvtps_pd (_mm_loadu_ps (sd->G + k)),
+                               _mm256_cvtps_pd (_mm_loadu_ps (sd->DCS + k)));
+    g = _mm256_add_pd (g, _mm256_cvtps_pd (q));
+    _mm_storeu_ps (sd->G + k, _mm256_cvtpd_ps (g));
+    for (i = 0; i < 4; i++)
+      sd->q[k + i][sd->qpos[k + i]] = 0;
+    __m128i next = _mm_add_epi32 (pos, _mm_set1_epi32 (1));
+    __m128i wrap = _mm_cmpeq_epi32 (next, _mm_loadu_si128 ((const __m128i *) (sd->q_count + k)));
+    _mm_storeu_si128 ((__m128i *) (sd->qpos + k), _mm_andnot_si128 (wrap, next));
+  }
+  decay_scalar (sd, k, k1);
+}
+
+// Four cells at a time, one per lane, each lane adding up its own cell's
+// synapses in order.
+__attribute__ ((target ("avx2"), optimize ("fp-contract=off")))
+static void
+sums_avx2 (SynDecay *sd, int k0, int n, int count, double eq_off,
+           double *Gsum, double *GEsum)
+{
+  __m128i idx = _mm_setr_epi32 (0, n, 2 * n, 3 * n);
+  __m256d off = _mm256_set1_pd (eq_off);
+  int c, j;
+
+  for (c = 0; c + 4 <= count; c += 4)
+  {
+    __m256d gs = _mm256_setzero_pd (), ges = _mm256_setzero_pd ();
+    for (j = 0; j < n; j++)
+    {
+      int k = k0 + c * n + j;
+      __m256d g = _mm256_cvtps_pd (_mm_i32gather_ps (sd->G + k, idx, 4));
+      __m256d eq = _mm256_sub_pd (_mm256_cvtps_pd (_mm_i32gather_ps (sd->EQ + k, idx, 4)), off);
+      gs = _mm256_add_pd (gs, g);
+      ges = _mm256_add_pd (ges, _mm256_mul_pd (g, eq));
+    }
+    _mm256_storeu_pd (Gsum + c, gs);
+    _mm256_storeu_pd (GEsum + c, ges);
+  }
+  sums_scalar (sd, k0 + c * n, n, count - c, eq_off, Gsum + c, GEsum + c);
+}
+
+__attribute__ ((target ("avx512f"), optimize ("fp-contract=off")))
+static void
+decay_avx512 (SynDecay *sd, int k0, int k1)
+{
+  int k = k0;
+  for (; k + 8 <= k1; k += 8)
+  {
+    __m256i pos = _mm256_loadu_si256 ((const __m256i *) (sd->qpos + k));
+    __m512i addr = _mm512_add_epi64 (_mm512_loadu_si512 (sd->q + k),
+                                     _mm512_slli_epi64 (_mm512_cvtepi32_epi64 (pos), 2));
+    __m256 q = _mm512_i64gather_ps (addr, (const float *) 0, 1);
+    __m512d g = _mm512_mul_pd (_mm512_cvtps_pd (_mm256_loadu_ps (sd->G + k)),
+                               _mm512_cvtps_pd (_mm256_loadu_ps (sd->DCS + k)));
+    g = _mm512_add_pd (g, _mm512_cvtps_pd (q));
+    _mm256_storeu_ps (sd->G + k, _mm512_cvtpd_ps (g));
+    _mm512_i64scatter_ps ((float *) 0, addr, _mm256_setzero_ps (), 1);
+    __m256i next = _mm256_add_epi32 (pos, _mm256_set1_epi32 (1));
+    __m256i wrap = _mm256_cmpeq_epi32 (next, _mm256_loadu_si256 ((const __m256i *) (sd->q_count + k)));
+    _mm256_storeu_si256 ((__m256i *) (sd->qpos + k), _mm256_andnot_si256 (wrap, next));
+  }
+  decay_scalar (sd, k, k1);
+}
+
+__attribute__ ((target ("avx512f"), optimize ("fp-contract=off")))
+static void
+sums_avx512 (SynDecay *sd, int k0, int n, int count, double eq_off,
+             double *Gsum, double *GEsum)
+{
+  __m256i idx = _mm256_mullo_epi32 (_mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7),
+                                    _mm256_set1_epi32 (n));
+  __m512d off = _mm512_set1_pd (eq_off);
+  int c, j;
+
+  for (c = 0; c + 8 <= count; c += 8)
+  {
+    __m512d gs = _mm512_setzero_pd (), ges = _mm512_setzero_pd ();
+    for (j = 0; j < n; j++)
+    {
+      int k = k0 + c * n + j;
+      __m512d g = _mm512_cvtps_pd (_mm256_i32gather_ps (sd->G + k, idx, 4));
+      __m512d eq = _mm512_sub_pd (_mm512_cvtps_pd (_mm256_i32gather_ps (sd->EQ + k, idx, 4)), off);
+      gs = _mm512_add_pd (gs, g);
+      ges = _mm512_add_pd (ges, _mm512_mul_pd (g, eq));
+    }
+    _mm512_storeu_pd (Gsum + c, gs);
+    _mm512_storeu_pd (GEsum + c, ges);
+  }
+  sums_scalar (sd, k0 + c * n, n, count - c, eq_off, Gsum + c, GEsum + c);
+}
+
+#endif
+
+static const SynDecayKernel kernel_scalar = {"scalar", decay_scalar, sums_scalar};
+
+SynDecayKernel syn_decay = {"scalar", decay_scalar, sums_scalar};
+
+// The kernels this CPU can run, widest first.
+int
+syn_decay_kernels (const SynDecayKernel **list)
+{
+  static SynDecayKernel have[3];
+  int count = 0;
+
+#ifdef SYNDECAY_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx512f"))
+    have[count++] = (SynDecayKernel) {"avx512", decay_avx512, sums_avx512};
+  if (__builtin_cpu_supports ("avx2"))
+    have[count++] = (SynDecayKernel) {"avx2", decay_avx2, sums_avx2};
+#endif
+  have[count++] = kernel_scalar;
+  *list = have;
+  return count;
+}
+
+const char *
+syn_decay_init (void)
+{
+  const SynDecayKernel *list;
+  int count = syn_decay_kernels (&list);
+
+  syn_decay = getenv ("SIM_SCALAR_DECAY") ? list[count - 1] : list[0];
+  return syn_decay.name;
+}
+
+// Split the cells into runs that have the same number of synapses, so
+// the vector kernels can step through several cells at once.
+void
+syn_decay_sums (SynDecay *sd, const int *syn_off, int cn0, int cn1,
+                double eq_off, double *Gsum, double *GEsum)
+{
+  int c0 = cn0, c;
+
+  while (c0 < cn1)
+  {
+    int n = syn_off[c0 + 1] - syn_off[c0];
+    for (c = c0 + 1; c < cn1 && syn_off[c + 1] - syn_off[c] == n; c++)
+      ;
+    syn_decay.sums (sd, syn_off[c0], n, c - c0, eq_off, Gsum + c0, GEsum + c0);
+    c0 = c;
+  }
+}
@@ -0,0 +1,75 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNDECAY_H
+#define SYNDECAY_H
+
+/* The per-step synaptic conductance update, run over a flat array of
+   synapses:
+
+     G = G * DCS + q[slot];  q[slot] = 0;  slot = (slot + 1) % q_count
+
+   and the per-cell sums that the next membrane update needs:
+
+     Gsum = sum of G,  GEsum = sum of G * (EQ - eq_off)
+
+   where a cell's synapses are a contiguous run of the flat array.  The
+   arithmetic is done in double and rounded to float exactly as the old
+   loop in simloop did it, and the sums are added up in synapse order,
+   so every kernel gives the same bits.  The vector kernels never fuse a
+   multiply and add.
+
+   syn_decay_init picks the widest kernel the CPU supports.  Setting
+   SIM_SCALAR_DECAY in the environment forces the scalar one.
+*/
+typedef struct
+{
+  float *G;
+  float *DCS;
+  float *EQ;
+  float **q;          // the q ring of each synapse
+  int *q_count;
+  int *qpos;          // current slot in each ring
+} SynDecay;
+
+typedef struct
+{
+  const char *name;
+  // G update for synapses k0 up to k1
+  void (*decay) (SynDecay *sd, int k0, int k1);
+  // sums for count cells that all have n synapses, the first at k0
+  void (*sums) (SynDecay *sd, int k0, int n, int count, double eq_off,
+                double *Gsum, double *GEsum);
+} SynDecayKernel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern SynDecayKernel syn_decay;
+
+const char *syn_decay_init (void);
+int syn_decay_kernels (const SynDecayKernel **list);
+void syn_decay_sums (SynDecay *sd, const int *syn_off, int cn0, int cn1,
+                     double eq_off, double *Gsum, double *GEsum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
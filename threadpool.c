@@ -0,0 +1,149 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "threadpool.h"
+#include "util.h"
+
+static pthread_t *worker;
+static int worker_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static unsigned long generation;
+static int busy;
+static int quit;
+
+static PoolFunc run_func;
+static void *run_arg;
+static int run_count;
+static atomic_int next_task;
+
+// grab tasks until there are none left
+static void
+do_tasks (void)
+{
+  int task;
+  while ((task = atomic_fetch_add (&next_task, 1)) < run_count)
+    run_func (task, run_arg);
+}
+
+static void *
+worker_main (void *unused)
+{
+  unsigned long seen = 0;
+
+  (void) unused;
+  pthread_mutex_lock (&lock);
+  while (1)
+  {
+    while (generation == seen && !quit)
+      pthread_cond_wait (&work_ready, &lock);
+    if (quit)
+      break;
+    seen = generation;
+    pthread_mutex_unlock (&lock);
+
+    do_tasks ();
+
+    pthread_mutex_lock (&lock);
+    if (--busy == 0)
+      pthread_cond_signal (&work_done);
+  }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+// nthreads counts the calling thread, so 1 means no workers at all
+void
+pool_start (int nthreads)
+{
+  int n;
+
+  if (worker_count || nthreads <= 1)
+    return;
+  TMALLOC (worker, nthreads - 1);
+  for (n = 0; n < nthreads - 1; n++)
+  {
+    if (pthread_create (worker + n, NULL, worker_main, NULL) != 0)
+    {
+      fprintf (stdout, "Could only start %d of %d worker threads\n", n, nthreads - 1);
+      break;
+    }
+  }
+  worker_count = n;
+}
+
+void
+pool_run (PoolFunc func, void *arg, int task_count)
+{
+  int task;
+
+  if (worker_count == 0 || task_count <= 1)
+  {
+    for (task = 0; task < task_count; task++)
+      func (task, arg);
+    return;
+  }
+  pthread_mutex_lock (&lock);
+  run_func = func;
+  run_arg = arg;
+  run_count = task_count;
+  atomic_store (&next_task, 0);
+  busy = worker_count;
+  generation++;
+  pthread_cond_broadcast (&work_ready);
+  pthread_mutex_unlock (&lock);
+
+  do_tasks ();
+
+  pthread_mutex_lock (&lock);
+  while (busy)
+    pthread_cond_wait (&work_done, &lock);
+  pthread_mutex_unlock (&lock);
+}
+
+void
+pool_stop (void)
+{
+  int n;
+
+  if (!worker_count)
+    return;
+  pthread_mutex_lock (&lock);
+  quit = 1;
+  pthread_cond_broadcast (&work_ready);
+  pthread_mutex_unlock (&lock);
+  for (n = 0; n < worker_count; n++)
+    pthread_join (worker[n], NULL);
+  free (worker);
+  worker = NULL;
+  worker_count = 0;
+  quit = 0;
+    // new workers start from seen = 0, the next pool_run must be news to them
+  generation = 0;
+}
+
+int
+pool_size (void)
+{
+  return worker_count + 1;
+}
@@ -0,0 +1,44 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* A fixed set of worker threads for the data-parallel parts of simloop.
+   pool_run hands out task numbers 0..task_count-1 to the workers and to
+   the calling thread, and returns when every task is finished. Tasks
+   may be picked up in any order, so a task must only write to memory
+   that no other task in the same run touches.
+*/
+
+typedef void (*PoolFunc) (int task, void *arg);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void pool_start (int nthreads);
+void pool_run (PoolFunc func, void *arg, int task_count);
+void pool_stop (void);
+int  pool_size (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -21,12 +21,20 @@ This file is part of the USF Neural Simulator suite.
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <math.h>
 #include "simulator.h"
+#include "inode.h"
+#include "cellstate.h"
+#include "csr.h"
+#include "arena.h"
+#include "expr.h"
 
 #if defined Q_OS_WIN
 #include "lin2ms.h"
 #endif
 extern bool get_essentials(bool,bool,bool,bool);
+extern int csr_flag;
 
 static void
 copy_state (Network *old, Network *new)
@@ -51,17 +59,13 @@ printf("%p %p\n",old->syntype,new->syntype);
     int cidx;
     int cell_count = MIN (pold->cell_count, pnew->cell_count);
     pnew->noise_seed = pold->noise_seed;
+    cellstate_copy (pold, pnew);
+    cellstate_scatter (pnew);
+    synstate_scatter (pold);
     for (cidx = 0; cidx < cell_count; cidx++) {
       Cell *cold = pold->cell + cidx;
       Cell *cnew = pnew->cell + cidx;
       int oldsidx, newsidx;
-      cnew->Vm_prev = cold->Vm_prev;
-      cnew->Vm = cold->Vm;
-      cnew->Gk = cold->Gk;
-      cnew->Thr = cold->Thr;
-      cnew->spike = cold->spike;
-      cnew->gnoise_e = cold->gnoise_e;
-      cnew->gnoise_i = cold->gnoise_i;
       cnew->x = cold->x;
       cnew->y = cold->y;
       cnew->z = cold->z;
@@ -89,44 +93,361 @@ printf("%p %p\n",old->syntype,new->syntype);
   }
 }
 
+// Everything sized by cells, fibers, terminals or synapses lives in the
+// network arena and goes in one arena_free. What is left is per pop,
+// including the strings load_sim gave it.
 static void
 free_net (Network *np)
 {
   int cpidx, fpidx;
   for (cpidx = 0; cpidx < np->cellpop_count; cpidx++) {
     CellPop *p = np->cellpop + cpidx;
-    int cidx;
-    for (cidx = 0; cidx < p->cell_count; cidx++) {
-      Cell *c = p->cell + cidx;
-      int sidx;
-      for (sidx = 0; sidx < c->syn_count; sidx++) {
-	Syn *s = c->syn + sidx;
-	free (s->q);
-      }
-      free (c->syn);
-      free (c->target);
-    }
-    free (p->cell);
+    cellstate_free (p);
+    synstate_free (p);
     free (p->targetpop);
+    free (p->name);
+    free (p->ic_expression);
   }
   free (np->cellpop);
   for (fpidx = 0; fpidx < np->fiberpop_count; fpidx++) {
     FiberPop *p = np->fiberpop + fpidx;
-    int fidx;
-    for (fidx = 0; fidx < p->fiber_count; fidx++) {
-      Fiber *f = p->fiber + fidx;
-      free (f->target);
-    }
-    free (p->fiber);
     free (p->targetpop);
+    free (p->afferent_file_name);
   }
   free (np->fiberpop);
   free (np->syntype);
+  arena_free (np->arena);
+  np->arena = NULL;
+  np->csr = NULL;
+}
+
+/* Most updates from simbuild only change parameters: strengths, EQ and
+   DCS, fiber probabilities, noise, time constants, thresholds.  Those
+   are patched into the running network.  It is only rebuilt when
+   something differs that build_network uses to lay it out, which is
+   what same_shape checks.
+*/
+
+static bool
+same_str (const char *a, const char *b)
+{
+  return a == b || (a && b && strcmp (a, b) == 0);
+}
+
+static bool
+same_targets (TargetPop *a, TargetPop *b, int count)
+{
+  int n;
+  for (n = 0; n < count; n++)
+    if (a[n].MCT != b[n].MCT || a[n].NCT != b[n].NCT || a[n].NT != b[n].NT
+        || a[n].IRCP != b[n].IRCP || a[n].INSED != b[n].INSED || a[n].TYPE != b[n].TYPE)
+      return false;
+  return true;
+}
+
+// The slices decide which terminals build_network cuts, and so which
+// are disabled.
+static bool
+same_slices (simulator_global *o, simulator_global *n)
+{
+  int k;
+
+  if (o->slice_count != n->slice_count)
+    return false;
+  for (k = 0; k < o->slice_count; k++)
+  {
+    Slice *a = o->slice + k, *b = n->slice + k;
+    if (a->stepnum != b->stepnum || a->ap != b->ap || a->rl != b->rl
+        || a->dp != b->dp || a->d != b->d || a->origin != b->origin)
+      return false;
+  }
+  return true;
+}
+
+// lrnWindow sizes simloop's learning wheels, so it counts as shape.
+static bool
+same_shape (simulator_global *o, simulator_global *n)
+{
+  Network *a = &o->net, *b = &n->net;
+  int pn;
+
+  if (o->step != n->step || o->ispresynaptic != n->ispresynaptic
+      || a->cellpop_count != b->cellpop_count || a->fiberpop_count != b->fiberpop_count
+      || a->syntype_count != b->syntype_count || !same_slices (o, n))
+    return false;
+  for (pn = 0; pn < a->syntype_count; pn++)
+  {
+    SynType *sa = a->syntype + pn, *sb = b->syntype + pn;
+    if (sa->SYN_TYPE != sb->SYN_TYPE || sa->PARENT != sb->PARENT || sa->lrnWindow != sb->lrnWindow)
+      return false;
+  }
+  for (pn = 0; pn < a->cellpop_count; pn++)
+  {
+    CellPop *pa = a->cellpop + pn, *pb = b->cellpop + pn;
+    if (pa->cell_count != pb->cell_count || pa->targetpop_count != pb->targetpop_count
+        || pa->pop_subtype != pb->pop_subtype || pa->haveLearn != pb->haveLearn
+        || !same_targets (pa->targetpop, pb->targetpop, pa->targetpop_count))
+      return false;
+  }
+  for (pn = 0; pn < a->fiberpop_count; pn++)
+  {
+    FiberPop *pa = a->fiberpop + pn, *pb = b->fiberpop + pn;
+    if (pa->fiber_count != pb->fiber_count || pa->targetpop_count != pb->targetpop_count
+        || pa->pop_subtype != pb->pop_subtype || pa->haveLearn != pb->haveLearn
+        || pa->num_aff != pb->num_aff || !same_str (pa->afferent_file_name, pb->afferent_file_name)
+        || !same_targets (pa->targetpop, pb->targetpop, pa->targetpop_count))
+      return false;
+  }
+  return true;
+}
+
+typedef void (*TermPatch) (Network *np, Target *t, TargetPop *tpo, TargetPop *tpn);
+
+// One source's terminals, laid out by target pop as for_source_targets
+// attached them, with the old and new target pop of each.
+static void
+source_terminals (Network *np, Target *target, TargetPop *tpo, TargetPop *tpn, int count, TermPatch func)
+{
+  int tpidx, tidx, tidx0 = 0;
+
+  for (tpidx = 0; tpidx < count; tpidx++)
+  {
+    for (tidx = 0; tidx < tpo[tpidx].NT; tidx++)
+    {
+      Target *t = target + tidx0 + tidx;
+      if (t->syn)     // no target pop, never attached
+        func (np, t, tpo + tpidx, tpn + tpidx);
+    }
+    tidx0 += tpo[tpidx].NT;
+  }
+}
+
+// Every terminal, cells then fibers, in the order build_network
+// attached them.
+static void
+all_terminals (Network *o, Network *n, TermPatch func)
+{
+  int pn, k;
+
+  for (pn = 0; pn < o->cellpop_count; pn++)
+  {
+    CellPop *po = o->cellpop + pn, *pnew = n->cellpop + pn;
+    for (k = 0; k < po->cell_count; k++)
+      source_terminals (o, po->cell[k].target, po->targetpop, pnew->targetpop, po->targetpop_count, func);
+  }
+  for (pn = 0; pn < o->fiberpop_count; pn++)
+  {
+    FiberPop *po = o->fiberpop + pn, *pnew = n->fiberpop + pn;
+    for (k = 0; k < po->fiber_count; k++)
+      source_terminals (o, po->fiber[k].target, po->targetpop, pnew->targetpop, po->targetpop_count, func);
+  }
+}
+
+// A synapse with a terminal whose STR changes is marked by a NaN
+// lrn_strength until its strengths are redone.
+static void
+new_strength (Network *np, Target *t, TargetPop *tpo, TargetPop *tpn)
+{
+  if (tpo->STR == tpn->STR)
+    return;
+  t->strength = tpn->STR;
+  if (csr_flag)
+    CSR (np)->strength[t - CSR (np)->target_pool] = tpn->STR;
+  t->syn->lrn_strength = NAN;
+}
+
+// As in set_strengths, a synapse gets the STR of its last terminal.
+static void
+syn_strength (Network *np, Target *t, TargetPop *tpo, TargetPop *tpn)
+{
+  (void) np, (void) tpo, (void) tpn;
+  if (isnan (t->syn->lrn_strength))
+    t->syn->initial_strength = t->strength;
+}
+
+// Copy member m from n to o, counting it if it changed.
+#define PATCH(o,n,m) do { if ((o)->m != (n)->m) { (o)->m = (n)->m; changed++; } } while (0)
+
+/* Patch the parameters of the new network n into the running one o,
+   which same_shape has found laid out the same.  The synapses whose
+   strength changes start learning over from it, as they would in a
+   rebuilt network; the rest of the state is left as it is.  Returns how
+   many parameters changed.
+*/
+static int
+patch_net (Network *o, Network *n)
+{
+  bool syntypes = false, strengths = false, expressions = false;
+  int changed = 0, pn, k, cn, sidx;
+
+  for (k = 0; k < o->syntype_count; k++)
+  {
+    SynType *so = o->syntype + k, *sn = n->syntype + k;
+    int before = changed;
+    PATCH (so, sn, EQ);
+    PATCH (so, sn, DCS);
+    PATCH (so, sn, lrnStrMax);
+    PATCH (so, sn, lrnStrDelta);
+    syntypes |= changed != before;
+  }
+
+  for (pn = 0; pn < o->cellpop_count && !strengths; pn++)
+    for (k = 0; k < o->cellpop[pn].targetpop_count; k++)
+      strengths |= o->cellpop[pn].targetpop[k].STR != n->cellpop[pn].targetpop[k].STR;
+  for (pn = 0; pn < o->fiberpop_count && !strengths; pn++)
+    for (k = 0; k < o->fiberpop[pn].targetpop_count; k++)
+      strengths |= o->fiberpop[pn].targetpop[k].STR != n->fiberpop[pn].targetpop[k].STR;
+  if (strengths)
+  {
+    all_terminals (o, n, new_strength);
+    all_terminals (o, n, syn_strength);
+  }
+
+  for (pn = 0; pn < o->cellpop_count; pn++)
+  {
+    CellPop *po = o->cellpop + pn, *pnew = n->cellpop + pn;
+    SynState *ss = SYNSTATE (po);
+    PATCH (po, pnew, R0);
+    PATCH (po, pnew, TMEM);
+    PATCH (po, pnew, B);
+    PATCH (po, pnew, DCG);
+    PATCH (po, pnew, GE0);
+    PATCH (po, pnew, MGC);
+    PATCH (po, pnew, DCTH);
+    PATCH (po, pnew, Th0);
+    PATCH (po, pnew, Th0_sd);
+    PATCH (po, pnew, theta_h);
+    PATCH (po, pnew, sigma_h);
+    PATCH (po, pnew, theta_m);
+    PATCH (po, pnew, sigma_m);
+    PATCH (po, pnew, Vreset);
+    PATCH (po, pnew, Vthresh);
+    PATCH (po, pnew, delta_h);
+    PATCH (po, pnew, taubar_h);
+    PATCH (po, pnew, g_NaP_h);
+    PATCH (po, pnew, noise_amp);
+    PATCH (po, pnew, fr);
+    PATCH (po, pnew, TGK);
+    for (k = 0; k < po->targetpop_count; k++)
+      PATCH (po->targetpop + k, pnew->targetpop + k, STR);
+    if (!same_str (po->ic_expression, pnew->ic_expression))
+    {
+      free (po->ic_expression);
+      po->ic_expression = pnew->ic_expression;
+      pnew->ic_expression = NULL;
+      expressions = true;
+      changed++;
+    }
+
+    if (!syntypes && !strengths)
+      continue;
+    for (cn = 0, k = 0; cn < po->cell_count; cn++)
+    {
+      Cell *c = po->cell + cn;
+      for (sidx = 0; sidx < c->syn_count; sidx++, k++)
+      {
+        Syn *s = c->syn + sidx;
+        SynType *st = o->syntype + s->stidx;
+        s->EQ = st->EQ;
+        s->DCS = st->DCS;
+        s->lrnStrMax = st->lrnStrMax;
+        s->lrnStrDelta = st->lrnStrDelta;
+        if (isnan (s->lrn_strength))
+          s->lrn_strength = s->initial_strength;
+        if (ss)   // the decay kernels' copies, laid out as synstate_alloc does
+        {
+          ss->sd.EQ[k] = s->EQ;
+          ss->sd.DCS[k] = s->DCS;
+        }
+      }
+    }
+      // this step's sums were taken with the old EQ and DCS, the next
+      // step would integrate with them
+    if (ss && syntypes)
+      synstate_sums (po, 0, po->cell_count);
+  }
+
+  for (pn = 0; pn < o->fiberpop_count; pn++)
+  {
+    FiberPop *po = o->fiberpop + pn, *pnew = n->fiberpop + pn;
+    int start = ceil (pnew->start / S.step);
+    int stop = ceil (pnew->stop / S.step);
+    PATCH (po, pnew, probability);
+    PATCH (po, pnew, freq_type);
+    PATCH (po, pnew, frequency);
+    PATCH (po, pnew, fuzzy_range);
+    PATCH (po, pnew, offset);
+    PATCH (po, pnew, slope_scale);
+    for (k = 0; k < po->targetpop_count; k++)
+      PATCH (po->targetpop + k, pnew->targetpop + k, STR);
+    for (k = 0; k < MAX_AFFERENT_PROB; k++)
+    {
+      PATCH (po, pnew, aff_val[k]);
+      PATCH (po, pnew, aff_prob[k]);
+    }
+      // build_network keeps these in steps
+    if (po->start != start || po->stop != stop)
+    {
+      po->start = start;
+      po->stop = stop;
+      if (po->pop_subtype == ELECTRIC_STIM)
+        po->next_stim = po->next_fixed = start;
+      changed++;
+    }
+  }
+
+  if (expressions)
+  {
+      // pops with the same text share an evaluator, free each one once
+    for (pn = 0; pn < o->cellpop_count; pn++)
+    {
+      Expr *e = o->cellpop[pn].ic_evaluator;
+      if (!e)
+        continue;
+      for (k = pn; k < o->cellpop_count; k++)
+        if (o->cellpop[k].ic_evaluator == e)
+          o->cellpop[k].ic_evaluator = NULL;
+      xp_free (e);
+    }
+    compile_ic_expressions ();
+  }
+  return changed;
+}
+
+// load_sim reallocs whatever S points to, so the update gets its own
+// file names and slices, and the running ones stay as they were until
+// same_shape has compared them.
+static void
+detach_loaded (void)
+{
+  S.slice = NULL;
+  S.slice_count = 0;
+  S.snd_file_name = NULL;
+  S.input_filename = NULL;
+}
+
+// Take the file names and slices of the update n.  The running network
+// keeps its own equations, so drop the copies read_snd made.
+static void
+adopt_loaded (simulator_global *o, simulator_global *n)
+{
+  free (o->slice);
+  free (o->snd_file_name);
+  free (o->input_filename);
+  S.slice = n->slice;
+  S.slice_count = n->slice_count;
+  S.snd_file_name = n->snd_file_name;
+  S.input_filename = n->input_filename;
+  if (n->phrenic_equation != o->phrenic_equation)
+    free (n->phrenic_equation);
+  if (n->lumbar_equation != o->lumbar_equation)
+    free (n->lumbar_equation);
 }
 
 // Called in response to command from simbuild.
 // A sim file with updated params is available. Use the
-// new params.
+// new params, patched in if the network keeps its layout,
+// otherwise in a rebuilt network.
 void
 update (void)
 {
@@ -134,8 +455,30 @@ update (void)
    fflush(stdout);
    simulator_global old_S = S, new_S;
    memset (&S.net, 0, sizeof S.net);
+   detach_loaded ();
    get_essentials(false,false,true,false);
-   read_sim();
+   load_sim();
+   if (same_shape (&old_S, &S))
+   {
+      clock_t start = clock ();
+      int changed;
+      new_S = S;
+      S = old_S;
+      S.Gm0 = new_S.Gm0;
+      S.Vm0 = new_S.Vm0;
+      S.Ek  = new_S.Ek;
+      S.step_count = new_S.step_count;
+      adopt_loaded (&old_S, &new_S);
+      changed = patch_net (&S.net, &new_S.net);
+      free_net (&new_S.net);
+      printf("%d parameters changed, patched into the running network in %.3f ms\n",
+             changed, (clock () - start) * 1000. / CLOCKS_PER_SEC);
+      printf("Mid-run update parameters have been loaded.\n");
+      fflush(stdout);
+      return;
+   }
+   printf("The update changes the layout of the network, rebuilding it\n");
+   build_sim();
    new_S = S;
    S = old_S;
     
@@ -145,9 +488,12 @@ update (void)
    S.Gm0            = new_S.Gm0;
    S.Vm0            = new_S.Vm0;
    S.Ek             = new_S.Ek;
-   S.snd_file_name  = new_S.snd_file_name;
+   adopt_loaded (&old_S, &new_S);
    copy_state (&old_S.net, &S.net);
+   clock_t start = clock ();
    free_net (&old_S.net);
+   printf("Old network released in %.3f ms\n",
+          (clock () - start) * 1000. / CLOCKS_PER_SEC);
 
    printf("Mid-run update parameters have been loaded.\n");
    fflush(stdout);
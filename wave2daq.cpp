@@ -43,6 +43,8 @@ This file is part of a collection of recording processing software.
 #include <sstream>
 #include <array>
 
+#include "wavefile.h"
+
 using namespace std;
 
 const int CHANS_PER_FILE = 64;
@@ -73,7 +75,8 @@ static void usage(char * name)
    printf (
 "\nUsage: %s "\
 "[-v launch number] -o outname\n"\
-"Read all the wave.launch_number.???? files and make .daq file(s).\n"\
+"Read the wave.launch_number.bin file, or if there is none, all the\n"\
+"wave.launch_number.???? files, and make .daq file(s).\n"\
 ,name);
 }
 
@@ -176,6 +179,22 @@ static bool findFirst()
    daq file are 2's complement words where 0xFFFF is 2.5 v, 0x8000 is 0 v 
    and 0x0000 is -2.5v.  
 */
+static short toDaq(float mv)
+{
+   int val = mv * 1000 + 0x8000;
+   if (val > 0xffff)
+   {
+      val = 0xffff;
+      cout << " ** POS CLIP" << endl;
+   }
+   else if (val < 0)
+   {
+      val = 0;
+      cout << " ** NEG CLIP" << endl;
+   }
+   return short(val);
+}
+
 static void makeDaq()
 {
    size_t maxname;
@@ -189,7 +208,6 @@ static void makeDaq()
    float mv;
    char inbuf[80] = {0};
    int idx;
-   int val;
    oneSample daq;
    ofstream daqStream(outName);
 
@@ -219,24 +237,50 @@ static void makeDaq()
             waveStrm.getline(inbuf, sizeof(inbuf));
             if (sscanf(inbuf,"%f",&mv) != 1)
                cout << "failed to read " << inbuf << endl;
-            val = mv * 1000 + 0x8000;
-            if (val > 0xffff)
-            {
-               val = 0xffff;
-               cout << " ** POS CLIP" << endl;
-            }
-            else if (val < 0)
-            {
-               val = 0;
-               cout << " ** NEG CLIP" << endl;
-            }
-            daq[idx++] = short(val);
+            daq[idx++] = toDaq(mv);
          }
          daqStream.write((const char*)daq.data(),sizeof(daq));
       }
       fStream.close();
    }
 }
+/*
+   Same thing from the binary wave file. Channels past the 64th are
+   dropped, as they are for the text files.
+*/
+static bool makeDaqBin(const char *name)
+{
+   WaveFile *wf = wave_open(name);
+   oneSample daq;
+   int got, blocks = 0;
+
+   if (!wf)
+   {
+      cerr << "***********Error opening " << name << endl;
+      return false;
+   }
+   ofstream daqStream(outName);
+   while ((got = wave_read_block(wf)) > 0)
+   {
+      int chans = min(wf->plot_count, DAQ_DATA_SIZ);
+      for (int rec = 0; rec < wf->nrecs; ++rec)
+      {
+         daq.fill(0x8000);
+         daq[0] = 0;
+         daq[1] = 0;
+         for (int chan = 0; chan < chans; ++chan)
+            daq[chan+2] = toDaq(wave_val(wf, chan, rec));
+         daqStream.write((const char*)daq.data(),sizeof(daq));
+      }
+      ++blocks;
+   }
+   wave_free(wf);
+   if (got < 0)
+      cerr << "***********Problem with " << name << endl;
+   cout << "Found " << blocks << " wave blocks." << endl;
+   return got == 0;
+}
+
 /*
    arg is launch number, defaults to 0
    Read first wave file to get number of chans. 
@@ -250,6 +294,10 @@ int main (int argc, char **argv)
 
    cout << argv[0] << "Version: " << VERSION << endl;
    parse_args(argc, argv);
+   char binName[32];
+   sprintf(binName,"wave.%02d.bin",launchNum);
+   if (access(binName, R_OK) == 0)
+      return makeDaqBin(binName) ? 0 : 1;
    if (!findFirst())
       exit(1);
    makeDaq();
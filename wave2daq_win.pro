@@ -29,7 +29,8 @@ win32 {
    DEFINES -= _UNICODE
    QT -= gui
 
-   SOURCES += wave2daq.cpp
+   SOURCES += wave2daq.cpp wavefile.c
+   HEADERS += wavefile.h
 
    DEFINES += S64_NOTDLL
    CONFIG -= debug
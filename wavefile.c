@@ -0,0 +1,653 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Reader and writer for the binary wave file, see wavefile.h.
+   This is shared by simrun, simviewer, simpickwave and wave2daq, so it
+   reports errors by return value and leaves the complaining to them.
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "wavefile.h"
+
+typedef struct
+{
+  char magic[8];
+  int32_t version, spawn;
+  double step;
+  int32_t block_steps, flags;
+} FileHeader;
+
+typedef struct
+{
+  int64_t index;
+  char magic[8];
+} Trailer;
+
+static int
+grow_buf (WaveFile *w, size_t size)
+{
+  unsigned char *buf;
+
+  if (size <= w->buf_size)
+    return 0;
+  if ((buf = realloc (w->buf, size)) == 0)
+    return -1;
+  w->buf = buf;
+  w->buf_size = size;
+  return 0;
+}
+
+static int
+add_index (WaveFile *w, int64_t data, int64_t plots)
+{
+  if (w->index_count == w->index_size)
+  {
+    long size = w->index_size ? w->index_size * 2 : 1024;
+    WaveIndex *index = realloc (w->index, size * sizeof *index);
+    if (index == 0)
+      return -1;
+    w->index = index;
+    w->index_size = size;
+  }
+  w->index[w->index_count].data = data;
+  w->index[w->index_count].plots = plots;
+  w->index_count++;
+  return 0;
+}
+
+static void
+free_plots (WaveFile *w)
+{
+  for (int n = 0; n < w->plot_count; n++)
+    free (w->plot[n].lbl);
+  free (w->plot);
+  w->plot = 0;
+  w->plot_count = 0;
+}
+
+static int
+same_plots (const WaveFile *w, int count, const WavePlot *plot)
+{
+  if (count != w->plot_count)
+    return 0;
+  for (int n = 0; n < count; n++)
+    if (plot[n].pop != w->plot[n].pop || plot[n].cell != w->plot[n].cell
+        || plot[n].var != w->plot[n].var || plot[n].type != w->plot[n].type
+        || strcmp (plot[n].lbl ? plot[n].lbl : "", w->plot[n].lbl))
+      return 0;
+  return 1;
+}
+
+static int
+copy_plots (WaveFile *w, int count, const WavePlot *plot)
+{
+  free_plots (w);
+  if (count && (w->plot = calloc (count, sizeof *w->plot)) == 0)
+    return -1;
+  w->plot_count = count;
+  for (int n = 0; n < count; n++)
+  {
+    w->plot[n] = plot[n];
+    if ((w->plot[n].lbl = strdup (plot[n].lbl ? plot[n].lbl : "")) == 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int
+write_chunk (WaveFile *w, int tag, int a, int b, size_t size)
+{
+  WaveChunk *ch = (WaveChunk *) w->buf;
+
+  ch->tag = tag;
+  ch->size = size;
+  ch->a = a;
+  ch->b = b;
+  if (w->sink)
+    w->sink (w->sink_arg, w->buf, sizeof *ch + size);
+  else if (fwrite (w->buf, sizeof *ch + size, 1, w->fp) != 1 || fflush (w->fp))
+    return -1;
+  return 0;
+}
+
+// where the next chunk goes
+static int64_t
+write_pos (WaveFile *w)
+{
+  return w->sink ? 0 : ftello (w->fp);
+}
+
+/* Create name and write the file header.  The caller adds a PLOTS chunk
+   before the first block.
+*/
+WaveFile *
+wave_create (const char *name, int spawn, double step)
+{
+  WaveFile *w;
+  FileHeader fh = {WAVE_MAGIC, WAVE_VERSION, spawn, step, WAVE_BLOCK_STEPS, 0};
+
+  if ((w = calloc (1, sizeof *w)) == 0)
+    return 0;
+  if ((w->fp = fopen (name, "wb")) == 0)
+  {
+    free (w);
+    return 0;
+  }
+  w->writing = 1;
+  w->version = WAVE_VERSION;
+  w->spawn = spawn;
+  w->step = step;
+  w->block_steps = WAVE_BLOCK_STEPS;
+  w->plots_off = -1;
+  if (fwrite (&fh, sizeof fh, 1, w->fp) != 1 || fflush (w->fp))
+  {
+    wave_free (w);
+    return 0;
+  }
+  return w;
+}
+
+/* Same, but each chunk goes to sink, which has to copy it.  */
+WaveFile *
+wave_create_sink (WaveSink sink, void *arg, int spawn, double step)
+{
+  WaveFile *w;
+  FileHeader fh = {WAVE_MAGIC, WAVE_VERSION, spawn, step, WAVE_BLOCK_STEPS, 0};
+
+  if ((w = calloc (1, sizeof *w)) == 0)
+    return 0;
+  w->sink = sink;
+  w->sink_arg = arg;
+  w->writing = 1;
+  w->version = WAVE_VERSION;
+  w->spawn = spawn;
+  w->step = step;
+  w->block_steps = WAVE_BLOCK_STEPS;
+  w->plots_off = -1;
+  if (grow_buf (w, sizeof (WaveChunk) + sizeof fh))
+  {
+    wave_free (w);
+    return 0;
+  }
+  memcpy (w->buf + sizeof (WaveChunk), &fh, sizeof fh);
+  write_chunk (w, WAVE_CHUNK_HEADER, 0, 0, sizeof fh);
+  return w;
+}
+
+/* Describe the plots for the blocks that follow.  Nothing is written if
+   they are the same as last time, so this can be called for every
+   block.
+*/
+int
+wave_write_plots (WaveFile *w, int count, const WavePlot *plot)
+{
+  size_t size = 0;
+  unsigned char *p;
+
+  if (w->plots_off >= 0 && same_plots (w, count, plot))
+    return 0;
+  for (int n = 0; n < count; n++)
+    size += 5 * sizeof (int32_t) + ((strlen (plot[n].lbl ? plot[n].lbl : "") + 3) & ~3);
+  if (grow_buf (w, sizeof (WaveChunk) + size))
+    return -1;
+  memset (w->buf, 0, sizeof (WaveChunk) + size);
+  p = w->buf + sizeof (WaveChunk);
+  for (int n = 0; n < count; n++)
+  {
+    const char *lbl = plot[n].lbl ? plot[n].lbl : "";
+    int32_t v[5] = {plot[n].pop, plot[n].cell, plot[n].var, plot[n].type, strlen (lbl)};
+    memcpy (p, v, sizeof v);
+    memcpy (p + sizeof v, lbl, v[4]);
+    p += sizeof v + ((v[4] + 3) & ~3);
+  }
+  w->plots_off = write_pos (w);
+  if (copy_plots (w, count, plot))
+    return -1;
+  return write_chunk (w, WAVE_CHUNK_PLOTS, count, 0, size);
+}
+
+/* Append one block.  val holds nrecs values for each plot in turn and
+   spike the matching 0/1 flags, one byte each; they are packed to bits
+   here.
+*/
+int
+wave_write_block (WaveFile *w, int block, int nrecs, const float *val, const unsigned char *spike)
+{
+  int count = w->plot_count;
+  int stride = (nrecs + 7) / 8;
+  size_t vsize = (size_t) count * nrecs * sizeof *val;
+  size_t size = (vsize + (size_t) count * stride + 3) & ~(size_t) 3;
+  unsigned char *p;
+
+  if (w->plots_off < 0 || grow_buf (w, sizeof (WaveChunk) + size))
+    return -1;
+  p = w->buf + sizeof (WaveChunk);
+  memcpy (p, val, vsize);
+  p += vsize;
+  memset (p, 0, size - vsize);
+  for (int n = 0; n < count; n++, p += stride, spike += nrecs)
+    for (int rec = 0; rec < nrecs; rec++)
+      if (spike[rec])
+        p[rec / 8] |= 1 << rec % 8;
+  if (!w->sink && add_index (w, write_pos (w), w->plots_off))
+    return -1;
+  return write_chunk (w, WAVE_CHUNK_DATA, block, nrecs, size);
+}
+
+/* Finish the file with the block index and close it.  */
+int
+wave_close (WaveFile *w)
+{
+  int err = 0;
+  size_t size = w->index_count * sizeof *w->index;
+  Trailer tr = {0, WAVE_INDEX_MAGIC};
+
+  if (w->sink)
+  {
+    wave_free (w);
+    return 0;
+  }
+  tr.index = ftello (w->fp);
+  if (grow_buf (w, sizeof (WaveChunk) + size))
+    err = -1;
+  else
+  {
+    memcpy (w->buf + sizeof (WaveChunk), w->index, size);
+    err = write_chunk (w, WAVE_CHUNK_INDEX, w->index_count, 0, size);
+  }
+  if (!err && (fwrite (&tr, sizeof tr, 1, w->fp) != 1 || fflush (w->fp)))
+    err = -1;
+  wave_free (w);
+  return err;
+}
+
+static int read_chunk (WaveFile *w, WaveChunk *ch, int64_t *pos);
+static int parse_plots (WaveFile *w, const WaveChunk *ch);
+
+/* Go on writing name, a file wave_create made, from offset size, which
+   has to be at the end of a chunk.  Anything after it is cut off.  The
+   index and the plots in force are rebuilt from the chunks before it.
+*/
+WaveFile *
+wave_append (const char *name, int64_t size)
+{
+  WaveFile *w;
+  FileHeader fh;
+  WaveChunk ch;
+  int64_t pos;
+
+  if ((w = calloc (1, sizeof *w)) == 0)
+    return 0;
+  if ((w->fp = fopen (name, "r+b")) == 0)
+  {
+    free (w);
+    return 0;
+  }
+  if (fread (&fh, sizeof fh, 1, w->fp) != 1
+      || memcmp (fh.magic, WAVE_MAGIC, sizeof fh.magic)
+      || fh.version != WAVE_VERSION || size < (int64_t) sizeof fh)
+  {
+    wave_free (w);
+    return 0;
+  }
+  w->version = fh.version;
+  w->spawn = fh.spawn;
+  w->step = fh.step;
+  w->block_steps = fh.block_steps;
+  w->plots_off = -1;
+  while (ftello (w->fp) < size)
+  {
+    if (!read_chunk (w, &ch, &pos)
+        || (ch.tag == WAVE_CHUNK_PLOTS && parse_plots (w, &ch))
+        || (ch.tag == WAVE_CHUNK_DATA && add_index (w, pos, w->plots_off))
+        || (ch.tag != WAVE_CHUNK_PLOTS && ch.tag != WAVE_CHUNK_DATA))
+    {
+      wave_free (w);
+      return 0;
+    }
+    if (ch.tag == WAVE_CHUNK_PLOTS)
+      w->plots_off = pos;
+  }
+  if (ftello (w->fp) != size || fflush (w->fp) || ftruncate (fileno (w->fp), size))
+  {
+    wave_free (w);
+    return 0;
+  }
+  w->writing = 1;
+  return w;
+}
+
+/* Read the chunk at the current position into w->buf.  Returns 1 if
+   there is a whole chunk, 0 if it is not all there yet, in which case
+   the position is left at its start.
+*/
+static int
+read_chunk (WaveFile *w, WaveChunk *ch, int64_t *pos)
+{
+  *pos = ftello (w->fp);
+  if (fread (ch, sizeof *ch, 1, w->fp) == 1 && ch->size >= 0
+      && grow_buf (w, ch->size + 1) == 0
+      && (ch->size == 0 || fread (w->buf, ch->size, 1, w->fp) == 1))
+    return 1;
+  clearerr (w->fp);
+  fseeko (w->fp, *pos, SEEK_SET);
+  return 0;
+}
+
+static int
+parse_plots (WaveFile *w, const WaveChunk *ch)
+{
+  const unsigned char *p = w->buf, *end = w->buf + ch->size;
+  WavePlot *plot = 0;
+  int err = 0;
+
+  if (ch->a < 0 || (ch->a && (plot = calloc (ch->a, sizeof *plot)) == 0))
+    return -1;
+  for (int n = 0; n < ch->a && !err; n++)
+  {
+    int32_t v[5];
+    if (p + sizeof v > end)
+    {
+      err = -1;
+      break;
+    }
+    memcpy (v, p, sizeof v);
+    p += sizeof v;
+    if (v[4] < 0 || p + v[4] > end || (plot[n].lbl = malloc (v[4] + 1)) == 0)
+    {
+      err = -1;
+      break;
+    }
+    plot[n].pop = v[0];
+    plot[n].cell = v[1];
+    plot[n].var = v[2];
+    plot[n].type = v[3];
+    memcpy (plot[n].lbl, p, v[4]);
+    plot[n].lbl[v[4]] = 0;
+    p += (v[4] + 3) & ~3;
+  }
+  if (!err)
+  {
+    free_plots (w);
+    w->plot = plot;
+    w->plot_count = ch->a;
+    w->plots_changed = 1;
+  }
+  else if (ch->a)
+  {
+    for (int n = 0; n < ch->a; n++)
+      free (plot[n].lbl);
+    free (plot);
+  }
+  return err;
+}
+
+static int
+parse_data (WaveFile *w, const WaveChunk *ch)
+{
+  int stride = (ch->b + 7) / 8;
+  size_t vsize = (size_t) w->plot_count * ch->b * sizeof (float);
+
+  if (ch->b < 0 || vsize + (size_t) w->plot_count * stride > (size_t) ch->size)
+    return -1;
+  w->block = ch->a;
+  w->nrecs = ch->b;
+  w->val = (float *) w->buf;
+  w->spike = w->buf + vsize;
+  w->spike_stride = stride;
+  return 0;
+}
+
+/* Open a binary wave file for reading, which may still be being
+   written.  If it is complete, its index is read as well.
+*/
+WaveFile *
+wave_open (const char *name)
+{
+  WaveFile *w;
+  FileHeader fh;
+  Trailer tr;
+  WaveChunk ch;
+
+  if ((w = calloc (1, sizeof *w)) == 0)
+    return 0;
+  if ((w->fp = fopen (name, "rb")) == 0)
+  {
+    free (w);
+    return 0;
+  }
+  if (fread (&fh, sizeof fh, 1, w->fp) != 1
+      || memcmp (fh.magic, WAVE_MAGIC, sizeof fh.magic)
+      || fh.version != WAVE_VERSION)
+  {
+    wave_free (w);
+    return 0;
+  }
+  w->version = fh.version;
+  w->spawn = fh.spawn;
+  w->step = fh.step;
+  w->block_steps = fh.block_steps;
+  w->plots_off = -1;
+  w->scan_off = sizeof fh;
+  w->scan_plots = -1;
+
+  if (fseeko (w->fp, -(off_t) sizeof tr, SEEK_END) == 0
+      && fread (&tr, sizeof tr, 1, w->fp) == 1
+      && memcmp (tr.magic, WAVE_INDEX_MAGIC, sizeof tr.magic) == 0
+      && fseeko (w->fp, tr.index, SEEK_SET) == 0
+      && fread (&ch, sizeof ch, 1, w->fp) == 1
+      && ch.tag == WAVE_CHUNK_INDEX && ch.a >= 0
+      && (w->index = malloc ((ch.a ? ch.a : 1) * sizeof *w->index))
+      && fread (w->index, sizeof *w->index, ch.a, w->fp) == (size_t) ch.a)
+  {
+    w->index_count = w->index_size = ch.a;
+    w->indexed = 1;
+  }
+  else if (w->index)
+  {
+    free (w->index);
+    w->index = 0;
+  }
+  clearerr (w->fp);
+  fseeko (w->fp, sizeof fh, SEEK_SET);
+  return w;
+}
+
+/* Does name start like a binary wave file?  */
+int
+wave_is_binary (const char *name)
+{
+  char magic[8];
+  FILE *fp = fopen (name, "rb");
+  int ok;
+
+  if (fp == 0)
+    return 0;
+  ok = fread (magic, sizeof magic, 1, fp) == 1 && memcmp (magic, WAVE_MAGIC, sizeof magic) == 0;
+  fclose (fp);
+  return ok;
+}
+
+/* Read the next block, taking in any PLOTS chunk on the way.  Returns 1
+   if there is one, 0 at the end of the data written so far, or -1 if
+   the file is bad.
+*/
+int
+wave_read_block (WaveFile *w)
+{
+  WaveChunk ch;
+  int64_t pos;
+
+  while (read_chunk (w, &ch, &pos))
+  {
+    switch (ch.tag)
+    {
+      case WAVE_CHUNK_PLOTS:
+        if (parse_plots (w, &ch))
+          return -1;
+        w->plots_off = pos;
+        break;
+      case WAVE_CHUNK_DATA:
+        if (w->plots_off < 0 || parse_data (w, &ch))
+          return -1;
+        return 1;
+      case WAVE_CHUNK_INDEX:
+        fseeko (w->fp, pos, SEEK_SET);
+        return 0;
+      default:
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/* Extend the index over whatever has been written since the last look.  */
+static void
+scan_index (WaveFile *w)
+{
+  int64_t here = ftello (w->fp), end;
+  WaveChunk ch;
+
+  fseeko (w->fp, 0, SEEK_END);
+  end = ftello (w->fp);
+  while (w->scan_off + (int64_t) sizeof ch <= end
+         && fseeko (w->fp, w->scan_off, SEEK_SET) == 0
+         && fread (&ch, sizeof ch, 1, w->fp) == 1
+         && ch.size >= 0 && w->scan_off + (int64_t) sizeof ch + ch.size <= end)
+  {
+    if (ch.tag == WAVE_CHUNK_PLOTS)
+      w->scan_plots = w->scan_off;
+    else if (ch.tag == WAVE_CHUNK_DATA)
+    {
+      if (add_index (w, w->scan_off, w->scan_plots))
+        break;
+    }
+    else
+    {
+      w->indexed = ch.tag == WAVE_CHUNK_INDEX;
+      break;
+    }
+    w->scan_off += sizeof ch + ch.size;
+  }
+  clearerr (w->fp);
+  fseeko (w->fp, here, SEEK_SET);
+}
+
+/* Number of blocks in the file so far.  */
+long
+wave_block_count (WaveFile *w)
+{
+  if (!w->indexed)
+    scan_index (w);
+  return w->index_count;
+}
+
+/* Position the file so the next wave_read_block returns the block with
+   ordinal n, counting from 0, with the plots in force for it.
+*/
+int
+wave_seek_block (WaveFile *w, long n)
+{
+  WaveChunk ch;
+  int64_t pos;
+
+  if (n >= w->index_count && !w->indexed)
+    scan_index (w);
+  if (n < 0 || n >= w->index_count)
+    return -1;
+  if (w->index[n].plots != w->plots_off)
+  {
+    if (fseeko (w->fp, w->index[n].plots, SEEK_SET)
+        || !read_chunk (w, &ch, &pos) || ch.tag != WAVE_CHUNK_PLOTS
+        || parse_plots (w, &ch))
+      return -1;
+    w->plots_off = pos;
+  }
+  return fseeko (w->fp, w->index[n].data, SEEK_SET);
+}
+
+/* A reader for chunks that come from somewhere other than a file.  */
+WaveFile *
+wave_decoder (void)
+{
+  WaveFile *w;
+
+  if ((w = calloc (1, sizeof *w)) == 0)
+    return 0;
+  w->plots_off = -1;
+  return w;
+}
+
+/* Take in one whole chunk, size bytes with its header.  Returns 1 if it
+   was a block, 0 if it was something else, -1 if it is bad.
+*/
+int
+wave_decode (WaveFile *w, const void *chunk, size_t size)
+{
+  WaveChunk ch;
+  FileHeader fh;
+
+  if (size < sizeof ch)
+    return -1;
+  memcpy (&ch, chunk, sizeof ch);
+  if (ch.size < 0 || sizeof ch + ch.size != size || grow_buf (w, ch.size + 1))
+    return -1;
+  memcpy (w->buf, (const unsigned char *) chunk + sizeof ch, ch.size);
+  switch (ch.tag)
+  {
+    case WAVE_CHUNK_HEADER:
+      if ((size_t) ch.size < sizeof fh)
+        return -1;
+      memcpy (&fh, w->buf, sizeof fh);
+      if (memcmp (fh.magic, WAVE_MAGIC, sizeof fh.magic) || fh.version != WAVE_VERSION)
+        return -1;
+      w->version = fh.version;
+      w->spawn = fh.spawn;
+      w->step = fh.step;
+      w->block_steps = fh.block_steps;
+      return 0;
+    case WAVE_CHUNK_PLOTS:
+      if (parse_plots (w, &ch))
+        return -1;
+      w->plots_off = 0;
+      return 0;
+    case WAVE_CHUNK_DATA:
+      if (w->plots_off < 0 || parse_data (w, &ch))
+        return -1;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void
+wave_free (WaveFile *w)
+{
+  if (w->fp)
+    fclose (w->fp);
+  free_plots (w);
+  free (w->index);
+  free (w->buf);
+  free (w);
+}
@@ -0,0 +1,159 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WAVEFILE_H
+#define WAVEFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Binary wave file, one per spawn: wave.NN.bin.
+
+   simrun used to write a new text file, wave.NN.NNNN, every 100 steps.
+   The binary file holds the same information in a single file that
+   simrun appends to as it goes:
+
+     file header   "SIMWAVE\0", version, spawn number, step size, steps per block
+     PLOTS chunk   pop, cell, var, type and label of each plot
+     DATA chunk    one block of up to 100 steps:
+                     float32 values, one column of nrecs values per plot,
+                     then one row of nrecs spike bits per plot, lsb first
+     DATA chunk    ...
+     PLOTS chunk   only if a mid-run update changed the plots
+     DATA chunk    ...
+     INDEX chunk   file offsets of each DATA chunk and the PLOTS chunk
+                   that describes it, written when simrun finishes
+     trailer       offset of the INDEX chunk, "WAVEIDX\0"
+
+   Every chunk starts with a 16 byte header: tag, payload size, and two
+   tag-specific ints (block number and nrecs for DATA, the plot count
+   for PLOTS, the entry count for INDEX).  Each chunk is written with a
+   single fwrite and flushed, so a reader following a run that is still
+   going only has to wait until the whole chunk is there.  A file from
+   a run that did not finish has no index; wave_block_count and
+   wave_seek_block build one by walking the chunk headers.  A run that
+   resumes from a checkpoint cuts the file back to where it was at the
+   checkpoint with wave_append and goes on from there.
+
+   Values are in host byte order, which is little endian on everything
+   the simulator runs on.
+
+   The same chunks go over the socket to simviewer.  A writer made with
+   wave_create_sink hands each chunk to a sink function instead of a
+   file, starting with a HEADER chunk that carries the file header, and
+   writes no index.  The reader side is wave_decoder and wave_decode.
+*/
+
+#define WAVE_MAGIC       "SIMWAVE"
+#define WAVE_INDEX_MAGIC "WAVEIDX"
+#define WAVE_VERSION     1
+#define WAVE_BLOCK_STEPS 100
+
+enum {WAVE_CHUNK_PLOTS = 1, WAVE_CHUNK_DATA, WAVE_CHUNK_INDEX, WAVE_CHUNK_HEADER};
+
+typedef struct
+{
+  int32_t tag, size, a, b;    // size is the payload that follows
+} WaveChunk;
+
+typedef void (*WaveSink) (void *arg, const void *chunk, size_t size);
+
+typedef struct
+{
+  int pop, cell, var, type;
+  char *lbl;
+} WavePlot;
+
+typedef struct
+{
+  int64_t data;   // offset of the DATA chunk
+  int64_t plots;  // offset of the PLOTS chunk in force for it
+} WaveIndex;
+
+typedef struct
+{
+  FILE *fp;
+  WaveSink sink;
+  void *sink_arg;
+  int writing;
+  int version;
+  int spawn;
+  double step;
+  int block_steps;
+
+  int plot_count;
+  WavePlot *plot;
+  int plots_changed;    // reader: a PLOTS chunk came in since it was last cleared
+  int64_t plots_off;    // offset of the PLOTS chunk in force
+
+  WaveIndex *index;
+  long index_count, index_size;
+  int indexed;          // reader: index covers the whole file
+  int64_t scan_off;     // reader: where building the index left off
+  int64_t scan_plots;
+
+    // the current block
+  int block, nrecs;
+  float *val;           // [plot][rec]
+  unsigned char *spike; // [plot][spike_stride]
+  int spike_stride;
+
+  unsigned char *buf;   // chunk buffer
+  size_t buf_size;
+} WaveFile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  // writer
+WaveFile *wave_create (const char *name, int spawn, double step);
+WaveFile *wave_create_sink (WaveSink sink, void *arg, int spawn, double step);
+WaveFile *wave_append (const char *name, int64_t size);
+int wave_write_plots (WaveFile *w, int count, const WavePlot *plot);
+int wave_write_block (WaveFile *w, int block, int nrecs, const float *val, const unsigned char *spike);
+int wave_close (WaveFile *w);
+
+  // reader
+WaveFile *wave_open (const char *name);
+int wave_is_binary (const char *name);
+int wave_read_block (WaveFile *w);
+long wave_block_count (WaveFile *w);
+int wave_seek_block (WaveFile *w, long block);
+void wave_free (WaveFile *w);
+WaveFile *wave_decoder (void);
+int wave_decode (WaveFile *w, const void *chunk, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+  // value and spike flag of plot n at step rec of the current block
+static inline float
+wave_val (const WaveFile *w, int n, int rec)
+{
+  return w->val[(size_t) n * w->nrecs + rec];
+}
+
+static inline int
+wave_spike (const WaveFile *w, int n, int rec)
+{
+  return (w->spike[(size_t) n * w->spike_stride + rec / 8] >> (rec % 8)) & 1;
+}
+
+#endif
@@ -23,6 +23,8 @@ This file is part of the USF Neural Simulator suite.
 const unsigned char MSG_START = 0xfd;
 const unsigned char MSG_END = 0xfe; 
 const unsigned char MSG_EOF = 0xff;
+// starts a binary frame, see wavesend.h
+const unsigned char MSG_FRAME = 0xfc;
 
 // If adding more, make sure these are not P, R, U, T, these used in simloop
 const unsigned char PORT_MSG = 'O';
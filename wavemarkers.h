@@ -21,6 +21,7 @@ This file is part of the USF Neural Simulator suite.
 extern const unsigned char MSG_START; // "impossible" text values
 extern const unsigned char MSG_END;
 extern const unsigned char MSG_EOF;
+extern const unsigned char MSG_FRAME;
 extern const unsigned char PORT_MSG;
 extern const unsigned char SCRIPT_MSG;
 extern const unsigned char SIM_MSG;
@@ -0,0 +1,207 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Sender thread and ring buffer for the binary simviewer stream.  See
+   wavesend.h.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined __linux__
+#include <sys/socket.h>
+#endif
+#include "lin2ms.h"
+#include "wavemarkers.h"
+#include "wavesend.h"
+#include "util.h"
+
+#ifdef __linux__
+extern int sock_fdout;
+#else
+extern SOCKET sock_fdout;
+#define MSG_NOSIGNAL 0
+#endif
+
+#define RING_SIZE (16 * 1024 * 1024)
+
+static unsigned char *ring;
+static size_t ring_size;
+static size_t head, count;    // next byte to send, bytes queued
+static pthread_t sender;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t data_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_ready = PTHREAD_COND_INITIALIZER;
+static int running, quit, lost;
+static long frames, stalls;
+static double bytes;
+
+static int
+send_all (const unsigned char *p, size_t len)
+{
+  while (len)
+  {
+#ifdef __linux__
+    ssize_t sent = send (sock_fdout, p, len, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EINTR)
+      continue;
+    if (sent == -1)
+      return 0;
+#else
+    int sent = send (sock_fdout, (const char *) p, len, 0);
+    if (sent == SOCKET_ERROR)
+      return 0;
+#endif
+    p += sent;
+    len -= sent;
+  }
+  return 1;
+}
+
+static void *
+send_loop (void *arg)
+{
+  (void) arg;
+  pthread_mutex_lock (&lock);
+  while (1)
+  {
+    size_t len;
+    int ok;
+
+    while (count == 0 && !quit)
+      pthread_cond_wait (&data_ready, &lock);
+    if (count == 0)
+      break;
+      // the queued bytes up to the end of the ring, the producer only
+      // writes past them
+    len = count < ring_size - head ? count : ring_size - head;
+    pthread_mutex_unlock (&lock);
+    ok = send_all (ring + head, len);
+    pthread_mutex_lock (&lock);
+    head = (head + len) % ring_size;
+    count -= len;
+    bytes += len;
+    if (!ok)
+    {
+      lost = 1;
+      head = count = 0;
+      pthread_cond_broadcast (&space_ready);
+      break;
+    }
+    pthread_cond_broadcast (&space_ready);
+  }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+void
+wavesend_start (void)
+{
+  if (running)
+    return;
+  ring_size = RING_SIZE;
+  TMALLOC (ring, ring_size);
+  head = count = 0;
+  quit = lost = 0;
+  frames = stalls = 0;
+  bytes = 0;
+  pthread_create (&sender, NULL, send_loop, NULL) == 0 || DIE;
+  running = 1;
+}
+
+// copy len bytes to the free end of the ring, wrapping if need be
+static void
+put (const void *src, size_t len)
+{
+  size_t at = (head + count) % ring_size;
+  size_t first = len < ring_size - at ? len : ring_size - at;
+
+  memcpy (ring + at, src, first);
+  memcpy (ring, (const unsigned char *) src + first, len - first);
+  count += len;
+}
+
+void
+wavesend_chunk (void *arg, const void *chunk, size_t size)
+{
+  unsigned char prefix[WAVE_FRAME_PREFIX] = {MSG_FRAME, WAVE_FRAME_VERSION, 0, 0};
+  size_t total = sizeof prefix + size;
+  (void) arg;
+
+  pthread_mutex_lock (&lock);
+  if (!running || lost)
+  {
+    pthread_mutex_unlock (&lock);
+    return;
+  }
+  if (total > ring_size)  // wait until the sender is idle, then grow it
+  {
+    while (count && !lost)
+      pthread_cond_wait (&space_ready, &lock);
+    ring_size = total * 2;
+    TREALLOC (ring, ring_size);
+    head = 0;
+  }
+  if (ring_size - count < total)
+  {
+    stalls++;
+    while (ring_size - count < total && !lost)
+      pthread_cond_wait (&space_ready, &lock);
+  }
+  if (!lost)
+  {
+    put (prefix, sizeof prefix);
+    put (chunk, size);
+    frames++;
+    pthread_cond_signal (&data_ready);
+  }
+  pthread_mutex_unlock (&lock);
+}
+
+int
+wavesend_lost (void)
+{
+  int ret;
+
+  pthread_mutex_lock (&lock);
+  ret = lost;
+  pthread_mutex_unlock (&lock);
+  return ret;
+}
+
+// Send whatever is queued and stop the sender.
+void
+wavesend_stop (void)
+{
+  if (!running)
+    return;
+  pthread_mutex_lock (&lock);
+  quit = 1;
+  pthread_cond_signal (&data_ready);
+  pthread_mutex_unlock (&lock);
+  pthread_join (sender, NULL);
+  running = 0;
+  free (ring);
+  ring = NULL;
+  fprintf (stdout, "SIMRUN: sent %ld frames, %.1f MB to simviewer, the simulation waited for the sender %ld time%s\n",
+           frames, bytes / (1024 * 1024), stalls, stalls == 1 ? "" : "s");
+}
@@ -0,0 +1,55 @@
+/*(Copyright 2005-2020 Kendall F. Morris
+
+This file is part of the USF Neural Simulator suite.
+
+    The Neural Simulator suite is free software: you can redistribute
+    it and/or modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation, either
+    version 3 of the License, or (at your option) any later version.
+
+    The suite is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the suite.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef WAVESEND_H
+#define WAVESEND_H
+
+#include <stddef.h>
+
+/* Binary plot data stream from simrun to simviewer.
+
+   The stream is the chunks of a binary wave file (see wavefile.h), each
+   sent as a frame: a 4 byte prefix of MSG_FRAME, the frame version and
+   two zero bytes, then the chunk with its header.  The first frame
+   carries a HEADER chunk, then come PLOTS and DATA chunks as they would
+   in the file.  MSG_EOF still goes between frames at the end, and the
+   text blocks of the old protocol (MSG_START ... MSG_END) can be mixed
+   in, so simviewer takes whichever it gets.
+
+   wavesend_chunk is a WaveSink.  It copies the frame into a ring buffer
+   and returns, and a sender thread does the blocking send()s, so the
+   simulation only waits if simviewer falls a whole ring behind.
+*/
+
+#define WAVE_FRAME_VERSION 1
+#define WAVE_FRAME_PREFIX 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void wavesend_start (void);
+void wavesend_chunk (void *arg, const void *chunk, size_t size);
+int wavesend_lost (void);
+void wavesend_stop (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif